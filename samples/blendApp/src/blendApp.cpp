@@ -61,7 +61,7 @@ void blendApp::setup()
 	mParams = params::InterfaceGl( "Parameters", Vec2i( 200, 300 ) );
 	mParams.addParam( "Fps", &mFps, "", false );
 
-	mFaceShift.import( "export" );
+	mFaceShift.importAsync( "export" );
 	mFaceShift.connect();
 
 	gl::enable( GL_CULL_FACE );
@@ -1,28 +1,35 @@
 #version 120
 #extension GL_EXT_gpu_shader4 : enable
 
+// has to match GpuBlendData::Format::maxActiveShapes()
+#define MAX_ACTIVE_SHAPES 64
+
 attribute float index;
 
-uniform sampler2DRect blendshapes;
-uniform sampler2DRect normals;
+uniform sampler2DRect deltas;
+uniform sampler2DRect normalDeltas;
 uniform int numBlendshapes;
-uniform float blendshapeWeights[ 46 ];
+uniform int verticesPerRow;
+
+uniform int numActiveShapes;
+uniform int activeShapes[ MAX_ACTIVE_SHAPES ];
+uniform float activeWeights[ MAX_ACTIVE_SHAPES ];
 
 varying vec3 v;
 varying vec3 N;
 
 void main()
 {
-	vec2 uv = vec2( ( ( int( index ) & 31 ) * numBlendshapes ) + .5,
-					( int( index ) / 32 ) + .5 );
+	int vertex = int( index );
+	vec2 uv = vec2( ( vertex % verticesPerRow ) * numBlendshapes + .5,
+					( vertex / verticesPerRow ) + .5 );
 	vec3 blendshape = vec3( 0, 0, 0 );
 	vec3 normal = gl_Normal;
-	normal = texture2DRect( normals, uv ).xyz;
-	for ( int i = 0; i < numBlendshapes; i++ )
+	for ( int i = 0; i < numActiveShapes; i++ )
 	{
-		blendshape += blendshapeWeights[ i ] * texture2DRect( blendshapes, uv ).xyz;
-		normal += blendshapeWeights[ i ] * texture2DRect( normals, uv ).xyz;
-		uv += vec2( 1, 0 );
+		vec2 st = uv + vec2( activeShapes[ i ], 0 );
+		blendshape += activeWeights[ i ] * texture2DRect( deltas, st ).xyz;
+		normal += activeWeights[ i ] * texture2DRect( normalDeltas, st ).xyz;
 	}
 
 	gl_Position = gl_ModelViewProjectionMatrix * ( gl_Vertex + vec4( blendshape, 0 ) );
@@ -34,4 +41,3 @@ void main()
 	gl_TexCoord[ 0 ] = gl_MultiTexCoord0;
 	gl_FrontColor = gl_Color;
 }
-
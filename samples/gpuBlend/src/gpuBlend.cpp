@@ -30,6 +30,7 @@
 #include "cinder/TriMesh.h"
 
 #include "ciFaceshift.h"
+#include "GpuBlendData.h"
 #include "Resources.h"
 
 using namespace ci;
@@ -67,6 +68,10 @@ class gpuBlendApp : public AppBasic
 		gl::Material mMaterial;
 		void setupVbo();
 
+		mndl::faceshift::GpuBlendDataRef mBlendData;
+		vector< int > mActiveShapes;
+		vector< float > mActiveWeights;
+
 		mndl::faceshift::ciFaceShift mFaceShift;
 
 		params::InterfaceGl mParams;
@@ -118,7 +123,6 @@ void gpuBlendApp::setupVbo()
 {
 	TriMesh neutralMesh = mFaceShift.getNeutralMesh();
 	size_t numVertices = neutralMesh.getNumVertices();
-	size_t numBlendShapes = mFaceShift.getNumBlendshapes();
 
 	gl::VboMesh::Layout layout;
 
@@ -152,16 +156,39 @@ void gpuBlendApp::setupVbo()
 			&vertexIndices[ 0 ] );
 	mVboMesh.getStaticVbo().unbind();
 
+	// the packed deltas are cached next to the model export
+	fs::path cachePath = getAssetPath( "export" ) / "GpuBlend.bin";
+	mndl::faceshift::RigRef rig = mFaceShift.getRig();
+	// the maximum number of active shapes matches MAX_ACTIVE_SHAPES in Blend.vert
+	mndl::faceshift::GpuBlendData::Format blendFormat =
+		mndl::faceshift::GpuBlendData::Format().maxActiveShapes( 64 );
+	try
+	{
+		mBlendData = mndl::faceshift::GpuBlendData::read( cachePath );
+	}
+	catch ( const mndl::faceshift::GpuBlendDataExc & )
+	{
+	}
+	// the cache is packed again if the export or the format changed
+	if ( !mBlendData || !mBlendData->matches( *rig, blendFormat ) )
+	{
+		mBlendData = mndl::faceshift::GpuBlendData::create( *rig, blendFormat );
+		mBlendData->write( cachePath );
+	}
+	mActiveShapes.resize( mBlendData->getMaxActiveShapes() );
+	mActiveWeights.resize( mBlendData->getMaxActiveShapes() );
+
 	mShader.bind();
 	GLint location = mShader.getAttribLocation( "index" );
 	mVboMesh.setCustomStaticLocation( 0, location );
-	mShader.uniform( "blendshapes", 0 );
-	mShader.uniform( "normals", 1 );
+	mShader.uniform( "deltas", 0 );
+	mShader.uniform( "normalDeltas", 1 );
 	mShader.uniform( "tex", 2 );
-	mShader.uniform( "numBlendshapes", static_cast< int >( numBlendShapes ) );
+	mShader.uniform( "numBlendshapes", static_cast< int >( mBlendData->getNumBlendshapes() ) );
+	mShader.uniform( "verticesPerRow", static_cast< int >( mBlendData->getVerticesPerRow() ) );
 	mShader.unbind();
 
-	// blendshapes texture
+	// blendshape delta textures
 	gl::Texture::Format format;
 	format.setTargetRect();
 	format.setWrap( GL_CLAMP, GL_CLAMP );
@@ -169,48 +196,16 @@ void gpuBlendApp::setupVbo()
 	format.setMagFilter( GL_NEAREST );
 	format.setInternalFormat( GL_RGB32F_ARB );
 
-	int verticesPerRow = 32;
-	int txtWidth = verticesPerRow * numBlendShapes;
-	int txtHeight = math< float >::ceil( numVertices / (float)verticesPerRow );
-
-	Surface32f blendshapeSurface = Surface32f( txtWidth, txtHeight, false );
-	float *ptr = blendshapeSurface.getData();
-
-	size_t idx = 0;
-	for ( int j = 0; j < txtHeight; j++ )
-	{
-		for ( int s = 0; s < verticesPerRow; s++ )
-		{
-			for ( size_t i = 0; i < numBlendShapes; i++ )
-			{
-				*( reinterpret_cast< Vec3f * >( ptr ) ) = mFaceShift.getBlendshapeMesh( i ).getVertices()[ idx ] - neutralMesh.getVertices()[ idx ];
-				ptr += 3;
-			}
-			idx++;
-		}
-	}
-
-	mBlendshapeTexture = gl::Texture( blendshapeSurface, format );
-
-	// normals texture
-	Surface32f normalsSurface = Surface32f( txtWidth, txtHeight, false );
-	ptr = normalsSurface.getData();
-
-	idx = 0;
-	for ( int j = 0; j < txtHeight; j++ )
-	{
-		for ( int s = 0; s < verticesPerRow; s++ )
-		{
-			for ( size_t i = 0; i < numBlendShapes; i++ )
-			{
-				*( reinterpret_cast< Vec3f * >( ptr ) ) = mFaceShift.getBlendshapeMesh( i ).getNormals()[ idx ];
-				ptr += 3;
-			}
-			idx++;
-		}
-	}
-
-	mNormalsTexture = gl::Texture( normalsSurface, format );
+	// the surfaces wrap the packed data without copying
+	int width = mBlendData->getWidth();
+	int height = mBlendData->getHeight();
+	int rowBytes = width * 3 * sizeof( float );
+	Surface32f deltaSurface( const_cast< float * >( mBlendData->getDeltaData() ),
+			width, height, rowBytes, SurfaceChannelOrder::RGB );
+	mBlendshapeTexture = gl::Texture( deltaSurface, format );
+	Surface32f normalSurface( const_cast< float * >( mBlendData->getNormalDeltaData() ),
+			width, height, rowBytes, SurfaceChannelOrder::RGB );
+	mNormalsTexture = gl::Texture( normalSurface, format );
 
 	mMaterial = gl::Material( Color::gray( .0 ), Color::gray( .5 ), Color::white(), 50.f );
 }
@@ -237,7 +232,14 @@ void gpuBlendApp::draw()
 
 	mShader.bind();
 	const std::vector< float >& weights = mFaceShift.getBlendshapeWeights();
-	mShader.uniform( "blendshapeWeights", &( weights[ 0 ] ), weights.size() );
+	size_t numActive = mBlendData->getActiveShapes( &weights[ 0 ], weights.size(),
+			&mActiveShapes[ 0 ], &mActiveWeights[ 0 ] );
+	mShader.uniform( "numActiveShapes", static_cast< int >( numActive ) );
+	if ( numActive > 0 )
+	{
+		mShader.uniform( "activeShapes", &mActiveShapes[ 0 ], numActive );
+		mShader.uniform( "activeWeights", &mActiveWeights[ 0 ], numActive );
+	}
 	mShader.uniform( "flatShading", mFlatShading );
 
 	gl::enable( GL_TEXTURE_RECTANGLE_ARB );
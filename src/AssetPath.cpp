@@ -0,0 +1,29 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cinder/app/App.h"
+
+#include "AssetPath.h"
+
+namespace mndl { namespace faceshift { namespace detail {
+
+ci::fs::path findAssetPath( const ci::fs::path &path )
+{
+	return ci::app::getAssetPath( path );
+}
+
+} } } // namespace mndl::faceshift::detail
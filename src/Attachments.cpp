@@ -0,0 +1,230 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "Attachments.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+//! Returns true if \a v is too short to be normalized or not a number.
+static bool isDegenerate( const Vec3f &v )
+{
+	// the recalculated normals of zero-area triangles are NaN
+	return !( v.lengthSquared() >= 1e-12f );
+}
+
+Attachments::Attachments( RigRef rig ) :
+	mRig( rig ),
+	mDeltasNeedUpdate( false )
+{
+}
+
+size_t Attachments::addVertex( uint32_t vertex )
+{
+	if ( vertex >= mRig->getNumVertices() )
+		throw AttachmentsExc( "attachment vertex out of range" );
+
+	// the first triangle using the vertex provides the tangent
+	const std::vector< uint32_t >& indices = mRig->getNeutralMesh().getIndices();
+	for ( size_t i = 0; i < indices.size(); i++ )
+	{
+		if ( indices[ i ] != vertex )
+			continue;
+
+		size_t triangle = i / 3;
+		size_t corner = i % 3;
+		Vec3f barycentric = Vec3f::zero();
+		barycentric[ corner ] = 1.f;
+		return addPoint( triangle, barycentric );
+	}
+
+	// a vertex without triangles has no tangent
+	Point point;
+	point.mCorners[ 0 ] = point.mCorners[ 1 ] = point.mCorners[ 2 ] = addSlot( vertex );
+	point.mBarycentric = Vec3f( 1.f, 0.f, 0.f );
+	mPoints.push_back( point );
+	mPointVertices.push_back( vertex );
+	mPositions.resize( mPoints.size() );
+	mNormals.resize( mPoints.size() );
+	mTangents.resize( mPoints.size() );
+	return mPoints.size() - 1;
+}
+
+size_t Attachments::addPoint( size_t triangle, const Vec3f &barycentric )
+{
+	const std::vector< uint32_t >& indices = mRig->getNeutralMesh().getIndices();
+	if ( triangle * 3 + 2 >= indices.size() )
+		throw AttachmentsExc( "attachment triangle out of range" );
+
+	Point point;
+	size_t maxCorner = 0;
+	for ( size_t k = 0; k < 3; k++ )
+	{
+		point.mCorners[ k ] = addSlot( indices[ triangle * 3 + k ] );
+		if ( barycentric[ k ] > barycentric[ maxCorner ] )
+			maxCorner = k;
+	}
+	point.mBarycentric = barycentric;
+	mPoints.push_back( point );
+	mPointVertices.push_back( indices[ triangle * 3 + maxCorner ] );
+	mPositions.resize( mPoints.size() );
+	mNormals.resize( mPoints.size() );
+	mTangents.resize( mPoints.size() );
+	return mPoints.size() - 1;
+}
+
+bool Attachments::setRig( RigRef rig )
+{
+	if ( ( rig->getNumVertices() != mRig->getNumVertices() ) ||
+		 ( rig->getNeutralMesh().getIndices() != mRig->getNeutralMesh().getIndices() ) )
+		return false;
+
+	mRig = rig;
+	mDeltasNeedUpdate = true;
+	return true;
+}
+
+uint32_t Attachments::addSlot( uint32_t vertex )
+{
+	std::map< uint32_t, uint32_t >::const_iterator it = mVertexSlots.find( vertex );
+	if ( it != mVertexSlots.end() )
+		return it->second;
+
+	uint32_t slot = mSlotVertices.size();
+	mVertexSlots[ vertex ] = slot;
+	mSlotVertices.push_back( vertex );
+	mDeltasNeedUpdate = true;
+	return slot;
+}
+
+void Attachments::updateDeltas()
+{
+	size_t numSlots = mSlotVertices.size();
+	size_t numBlendshapes = mRig->getNumBlendshapes();
+	size_t numShapes = mRig->getNumBlendWeights();
+	const TriMesh &neutralMesh = mRig->getNeutralMesh();
+	bool hasNormals = neutralMesh.getNormals().size() == neutralMesh.getNumVertices();
+
+	mNeutralPositions.resize( numSlots );
+	mNeutralNormals.assign( numSlots, Vec3f::zero() );
+	for ( size_t j = 0; j < numSlots; j++ )
+	{
+		mNeutralPositions[ j ] = neutralMesh.getVertices()[ mSlotVertices[ j ] ];
+		if ( hasNormals )
+			mNeutralNormals[ j ] = neutralMesh.getNormals()[ mSlotVertices[ j ] ];
+	}
+
+	mPositionDeltas.resize( numShapes * numSlots );
+	mNormalDeltas.assign( numShapes * numSlots, Vec3f::zero() );
+	for ( size_t i = 0; i < numBlendshapes; i++ )
+	{
+		const TriMesh &mesh = mRig->getBlendshapeMesh( i );
+		bool shapeHasNormals = hasNormals && ( mesh.getNormals().size() == mesh.getNumVertices() );
+		for ( size_t j = 0; j < numSlots; j++ )
+		{
+			uint32_t v = mSlotVertices[ j ];
+			mPositionDeltas[ i * numSlots + j ] = mesh.getVertices()[ v ] - mNeutralPositions[ j ];
+			if ( shapeHasNormals )
+				mNormalDeltas[ i * numSlots + j ] = mesh.getNormals()[ v ] - mNeutralNormals[ j ];
+		}
+	}
+
+	// the correctives only correct the positions
+	for ( size_t i = numBlendshapes; i < numShapes; i++ )
+	{
+		for ( size_t j = 0; j < numSlots; j++ )
+			mPositionDeltas[ i * numSlots + j ] = mRig->getCorrectiveDelta( i - numBlendshapes, mSlotVertices[ j ] );
+	}
+
+	mSlotPositions.resize( numSlots );
+	mSlotNormals.resize( numSlots );
+	mDeltasNeedUpdate = false;
+}
+
+void Attachments::evaluate( const float *weights, size_t numWeights, const Rig::Pose *pose /* = NULL */ )
+{
+	if ( mDeltasNeedUpdate )
+		updateDeltas();
+
+	size_t numSlots = mSlotVertices.size();
+	size_t numShapes = std::min( numWeights, mRig->getNumBlendWeights() );
+	std::copy( mNeutralPositions.begin(), mNeutralPositions.end(), mSlotPositions.begin() );
+	std::copy( mNeutralNormals.begin(), mNeutralNormals.end(), mSlotNormals.begin() );
+	for ( size_t i = 0; i < numShapes; i++ )
+	{
+		float weight = weights[ i ];
+		if ( weight == 0.f )
+			continue;
+
+		const Vec3f *positionDeltas = &mPositionDeltas[ i * numSlots ];
+		const Vec3f *normalDeltas = &mNormalDeltas[ i * numSlots ];
+		for ( size_t j = 0; j < numSlots; j++ )
+		{
+			mSlotPositions[ j ] += weight * positionDeltas[ j ];
+			mSlotNormals[ j ] += weight * normalDeltas[ j ];
+		}
+	}
+
+	for ( size_t p = 0; p < mPoints.size(); p++ )
+	{
+		const Point &point = mPoints[ p ];
+		const Vec3f &b = point.mBarycentric;
+		const uint32_t *c = point.mCorners;
+		mPositions[ p ] = b.x * mSlotPositions[ c[ 0 ] ] + b.y * mSlotPositions[ c[ 1 ] ] +
+						  b.z * mSlotPositions[ c[ 2 ] ];
+		Vec3f normal = b.x * mSlotNormals[ c[ 0 ] ] + b.y * mSlotNormals[ c[ 1 ] ] +
+					   b.z * mSlotNormals[ c[ 2 ] ];
+
+		Vec3f edge = mSlotPositions[ c[ 1 ] ] - mSlotPositions[ c[ 0 ] ];
+		if ( isDegenerate( normal ) )
+			normal = edge.cross( mSlotPositions[ c[ 2 ] ] - mSlotPositions[ c[ 0 ] ] );
+		if ( isDegenerate( normal ) )
+		{
+			// zero-area triangle without normals, the neutral normal or a fixed axis
+			normal = b.x * mNeutralNormals[ c[ 0 ] ] + b.y * mNeutralNormals[ c[ 1 ] ] +
+					 b.z * mNeutralNormals[ c[ 2 ] ];
+			if ( isDegenerate( normal ) )
+				normal = Vec3f::zAxis();
+		}
+		normal.normalize();
+
+		// the first edge projected to the tangent plane, or any direction
+		// perpendicular to the normal for degenerate triangles
+		Vec3f tangent = edge - normal * normal.dot( edge );
+		if ( isDegenerate( tangent ) )
+		{
+			tangent = ( std::abs( normal.x ) < .9f ) ? Vec3f::xAxis() : Vec3f::yAxis();
+			tangent -= normal * normal.dot( tangent );
+		}
+		tangent.normalize();
+
+		mNormals[ p ] = normal;
+		mTangents[ p ] = tangent;
+	}
+
+	if ( ( pose != NULL ) && !mPoints.empty() )
+	{
+		mRig->transformPoints( *pose, &mPointVertices[ 0 ], mPoints.size(),
+							   &mPositions[ 0 ], &mNormals[ 0 ], &mTangents[ 0 ] );
+	}
+}
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,114 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+
+#include "Rig.h"
+
+namespace mndl { namespace faceshift {
+
+//! Thrown when an attachment point does not lie on the rig.
+class AttachmentsExc : public std::runtime_error
+{
+	public:
+		AttachmentsExc( const std::string &msg ) : std::runtime_error( msg ) {}
+};
+
+/*! Points attached to the surface of a rig, evaluated from the blendshape
+ * weights without blending the whole mesh. Only the deltas of the vertices
+ * the points lie on are kept, so an evaluation costs O(points * shapes).
+ * Every point has a position and a frame of its interpolated normal and a
+ * tangent along the first edge of its triangle.
+ */
+class Attachments
+{
+	public:
+		Attachments( RigRef rig );
+
+		//! Attaches a point to \a vertex of the neutral mesh and returns its index.
+		size_t addVertex( uint32_t vertex );
+		/*! Attaches a point at the \a barycentric coordinates of \a triangle
+		 * of the neutral mesh and returns its index.
+		 */
+		size_t addPoint( size_t triangle, const ci::Vec3f &barycentric );
+
+		size_t getNumPoints() const { return mPoints.size(); }
+		RigRef getRig() const { return mRig; }
+		/*! Moves the points to the same vertices of \a rig, for instance
+		 * a reimport of the rig. Returns false and keeps the current rig if
+		 * the neutral mesh of \a rig has a different topology.
+		 */
+		bool setRig( RigRef rig );
+
+		/*! Evaluates the points with \a numWeights blendshape \a weights,
+		 * which can be followed by the corrective activations of the rig.
+		 * If \a pose is not NULL, the points are transformed like the
+		 * vertices of their triangle corner with the largest weight.
+		 */
+		void evaluate( const float *weights, size_t numWeights, const Rig::Pose *pose = NULL );
+
+		//! Returns the position of the \a i'th point after the last evaluate().
+		const ci::Vec3f& getPosition( size_t i ) const { return mPositions[ i ]; }
+		//! Returns the unit normal of the \a i'th point after the last evaluate().
+		const ci::Vec3f& getNormal( size_t i ) const { return mNormals[ i ]; }
+		//! Returns the unit tangent of the \a i'th point perpendicular to its normal.
+		const ci::Vec3f& getTangent( size_t i ) const { return mTangents[ i ]; }
+
+	private:
+		//! Returns the slot of \a vertex, adding it if necessary.
+		uint32_t addSlot( uint32_t vertex );
+		//! Collects the deltas of the slots from the rig blendshapes.
+		void updateDeltas();
+
+		struct Point
+		{
+			//! Slots of the triangle corners.
+			uint32_t mCorners[ 3 ];
+			ci::Vec3f mBarycentric;
+		};
+
+		RigRef mRig;
+		std::vector< Point > mPoints;
+
+		//! Rig vertex of each slot.
+		std::vector< uint32_t > mSlotVertices;
+		std::map< uint32_t, uint32_t > mVertexSlots;
+		std::vector< ci::Vec3f > mNeutralPositions;
+		std::vector< ci::Vec3f > mNeutralNormals;
+		//! Deltas of the slots, the slots of each blendshape are stored together.
+		std::vector< ci::Vec3f > mPositionDeltas;
+		std::vector< ci::Vec3f > mNormalDeltas;
+		bool mDeltasNeedUpdate;
+
+		std::vector< ci::Vec3f > mSlotPositions;
+		std::vector< ci::Vec3f > mSlotNormals;
+
+		//! Vertex each point follows when transformed.
+		std::vector< uint32_t > mPointVertices;
+		std::vector< ci::Vec3f > mPositions;
+		std::vector< ci::Vec3f > mNormals;
+		std::vector< ci::Vec3f > mTangents;
+};
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,135 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/functional/hash.hpp>
+
+#include "BlendCache.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+size_t BlendCache::KeyHash::operator()( const Key &key ) const
+{
+	return boost::hash_range( key.begin(), key.end() );
+}
+
+BlendCache::BlendCache( size_t numVertices, size_t memoryBudget, float quantizationStep ) :
+	mNumVertices( numVertices ),
+	mMemoryBudget( memoryBudget ),
+	mMemoryUsage( 0 ),
+	mQuantizationStep( std::max( quantizationStep, 1e-6f ) ),
+	mLookupMissed( false )
+{
+}
+
+size_t BlendCache::calcEntrySize( size_t numWeights ) const
+{
+	// the vertices, the key held by the list entry and the map, the list
+	// node with its two links, and the map node with its next link, hash
+	// and bucket
+	return mNumVertices * sizeof( Vec3f ) + 2 * numWeights * sizeof( int32_t ) +
+		   sizeof( Entry ) + 2 * sizeof( void * ) +
+		   sizeof( EntryMap::value_type ) + 2 * sizeof( void * ) + sizeof( size_t );
+}
+
+const Vec3f* BlendCache::lookup( const float *weights, size_t numWeights )
+{
+	mLookupKey.resize( numWeights );
+	for ( size_t i = 0; i < numWeights; i++ )
+	{
+		mLookupKey[ i ] = static_cast< int32_t >( std::floor( weights[ i ] / mQuantizationStep + .5f ) );
+	}
+
+	EntryMap::iterator it = mEntryMap.find( mLookupKey );
+	if ( it == mEntryMap.end() )
+	{
+		mStats.mMisses++;
+		mLookupMissed = true;
+		return NULL;
+	}
+
+	// move to the front of the recently used list
+	mEntries.splice( mEntries.begin(), mEntries, it->second );
+	mStats.mHits++;
+	mLookupMissed = false;
+	return &it->second->mVertices[ 0 ];
+}
+
+void BlendCache::store( const Vec3f *vertices )
+{
+	size_t entrySize = calcEntrySize( mLookupKey.size() );
+	if ( !mLookupMissed || ( entrySize > mMemoryBudget ) || ( mNumVertices == 0 ) )
+		return;
+	mLookupMissed = false;
+
+	// evict the least recently used entries until the new one fits, the
+	// vertex buffer of the last evicted entry is reused
+	bool reused = false;
+	while ( !reused && ( mMemoryUsage + entrySize > mMemoryBudget ) )
+	{
+		EntryList::iterator last = --mEntries.end();
+		mEntryMap.erase( last->mKey );
+		mMemoryUsage -= calcEntrySize( last->mKey.size() );
+		mStats.mEvictions++;
+		if ( mMemoryUsage + entrySize <= mMemoryBudget )
+		{
+			mEntries.splice( mEntries.begin(), mEntries, last );
+			reused = true;
+		}
+		else
+		{
+			mEntries.erase( last );
+		}
+	}
+	if ( !reused )
+	{
+		mEntries.push_front( Entry() );
+		mEntries.front().mVertices.resize( mNumVertices );
+	}
+
+	Entry &entry = mEntries.front();
+	entry.mKey = mLookupKey;
+	std::copy( vertices, vertices + mNumVertices, entry.mVertices.begin() );
+	mEntryMap[ entry.mKey ] = mEntries.begin();
+	mMemoryUsage += entrySize;
+
+	mStats.mEntries = mEntries.size();
+	mStats.mMemoryUsage = mMemoryUsage;
+}
+
+void BlendCache::clear()
+{
+	mEntryMap.clear();
+	mEntries.clear();
+	mLookupMissed = false;
+	mMemoryUsage = 0;
+	mStats.mEntries = 0;
+	mStats.mMemoryUsage = 0;
+}
+
+void BlendCache::resetStats()
+{
+	mStats.mHits = 0;
+	mStats.mMisses = 0;
+	mStats.mEvictions = 0;
+}
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,111 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <list>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+
+namespace mndl { namespace faceshift {
+
+/*! Bounded least recently used cache of blended vertices keyed on the
+ * quantized blendshape weights. Weight vectors that quantize to the same
+ * key share the result blended from the first of them, so the quantization
+ * step bounds the error of a cache hit.
+ */
+class BlendCache
+{
+	public:
+		struct Stats
+		{
+			Stats() : mHits( 0 ), mMisses( 0 ), mEvictions( 0 ), mEntries( 0 ), mMemoryUsage( 0 ) {}
+
+			size_t mHits;
+			size_t mMisses;
+			size_t mEvictions;
+			size_t mEntries;
+			size_t mMemoryUsage; //!< bytes
+		};
+
+		/*! Creates a cache for meshes of \a numVertices vertices using at
+		 * most \a memoryBudget bytes, including the keys and the list and
+		 * map nodes of the entries. Weights are quantized to multiples of
+		 * \a quantizationStep.
+		 */
+		BlendCache( size_t numVertices, size_t memoryBudget, float quantizationStep );
+
+		/*! Looks up the blended vertices of \a weights. Returns NULL on a miss,
+		 * the result can be added with store() afterwards.
+		 */
+		const ci::Vec3f* lookup( const float *weights, size_t numWeights );
+		/*! Stores \a vertices as the result of the weights of the last
+		 * lookup() miss, evicting the least recently used entries until the
+		 * new entry fits in the memory budget.
+		 */
+		void store( const ci::Vec3f *vertices );
+
+		//! Removes all entries.
+		void clear();
+
+		size_t getNumVertices() const { return mNumVertices; }
+		size_t getMemoryBudget() const { return mMemoryBudget; }
+		float getQuantizationStep() const { return mQuantizationStep; }
+
+		//! Returns the hit and miss statistics.
+		const Stats& getStats() const { return mStats; }
+		void resetStats();
+
+	private:
+		typedef std::vector< int32_t > Key;
+
+		struct KeyHash
+		{
+			size_t operator()( const Key &key ) const;
+		};
+
+		struct Entry
+		{
+			Key mKey;
+			std::vector< ci::Vec3f > mVertices;
+		};
+
+		typedef std::list< Entry > EntryList;
+		typedef boost::unordered_map< Key, EntryList::iterator, KeyHash > EntryMap;
+
+		//! Returns the bytes used by an entry with \a numWeights weights.
+		size_t calcEntrySize( size_t numWeights ) const;
+
+		size_t mNumVertices;
+		size_t mMemoryBudget;
+		size_t mMemoryUsage;
+		float mQuantizationStep;
+
+		//! Entries in most recently used first order.
+		EntryList mEntries;
+		EntryMap mEntryMap;
+
+		Key mLookupKey;
+		bool mLookupMissed;
+
+		Stats mStats;
+};
+
+} } // namespace mndl::faceshift
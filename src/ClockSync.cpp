@@ -0,0 +1,145 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "ClockSync.h"
+
+namespace mndl { namespace faceshift {
+
+//! The drift is only fitted to windows spanning at least this many remote seconds.
+static const double sMinDriftSpan = 4.0;
+//! Larger drifts than 1000 ppm are clamped, they are not from clocks running apart.
+static const double sMaxDrift = 1e-3;
+//! Weight of a new sample in the moving delay mean and variance.
+static const double sDelayWeight = 1.0 / 32.0;
+
+ClockSync::ClockSync( size_t windowSize /* = 512 */ ) :
+	mSamples( std::max< size_t >( windowSize, 2 ) )
+{
+	reset();
+}
+
+void ClockSync::reset()
+{
+	mFirstSample = 0;
+	mNumSamples = 0;
+	mSamplesSinceFit = 0;
+	mRemoteOrigin = 0.0;
+	mOffset = 0.0;
+	mDrift = 0.0;
+	mDelayMean = 0.0;
+	mDelayVariance = 0.0;
+}
+
+double ClockSync::getJitter() const
+{
+	return std::sqrt( mDelayVariance );
+}
+
+void ClockSync::addSample( double remoteTime, double localTime )
+{
+	if ( mNumSamples > 0 )
+	{
+		const Sample &last = mSamples[ ( mFirstSample + mNumSamples - 1 ) % mSamples.size() ];
+		if ( remoteTime < last.mRemoteTime )
+			reset();
+	}
+	if ( mNumSamples == 0 )
+		mRemoteOrigin = remoteTime;
+
+	Sample sample;
+	sample.mRemoteTime = remoteTime;
+	sample.mDifference = localTime - remoteTime;
+	if ( mNumSamples < mSamples.size() )
+	{
+		mSamples[ ( mFirstSample + mNumSamples ) % mSamples.size() ] = sample;
+		mNumSamples++;
+	}
+	else
+	{
+		mSamples[ mFirstSample ] = sample;
+		mFirstSample = ( mFirstSample + 1 ) % mSamples.size();
+	}
+
+	if ( ( mNumSamples == 1 ) || ( ++mSamplesSinceFit >= std::max< size_t >( mSamples.size() / 16, 1 ) ) )
+	{
+		fit();
+		mSamplesSinceFit = 0;
+	}
+	else
+	{
+		// the samples which left the window since the fit can only keep the line lower
+		mOffset = std::min( mOffset, sample.mDifference - mDrift * ( remoteTime - mRemoteOrigin ) );
+	}
+
+	// the delay above the envelope is never negative for samples in the
+	// window
+	double delay = localTime - toLocalTime( remoteTime );
+	if ( mNumSamples == 1 )
+	{
+		mDelayMean = delay;
+		mDelayVariance = 0.0;
+	}
+	else
+	{
+		double difference = delay - mDelayMean;
+		double increment = sDelayWeight * difference;
+		mDelayMean += increment;
+		mDelayVariance = ( 1.0 - sDelayWeight ) * ( mDelayVariance + difference * increment );
+	}
+}
+
+void ClockSync::fit()
+{
+	// the drift is the slope between the lowest samples of the older and
+	// the newer half of the window
+	size_t half = mNumSamples / 2;
+	const Sample &first = mSamples[ mFirstSample ];
+	const Sample &last = mSamples[ ( mFirstSample + mNumSamples - 1 ) % mSamples.size() ];
+	if ( ( half > 0 ) && ( last.mRemoteTime - first.mRemoteTime >= sMinDriftSpan ) )
+	{
+		size_t lowest[ 2 ] = { 0, half };
+		for ( size_t i = 0; i < mNumSamples; i++ )
+		{
+			size_t h = ( i < half ) ? 0 : 1;
+			const Sample &sample = mSamples[ ( mFirstSample + i ) % mSamples.size() ];
+			const Sample &low = mSamples[ ( mFirstSample + lowest[ h ] ) % mSamples.size() ];
+			if ( sample.mDifference < low.mDifference )
+				lowest[ h ] = i;
+		}
+
+		const Sample &a = mSamples[ ( mFirstSample + lowest[ 0 ] ) % mSamples.size() ];
+		const Sample &b = mSamples[ ( mFirstSample + lowest[ 1 ] ) % mSamples.size() ];
+		if ( b.mRemoteTime > a.mRemoteTime )
+		{
+			mDrift = ( b.mDifference - a.mDifference ) / ( b.mRemoteTime - a.mRemoteTime );
+			mDrift = std::max( -sMaxDrift, std::min( mDrift, sMaxDrift ) );
+		}
+	}
+
+	// the offset puts the drift line under every sample
+	mOffset = mSamples[ mFirstSample ].mDifference - mDrift * ( first.mRemoteTime - mRemoteOrigin );
+	for ( size_t i = 1; i < mNumSamples; i++ )
+	{
+		const Sample &sample = mSamples[ ( mFirstSample + i ) % mSamples.size() ];
+		mOffset = std::min( mOffset, sample.mDifference - mDrift * ( sample.mRemoteTime - mRemoteOrigin ) );
+	}
+}
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,92 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <vector>
+
+#include "cinder/Cinder.h"
+
+namespace mndl { namespace faceshift {
+
+/*! Estimates the offset and drift between a remote clock and the local
+ * clock from pairs of remote timestamps and local receive times. Network
+ * and scheduling delays only ever make a frame arrive later, so the line
+ * under the samples of the recent window, the lower envelope, is fitted
+ * instead of the mean. Delay spikes do not move the fit, they show up as
+ * jitter.
+ */
+class ClockSync
+{
+	public:
+		ClockSync( size_t windowSize = 512 );
+
+		/*! Adds a sample of a \a remoteTime received at \a localTime. The
+		 * fit is restarted if the remote clock goes backwards. The window is
+		 * fitted again after a sixteenth of it was replaced, in between a
+		 * new sample only lowers the offset if it lies under the line, so
+		 * a sample costs O(1) amortized over the refits.
+		 */
+		void addSample( double remoteTime, double localTime );
+		//! Removes all samples.
+		void reset();
+
+		//! Returns the number of samples in the window.
+		size_t getNumSamples() const { return mNumSamples; }
+
+		/*! Returns the local time a frame stamped with \a remoteTime arrives at
+		 * with the lowest delay seen in the window.
+		 */
+		double toLocalTime( double remoteTime ) const
+		{
+			return remoteTime + mOffset + mDrift * ( remoteTime - mRemoteOrigin );
+		}
+		//! Returns the local minus the remote time at the first sample after a reset.
+		double getOffset() const { return mOffset; }
+		//! Returns the drift of the local clock relative to the remote clock in seconds per second.
+		double getDrift() const { return mDrift; }
+		//! Returns the mean delay of the frames above the lowest delay.
+		double getDelay() const { return mDelayMean; }
+		//! Returns the standard deviation of the frame delays.
+		double getJitter() const;
+
+	private:
+		//! Fits the lower envelope to the samples of the window.
+		void fit();
+
+		struct Sample
+		{
+			double mRemoteTime;
+			//! Local minus remote time.
+			double mDifference;
+		};
+
+		//! Ring buffer of the recent samples.
+		std::vector< Sample > mSamples;
+		size_t mFirstSample;
+		size_t mNumSamples;
+		//! Number of samples added since the last fit().
+		size_t mSamplesSinceFit;
+
+		//! Remote time of the first sample, the drift is relative to it.
+		double mRemoteOrigin;
+		double mOffset;
+		double mDrift;
+		double mDelayMean;
+		double mDelayVariance;
+};
+
+} } // namespace mndl::faceshift
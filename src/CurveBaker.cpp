@@ -0,0 +1,310 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <utility>
+
+#include "ciFaceShift.h"
+#include "CurveBaker.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+namespace {
+
+const uint32_t sCurvesMagic = 0x46534356; // 'FSCV'
+const uint32_t sCurvesVersion = 1;
+
+float error( const float &a, const float &b ) { return std::abs( a - b ); }
+float error( const Vec3f &a, const Vec3f &b ) { return a.distance( b ); }
+float error( const Quatf &a, const Quatf &b )
+{
+	return 2.f * std::acos( std::min( std::abs( a.dot( b ) ), 1.f ) );
+}
+
+/*! Reduces the samples in \a values at \a times to the keys of \a curve,
+ * so that the curve differs from every sample by at most \a tolerance.
+ */
+template < typename T >
+void fitCurve( const std::vector< float > &times, const std::vector< T > &values,
+			   float tolerance, KeyframeCurve< T > *curve )
+{
+	curve->mTimes.clear();
+	curve->mValues.clear();
+	size_t numSamples = values.size();
+	if ( numSamples == 0 )
+		return;
+
+	// Douglas-Peucker with an explicit stack, splitting the key ranges at
+	// the sample with the largest error
+	std::vector< bool > keep( numSamples, false );
+	keep[ 0 ] = true;
+	keep[ numSamples - 1 ] = true;
+
+	std::vector< std::pair< size_t, size_t > > ranges;
+	ranges.push_back( std::make_pair( 0, numSamples - 1 ) );
+	while ( !ranges.empty() )
+	{
+		size_t first = ranges.back().first;
+		size_t last = ranges.back().second;
+		ranges.pop_back();
+
+		float maxError = 0.f;
+		size_t maxIndex = first;
+		float duration = times[ last ] - times[ first ];
+		for ( size_t i = first + 1; i < last; i++ )
+		{
+			float t = ( duration > 0.f ) ? ( times[ i ] - times[ first ] ) / duration : 0.f;
+			float e = error( detail::interpolate( values[ first ], values[ last ], t ), values[ i ] );
+			if ( e > maxError )
+			{
+				maxError = e;
+				maxIndex = i;
+			}
+		}
+
+		if ( maxError > tolerance )
+		{
+			keep[ maxIndex ] = true;
+			ranges.push_back( std::make_pair( first, maxIndex ) );
+			ranges.push_back( std::make_pair( maxIndex, last ) );
+		}
+	}
+
+	for ( size_t i = 0; i < numSamples; i++ )
+	{
+		if ( keep[ i ] )
+		{
+			curve->mTimes.push_back( times[ i ] );
+			curve->mValues.push_back( values[ i ] );
+		}
+	}
+}
+
+//! Flips the quaternions to the hemisphere of their predecessor, so they are interpolated along the shorter arc.
+std::vector< Quatf > continuous( const std::vector< Quatf > &rotations )
+{
+	std::vector< Quatf > result( rotations );
+	for ( size_t i = 1; i < result.size(); i++ )
+	{
+		if ( result[ i ].dot( result[ i - 1 ] ) < 0.f )
+		{
+			const Quatf &q = result[ i ];
+			result[ i ] = Quatf( -q.w, -q.v.x, -q.v.y, -q.v.z );
+		}
+	}
+	return result;
+}
+
+template < typename T >
+inline void writeRaw( std::ostream &os, const T &data )
+{
+	os.write( reinterpret_cast< const char * >( &data ), sizeof( T ) );
+}
+
+template < typename T >
+inline void readRaw( std::istream &is, T &data )
+{
+	is.read( reinterpret_cast< char * >( &data ), sizeof( T ) );
+}
+
+template < typename T >
+void writeCurve( std::ostream &os, const KeyframeCurve< T > &curve )
+{
+	writeRaw( os, uint32_t( curve.mTimes.size() ) );
+	if ( curve.mTimes.empty() )
+		return;
+	os.write( reinterpret_cast< const char * >( &curve.mTimes[ 0 ] ), curve.mTimes.size() * sizeof( float ) );
+	os.write( reinterpret_cast< const char * >( &curve.mValues[ 0 ] ), curve.mValues.size() * sizeof( T ) );
+}
+
+//! Returns the bytes left after the read position of \a is in a file of \a fileSize bytes.
+inline uint64_t getRemainingSize( std::istream &is, uint64_t fileSize )
+{
+	std::streamoff position = is.tellg();
+	if ( ( position < 0 ) || ( static_cast< uint64_t >( position ) > fileSize ) )
+		return 0;
+	return fileSize - static_cast< uint64_t >( position );
+}
+
+template < typename T >
+void readCurve( std::istream &is, uint64_t fileSize, KeyframeCurve< T > *curve )
+{
+	uint32_t numKeys = 0;
+	readRaw( is, numKeys );
+	if ( !is || ( uint64_t( numKeys ) * ( sizeof( float ) + sizeof( T ) ) > getRemainingSize( is, fileSize ) ) )
+		throw BakedCurvesExc( "truncated curve file" );
+
+	curve->mTimes.resize( numKeys );
+	curve->mValues.resize( numKeys );
+	if ( numKeys == 0 )
+		return;
+	is.read( reinterpret_cast< char * >( &curve->mTimes[ 0 ] ), numKeys * sizeof( float ) );
+	is.read( reinterpret_cast< char * >( &curve->mValues[ 0 ] ), numKeys * sizeof( T ) );
+	if ( !is )
+		throw BakedCurvesExc( "truncated curve file" );
+}
+
+} // anonymous namespace
+
+void CurveBaker::addFrame( const ciFaceShift &faceShift )
+{
+	addFrame( faceShift.getTimestamp(), faceShift.getBlendshapeWeights(),
+			  faceShift.getPosition(), faceShift.getRotation(),
+			  faceShift.getLeftEyeRotation(), faceShift.getRightEyeRotation() );
+}
+
+void CurveBaker::addFrame( double timestamp, const std::vector< float > &weights,
+						   const Vec3f &position, const Quatf &rotation,
+						   const Quatf &leftEyeRotation, const Quatf &rightEyeRotation )
+{
+	// the same frame can be polled several times from a live session
+	if ( !mTimestamps.empty() && ( timestamp <= mTimestamps.back() ) )
+		return;
+
+	mTimestamps.push_back( timestamp );
+	mWeights.push_back( weights );
+	mPositions.push_back( position );
+	mRotations.push_back( rotation );
+	mLeftEyeRotations.push_back( leftEyeRotation );
+	mRightEyeRotations.push_back( rightEyeRotation );
+}
+
+void CurveBaker::clear()
+{
+	mTimestamps.clear();
+	mWeights.clear();
+	mPositions.clear();
+	mRotations.clear();
+	mLeftEyeRotations.clear();
+	mRightEyeRotations.clear();
+}
+
+BakedCurvesRef CurveBaker::bake() const
+{
+	std::shared_ptr< BakedCurves > curves( new BakedCurves() );
+	if ( mTimestamps.empty() )
+		return curves;
+
+	size_t numFrames = mTimestamps.size();
+	std::vector< float > times( numFrames );
+	for ( size_t i = 0; i < numFrames; i++ )
+		times[ i ] = static_cast< float >( mTimestamps[ i ] - mTimestamps[ 0 ] );
+
+	curves->mStartTimestamp = mTimestamps.front();
+	curves->mDuration = times.back();
+
+	size_t numWeights = 0;
+	for ( size_t i = 0; i < numFrames; i++ )
+		numWeights = std::max( numWeights, mWeights[ i ].size() );
+
+	curves->mWeightCurves.resize( numWeights );
+	std::vector< float > channel( numFrames );
+	for ( size_t w = 0; w < numWeights; w++ )
+	{
+		for ( size_t i = 0; i < numFrames; i++ )
+			channel[ i ] = ( w < mWeights[ i ].size() ) ? mWeights[ i ][ w ] : 0.f;
+		fitCurve( times, channel, mFormat.getWeightTolerance(), &curves->mWeightCurves[ w ] );
+	}
+
+	fitCurve( times, mPositions, mFormat.getPositionTolerance(), &curves->mPositionCurve );
+	fitCurve( times, continuous( mRotations ), mFormat.getRotationTolerance(), &curves->mRotationCurve );
+	fitCurve( times, continuous( mLeftEyeRotations ), mFormat.getRotationTolerance(), &curves->mLeftEyeCurve );
+	fitCurve( times, continuous( mRightEyeRotations ), mFormat.getRotationTolerance(), &curves->mRightEyeCurve );
+
+	return curves;
+}
+
+size_t BakedCurves::getNumKeys() const
+{
+	size_t numKeys = mPositionCurve.getNumKeys() + mRotationCurve.getNumKeys() +
+		mLeftEyeCurve.getNumKeys() + mRightEyeCurve.getNumKeys();
+	for ( size_t i = 0; i < mWeightCurves.size(); i++ )
+		numKeys += mWeightCurves[ i ].getNumKeys();
+	return numKeys;
+}
+
+void BakedCurves::getBlendshapeWeights( float time, float *weights ) const
+{
+	for ( size_t i = 0; i < mWeightCurves.size(); i++ )
+		weights[ i ] = mWeightCurves[ i ].evaluate( time );
+}
+
+void BakedCurves::write( const fs::path &path ) const
+{
+	std::ofstream os( path.string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+	if ( !os )
+		throw BakedCurvesExc( "cannot create " + path.string() );
+
+	writeRaw( os, sCurvesMagic );
+	writeRaw( os, sCurvesVersion );
+	writeRaw( os, mStartTimestamp );
+	writeRaw( os, mDuration );
+	writeRaw( os, uint32_t( mWeightCurves.size() ) );
+	for ( size_t i = 0; i < mWeightCurves.size(); i++ )
+		writeCurve( os, mWeightCurves[ i ] );
+	writeCurve( os, mPositionCurve );
+	writeCurve( os, mRotationCurve );
+	writeCurve( os, mLeftEyeCurve );
+	writeCurve( os, mRightEyeCurve );
+	// closing flushes the buffered curves, which can fail as well
+	os.close();
+	if ( !os )
+		throw BakedCurvesExc( "cannot write " + path.string() );
+}
+
+BakedCurvesRef BakedCurves::read( const fs::path &path )
+{
+	std::ifstream is( path.string().c_str(), std::ios::in | std::ios::binary );
+	if ( !is )
+		throw BakedCurvesExc( "cannot open " + path.string() );
+	is.seekg( 0, std::ios::end );
+	uint64_t fileSize = static_cast< uint64_t >( std::max< std::streamoff >( is.tellg(), 0 ) );
+	is.seekg( 0, std::ios::beg );
+
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	readRaw( is, magic );
+	readRaw( is, version );
+	if ( ( magic != sCurvesMagic ) || ( version != sCurvesVersion ) )
+		throw BakedCurvesExc( path.string() + " is not a curve file" );
+
+	std::shared_ptr< BakedCurves > curves( new BakedCurves() );
+	uint32_t numWeights = 0;
+	readRaw( is, curves->mStartTimestamp );
+	readRaw( is, curves->mDuration );
+	readRaw( is, numWeights );
+	// the counts are checked against the file size before allocating,
+	// every curve takes at least its key count
+	if ( !is || ( ( uint64_t( numWeights ) + 4 ) * sizeof( uint32_t ) > getRemainingSize( is, fileSize ) ) )
+		throw BakedCurvesExc( "truncated curve file" );
+
+	curves->mWeightCurves.resize( numWeights );
+	for ( size_t i = 0; i < numWeights; i++ )
+		readCurve( is, fileSize, &curves->mWeightCurves[ i ] );
+	readCurve( is, fileSize, &curves->mPositionCurve );
+	readCurve( is, fileSize, &curves->mRotationCurve );
+	readCurve( is, fileSize, &curves->mLeftEyeCurve );
+	readCurve( is, fileSize, &curves->mRightEyeCurve );
+
+	return curves;
+}
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,188 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/Quaternion.h"
+#include "cinder/Vector.h"
+
+namespace mndl { namespace faceshift {
+
+class ciFaceShift;
+
+class BakedCurves;
+typedef std::shared_ptr< const BakedCurves > BakedCurvesRef;
+
+//! Thrown when baked curves cannot be read or written.
+class BakedCurvesExc : public std::runtime_error
+{
+	public:
+		BakedCurvesExc( const std::string &msg ) : std::runtime_error( msg ) {}
+};
+
+//! Linearly interpolated keyframe curve.
+template < typename T >
+class KeyframeCurve
+{
+	public:
+		//! Returns the interpolated value at \a time in O(log n).
+		T evaluate( float time ) const;
+
+		size_t getNumKeys() const { return mTimes.size(); }
+
+		std::vector< float > mTimes;
+		std::vector< T > mValues;
+};
+
+/*! Session baked to keyframe curves, one for each blendshape weight, the
+ * head position, the head rotation and the eye rotations. Times are in
+ * seconds relative to the first frame.
+ */
+class BakedCurves
+{
+	public:
+		/*! Reads curves written by write() from \a path.
+		 * \throws BakedCurvesExc if the file cannot be read or its curve and
+		 * key counts exceed the file size.
+		 */
+		static BakedCurvesRef read( const ci::fs::path &path );
+		/*! Writes the curves to \a path.
+		 * \throws BakedCurvesExc if the file cannot be written.
+		 */
+		void write( const ci::fs::path &path ) const;
+
+		//! Returns the duration of the session in seconds.
+		float getDuration() const { return mDuration; }
+		//! Returns the timestamp of the first baked frame.
+		double getStartTimestamp() const { return mStartTimestamp; }
+		//! Returns the total number of keys of all curves.
+		size_t getNumKeys() const;
+
+		size_t getNumBlendshapes() const { return mWeightCurves.size(); }
+		float getBlendshapeWeight( size_t i, float time ) const { return mWeightCurves[ i ].evaluate( time ); }
+		//! Evaluates all blendshape weights at \a time into \a weights.
+		void getBlendshapeWeights( float time, float *weights ) const;
+		ci::Vec3f getPosition( float time ) const { return mPositionCurve.evaluate( time ); }
+		ci::Quatf getRotation( float time ) const { return mRotationCurve.evaluate( time ); }
+		ci::Quatf getLeftEyeRotation( float time ) const { return mLeftEyeCurve.evaluate( time ); }
+		ci::Quatf getRightEyeRotation( float time ) const { return mRightEyeCurve.evaluate( time ); }
+
+		const KeyframeCurve< float >& getBlendshapeCurve( size_t i ) const { return mWeightCurves[ i ]; }
+
+	private:
+		BakedCurves() : mDuration( 0.f ), mStartTimestamp( 0.0 ) {}
+
+		float mDuration;
+		double mStartTimestamp;
+		std::vector< KeyframeCurve< float > > mWeightCurves;
+		KeyframeCurve< ci::Vec3f > mPositionCurve;
+		KeyframeCurve< ci::Quatf > mRotationCurve;
+		KeyframeCurve< ci::Quatf > mLeftEyeCurve;
+		KeyframeCurve< ci::Quatf > mRightEyeCurve;
+
+		friend class CurveBaker;
+};
+
+/*! Collects frames from a recorded or live session and reduces them to
+ * keyframe curves. Every curve keeps only the keys needed to stay within
+ * the tolerance of its channel at the collected frames.
+ */
+class CurveBaker
+{
+	public:
+		//! Error tolerances of the curve fitting.
+		class Format
+		{
+			public:
+				Format() : mWeightTolerance( .01f ), mPositionTolerance( .5f ),
+					mRotationTolerance( ci::toRadians( .25f ) ) {}
+
+				//! Sets the maximum error of the blendshape weights.
+				Format& weightTolerance( float tolerance ) { mWeightTolerance = tolerance; return *this; }
+				//! Sets the maximum error of the head position in millimetres.
+				Format& positionTolerance( float tolerance ) { mPositionTolerance = tolerance; return *this; }
+				//! Sets the maximum angular error of the rotations in radians.
+				Format& rotationTolerance( float tolerance ) { mRotationTolerance = tolerance; return *this; }
+
+				float getWeightTolerance() const { return mWeightTolerance; }
+				float getPositionTolerance() const { return mPositionTolerance; }
+				float getRotationTolerance() const { return mRotationTolerance; }
+
+			private:
+				float mWeightTolerance;
+				float mPositionTolerance;
+				float mRotationTolerance;
+		};
+
+		CurveBaker( const Format &format = Format() ) : mFormat( format ) {}
+
+		//! Adds the last frame received by \a faceShift.
+		void addFrame( const ciFaceShift &faceShift );
+		//! Adds a frame. Frames have to be added in increasing \a timestamp order.
+		void addFrame( double timestamp, const std::vector< float > &weights,
+					   const ci::Vec3f &position, const ci::Quatf &rotation,
+					   const ci::Quatf &leftEyeRotation, const ci::Quatf &rightEyeRotation );
+
+		//! Returns the number of frames collected.
+		size_t getNumFrames() const { return mTimestamps.size(); }
+		//! Removes the collected frames.
+		void clear();
+
+		//! Fits the curves to the collected frames.
+		BakedCurvesRef bake() const;
+
+	private:
+		Format mFormat;
+
+		std::vector< double > mTimestamps;
+		std::vector< std::vector< float > > mWeights;
+		std::vector< ci::Vec3f > mPositions;
+		std::vector< ci::Quatf > mRotations;
+		std::vector< ci::Quatf > mLeftEyeRotations;
+		std::vector< ci::Quatf > mRightEyeRotations;
+};
+
+namespace detail {
+
+inline float interpolate( const float &a, const float &b, float t ) { return a + ( b - a ) * t; }
+inline ci::Vec3f interpolate( const ci::Vec3f &a, const ci::Vec3f &b, float t ) { return a + ( b - a ) * t; }
+inline ci::Quatf interpolate( const ci::Quatf &a, const ci::Quatf &b, float t ) { return a.slerp( t, b ); }
+
+} // namespace detail
+
+template < typename T >
+T KeyframeCurve< T >::evaluate( float time ) const
+{
+	if ( mTimes.empty() )
+		return T();
+	if ( time <= mTimes.front() )
+		return mValues.front();
+	if ( time >= mTimes.back() )
+		return mValues.back();
+
+	size_t next = std::upper_bound( mTimes.begin(), mTimes.end(), time ) - mTimes.begin();
+	size_t prev = next - 1;
+	float t = ( time - mTimes[ prev ] ) / ( mTimes[ next ] - mTimes[ prev ] );
+	return detail::interpolate( mValues[ prev ], mValues[ next ], t );
+}
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,261 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "GpuBlendData.h"
+#include "ImportManifest.h"
+#include "Rig.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+namespace {
+
+const uint32_t sGpuBlendMagic = 0x46534742; // 'FSGB'
+const uint32_t sGpuBlendVersion = 3;
+
+template < typename T >
+inline void writeRaw( std::ostream &os, const T &data )
+{
+	os.write( reinterpret_cast< const char * >( &data ), sizeof( T ) );
+}
+
+template < typename T >
+inline void readRaw( std::istream &is, T &data )
+{
+	is.read( reinterpret_cast< char * >( &data ), sizeof( T ) );
+}
+
+uint64_t hashVectors( const std::vector< Vec3f > &vectors, uint64_t hash )
+{
+	uint64_t size = vectors.size();
+	hash = ImportManifest::hashBytes( &size, sizeof( size ), hash );
+	return vectors.empty() ? hash : ImportManifest::hashBytes( &vectors[ 0 ], vectors.size() * sizeof( Vec3f ), hash );
+}
+
+//! Hashes the vertices and normals of the neutral and blendshape meshes, which the deltas are packed from.
+uint64_t hashRig( const Rig &rig )
+{
+	uint64_t hash = hashVectors( rig.getNeutralMesh().getVertices(), ImportManifest::kHashBasis );
+	hash = hashVectors( rig.getNeutralMesh().getNormals(), hash );
+	for ( size_t s = 0; s < rig.getNumBlendshapes(); s++ )
+	{
+		hash = hashVectors( rig.getBlendshapeMesh( s ).getVertices(), hash );
+		hash = hashVectors( rig.getBlendshapeMesh( s ).getNormals(), hash );
+	}
+	return hash;
+}
+
+} // anonymous namespace
+
+GpuBlendDataRef GpuBlendData::create( const Rig &rig, const Format &format /* = Format() */ )
+{
+	size_t numVertices = rig.getNumVertices();
+	size_t numBlendshapes = rig.getNumBlendshapes();
+	if ( numBlendshapes == 0 )
+		throw GpuBlendDataExc( "rig has no blendshapes" );
+
+	std::shared_ptr< GpuBlendData > data( new GpuBlendData() );
+	data->mNumVertices = numVertices;
+	data->mNumBlendshapes = numBlendshapes;
+	data->mMaxActiveShapes = format.getMaxActiveShapes();
+	data->mRigHash = hashRig( rig );
+	data->mVerticesPerRow = format.getMaxTextureSize() / numBlendshapes;
+	if ( ( data->mVerticesPerRow == 0 ) || ( data->getHeight() > format.getMaxTextureSize() ) )
+		throw GpuBlendDataExc( "blendshape deltas do not fit in the maximum texture size" );
+
+	size_t numFloats = data->getWidth() * data->getHeight() * 3;
+	data->mDeltas.assign( numFloats, 0.f );
+	data->mNormalDeltas.assign( numFloats, 0.f );
+
+	const std::vector< Vec3f >& neutralVertices = rig.getNeutralMesh().getVertices();
+	const std::vector< Vec3f >& neutralNormals = rig.getNeutralMesh().getNormals();
+	bool hasNormals = neutralNormals.size() == numVertices;
+	for ( size_t s = 0; s < numBlendshapes; s++ )
+	{
+		const std::vector< Vec3f >& vertices = rig.getBlendshapeMesh( s ).getVertices();
+		const std::vector< Vec3f >& normals = rig.getBlendshapeMesh( s ).getNormals();
+		bool shapeHasNormals = hasNormals && ( normals.size() == numVertices );
+		for ( size_t v = 0; v < numVertices; v++ )
+		{
+			size_t offset = data->getTexelOffset( v, s );
+			Vec3f delta = vertices[ v ] - neutralVertices[ v ];
+			data->mDeltas[ offset ] = delta.x;
+			data->mDeltas[ offset + 1 ] = delta.y;
+			data->mDeltas[ offset + 2 ] = delta.z;
+
+			if ( shapeHasNormals )
+			{
+				Vec3f normalDelta = normals[ v ] - neutralNormals[ v ];
+				data->mNormalDeltas[ offset ] = normalDelta.x;
+				data->mNormalDeltas[ offset + 1 ] = normalDelta.y;
+				data->mNormalDeltas[ offset + 2 ] = normalDelta.z;
+			}
+		}
+	}
+
+	return data;
+}
+
+void GpuBlendData::write( const fs::path &path ) const
+{
+	std::ofstream os( path.string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+	if ( !os )
+		throw GpuBlendDataExc( "cannot create " + path.string() );
+
+	writeRaw( os, sGpuBlendMagic );
+	writeRaw( os, sGpuBlendVersion );
+	writeRaw( os, uint32_t( mNumVertices ) );
+	writeRaw( os, uint32_t( mNumBlendshapes ) );
+	writeRaw( os, uint32_t( mVerticesPerRow ) );
+	writeRaw( os, uint32_t( mMaxActiveShapes ) );
+	writeRaw( os, mRigHash );
+	if ( !mDeltas.empty() )
+	{
+		os.write( reinterpret_cast< const char * >( &mDeltas[ 0 ] ), mDeltas.size() * sizeof( float ) );
+		os.write( reinterpret_cast< const char * >( &mNormalDeltas[ 0 ] ), mNormalDeltas.size() * sizeof( float ) );
+	}
+	if ( !os )
+		throw GpuBlendDataExc( "cannot write " + path.string() );
+}
+
+GpuBlendDataRef GpuBlendData::read( const fs::path &path )
+{
+	std::ifstream is( path.string().c_str(), std::ios::in | std::ios::binary );
+	if ( !is )
+		throw GpuBlendDataExc( "cannot open " + path.string() );
+
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	readRaw( is, magic );
+	readRaw( is, version );
+	if ( ( magic != sGpuBlendMagic ) || ( version != sGpuBlendVersion ) )
+		throw GpuBlendDataExc( path.string() + " is not a GPU blend data file" );
+
+	uint32_t numVertices = 0;
+	uint32_t numBlendshapes = 0;
+	uint32_t verticesPerRow = 0;
+	uint32_t maxActiveShapes = 0;
+	uint64_t rigHash = 0;
+	readRaw( is, numVertices );
+	readRaw( is, numBlendshapes );
+	readRaw( is, verticesPerRow );
+	readRaw( is, maxActiveShapes );
+	readRaw( is, rigHash );
+	if ( !is || ( verticesPerRow == 0 ) )
+		throw GpuBlendDataExc( "truncated GPU blend data file" );
+
+	std::shared_ptr< GpuBlendData > data( new GpuBlendData() );
+	data->mNumVertices = numVertices;
+	data->mNumBlendshapes = numBlendshapes;
+	data->mVerticesPerRow = verticesPerRow;
+	data->mMaxActiveShapes = maxActiveShapes;
+	data->mRigHash = rigHash;
+
+	size_t numFloats = data->getWidth() * data->getHeight() * 3;
+	data->mDeltas.resize( numFloats );
+	data->mNormalDeltas.resize( numFloats );
+	if ( numFloats > 0 )
+	{
+		is.read( reinterpret_cast< char * >( &data->mDeltas[ 0 ] ), numFloats * sizeof( float ) );
+		is.read( reinterpret_cast< char * >( &data->mNormalDeltas[ 0 ] ), numFloats * sizeof( float ) );
+		if ( !is )
+			throw GpuBlendDataExc( "truncated GPU blend data file" );
+	}
+
+	return data;
+}
+
+bool GpuBlendData::matches( const Rig &rig, const Format &format /* = Format() */ ) const
+{
+	// the active shape arrays of the shader have the size of the format,
+	// the cached data can be packed with another one
+	if ( ( mNumVertices != rig.getNumVertices() ) || ( mNumBlendshapes != rig.getNumBlendshapes() ) ||
+		 ( mMaxActiveShapes != format.getMaxActiveShapes() ) ||
+		 ( getWidth() > format.getMaxTextureSize() ) || ( getHeight() > format.getMaxTextureSize() ) )
+		return false;
+
+	return mRigHash == hashRig( rig );
+}
+
+size_t GpuBlendData::getTexelOffset( size_t vertex, size_t shape ) const
+{
+	size_t x = ( vertex % mVerticesPerRow ) * mNumBlendshapes + shape;
+	size_t y = vertex / mVerticesPerRow;
+	return ( y * getWidth() + x ) * 3;
+}
+
+Vec3f GpuBlendData::getDelta( size_t vertex, size_t shape ) const
+{
+	const float *texel = &mDeltas[ getTexelOffset( vertex, shape ) ];
+	return Vec3f( texel[ 0 ], texel[ 1 ], texel[ 2 ] );
+}
+
+Vec3f GpuBlendData::getNormalDelta( size_t vertex, size_t shape ) const
+{
+	const float *texel = &mNormalDeltas[ getTexelOffset( vertex, shape ) ];
+	return Vec3f( texel[ 0 ], texel[ 1 ], texel[ 2 ] );
+}
+
+size_t GpuBlendData::getActiveShapes( const float *weights, size_t numWeights,
+									  int *indices, float *activeWeights ) const
+{
+	size_t numActive = 0;
+	numWeights = std::min( numWeights, mNumBlendshapes );
+	for ( size_t i = 0; i < numWeights; i++ )
+	{
+		if ( weights[ i ] == 0.f )
+			continue;
+
+		if ( numActive < mMaxActiveShapes )
+		{
+			indices[ numActive ] = static_cast< int >( i );
+			activeWeights[ numActive ] = weights[ i ];
+			numActive++;
+			continue;
+		}
+
+		// replace the smallest active weight if this one is larger
+		size_t smallest = 0;
+		for ( size_t k = 1; k < numActive; k++ )
+		{
+			if ( std::abs( activeWeights[ k ] ) < std::abs( activeWeights[ smallest ] ) )
+				smallest = k;
+		}
+		if ( ( numActive > 0 ) && ( std::abs( weights[ i ] ) > std::abs( activeWeights[ smallest ] ) ) )
+		{
+			indices[ smallest ] = static_cast< int >( i );
+			activeWeights[ smallest ] = weights[ i ];
+		}
+	}
+	return numActive;
+}
+
+Vec3f GpuBlendData::blendDelta( size_t vertex, const int *indices, const float *activeWeights,
+								size_t numActive ) const
+{
+	Vec3f delta = Vec3f::zero();
+	for ( size_t i = 0; i < numActive; i++ )
+		delta += activeWeights[ i ] * getDelta( vertex, indices[ i ] );
+	return delta;
+}
+
+} } // namespace mndl::faceshift
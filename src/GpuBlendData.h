@@ -0,0 +1,145 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+
+namespace mndl { namespace faceshift {
+
+class Rig;
+
+class GpuBlendData;
+typedef std::shared_ptr< const GpuBlendData > GpuBlendDataRef;
+
+//! Thrown when the GPU blend data cannot be packed, read or written.
+class GpuBlendDataExc : public std::runtime_error
+{
+	public:
+		GpuBlendDataExc( const std::string &msg ) : std::runtime_error( msg ) {}
+};
+
+/*! Blendshape position and normal deltas of a rig packed into RGB float
+ * arrays ready to be uploaded as rectangle textures. The deltas of a vertex
+ * are stored next to each other for all blendshapes, the texel of vertex
+ * \a v and blendshape \a s is at
+ * x = ( v % getVerticesPerRow() ) * getNumBlendshapes() + s,
+ * y = v / getVerticesPerRow().
+ * The data does not depend on OpenGL and can be cached in a binary file.
+ */
+class GpuBlendData
+{
+	public:
+		//! Packing options.
+		class Format
+		{
+			public:
+				Format() : mMaxTextureSize( 4096 ), mMaxActiveShapes( 64 ) {}
+
+				//! Sets the maximum width and height of the packed textures.
+				Format& maxTextureSize( size_t size ) { mMaxTextureSize = size; return *this; }
+				/*! Sets the maximum number of blendshapes returned by
+				 * getActiveShapes(), it has to match the size of the active
+				 * shape arrays in the shader.
+				 */
+				Format& maxActiveShapes( size_t numShapes ) { mMaxActiveShapes = numShapes; return *this; }
+
+				size_t getMaxTextureSize() const { return mMaxTextureSize; }
+				size_t getMaxActiveShapes() const { return mMaxActiveShapes; }
+
+			private:
+				size_t mMaxTextureSize;
+				size_t mMaxActiveShapes;
+		};
+
+		/*! Packs the deltas of \a rig.
+		 * \throws GpuBlendDataExc if the deltas do not fit in the maximum
+		 * texture size.
+		 */
+		static GpuBlendDataRef create( const Rig &rig, const Format &format = Format() );
+		/*! Reads data written by write() from \a path.
+		 * \throws GpuBlendDataExc if the file cannot be read.
+		 */
+		static GpuBlendDataRef read( const ci::fs::path &path );
+		/*! Writes the packed data to \a path.
+		 * \throws GpuBlendDataExc if the file cannot be written.
+		 */
+		void write( const ci::fs::path &path ) const;
+
+		/*! Returns true if the data was packed from the meshes of \a rig with
+		 * the options in \a format, so data read from a cache can be used for
+		 * \a rig. The meshes are compared by a hash of their vertices and
+		 * normals, which is calculated again from \a rig.
+		 */
+		bool matches( const Rig &rig, const Format &format = Format() ) const;
+
+		size_t getNumVertices() const { return mNumVertices; }
+		size_t getNumBlendshapes() const { return mNumBlendshapes; }
+		size_t getVerticesPerRow() const { return mVerticesPerRow; }
+		size_t getMaxActiveShapes() const { return mMaxActiveShapes; }
+
+		//! Returns the width of the packed textures in texels.
+		size_t getWidth() const { return mVerticesPerRow * mNumBlendshapes; }
+		//! Returns the height of the packed textures in texels.
+		size_t getHeight() const { return ( mNumVertices + mVerticesPerRow - 1 ) / mVerticesPerRow; }
+
+		//! Returns the RGB position deltas, getWidth() * getHeight() * 3 floats.
+		const float* getDeltaData() const { return mDeltas.empty() ? NULL : &mDeltas[ 0 ]; }
+		//! Returns the RGB normal deltas in the layout of the position deltas.
+		const float* getNormalDeltaData() const { return mNormalDeltas.empty() ? NULL : &mNormalDeltas[ 0 ]; }
+
+		//! Returns the position delta of \a vertex in blendshape \a shape.
+		ci::Vec3f getDelta( size_t vertex, size_t shape ) const;
+		//! Returns the normal delta of \a vertex in blendshape \a shape.
+		ci::Vec3f getNormalDelta( size_t vertex, size_t shape ) const;
+
+		/*! Compacts the non-zero \a weights to at most getMaxActiveShapes()
+		 * blendshape \a indices and \a activeWeights, both have to hold
+		 * getMaxActiveShapes() elements. If more blendshapes are active,
+		 * the ones with the largest weights are kept. Returns the number of
+		 * active blendshapes.
+		 */
+		size_t getActiveShapes( const float *weights, size_t numWeights,
+								int *indices, float *activeWeights ) const;
+
+		/*! Returns the blended position delta of \a vertex with \a numActive
+		 * active blendshapes, like the shader evaluates it.
+		 */
+		ci::Vec3f blendDelta( size_t vertex, const int *indices, const float *activeWeights,
+							  size_t numActive ) const;
+
+	private:
+		GpuBlendData() : mNumVertices( 0 ), mNumBlendshapes( 0 ), mVerticesPerRow( 1 ),
+			mMaxActiveShapes( 0 ), mRigHash( 0 ) {}
+
+		size_t getTexelOffset( size_t vertex, size_t shape ) const;
+
+		size_t mNumVertices;
+		size_t mNumBlendshapes;
+		size_t mVerticesPerRow;
+		size_t mMaxActiveShapes;
+		//! Hash of the rig meshes the deltas were packed from.
+		uint64_t mRigHash;
+		std::vector< float > mDeltas;
+		std::vector< float > mNormalDeltas;
+};
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,94 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+
+#include <boost/aligned_storage.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace mndl { namespace faceshift { namespace detail {
+
+/*! Storage for the operation of one outstanding asio handler, so a handler
+ * chain reading continuously does not allocate. Falls back to the heap if
+ * the storage is in use or too small.
+ */
+class HandlerAllocator : private boost::noncopyable
+{
+	public:
+		HandlerAllocator() : mInUse( false ) {}
+
+		void* allocate( std::size_t size )
+		{
+			if ( !mInUse && ( size <= sizeof( mStorage ) ) )
+			{
+				mInUse = true;
+				return mStorage.address();
+			}
+			return ::operator new( size );
+		}
+
+		void deallocate( void *pointer )
+		{
+			if ( pointer == mStorage.address() )
+				mInUse = false;
+			else
+				::operator delete( pointer );
+		}
+
+	private:
+		boost::aligned_storage< 1024 > mStorage;
+		bool mInUse;
+};
+
+//! Wraps \a Handler to allocate its operation from a HandlerAllocator.
+template < typename Handler >
+class AllocHandler
+{
+	public:
+		AllocHandler( HandlerAllocator &allocator, const Handler &handler ) :
+			mAllocator( allocator ), mHandler( handler ) {}
+
+		template < typename Arg1 >
+		void operator()( const Arg1 &arg1 ) { mHandler( arg1 ); }
+
+		template < typename Arg1, typename Arg2 >
+		void operator()( const Arg1 &arg1, const Arg2 &arg2 ) { mHandler( arg1, arg2 ); }
+
+		friend void* asio_handler_allocate( std::size_t size, AllocHandler< Handler > *handler )
+		{
+			return handler->mAllocator.allocate( size );
+		}
+
+		friend void asio_handler_deallocate( void *pointer, std::size_t /* size */,
+											 AllocHandler< Handler > *handler )
+		{
+			handler->mAllocator.deallocate( pointer );
+		}
+
+	private:
+		HandlerAllocator &mAllocator;
+		Handler mHandler;
+};
+
+template < typename Handler >
+inline AllocHandler< Handler > makeAllocHandler( HandlerAllocator &allocator, const Handler &handler )
+{
+	return AllocHandler< Handler >( allocator, handler );
+}
+
+} } } // namespace mndl::faceshift::detail
@@ -0,0 +1,212 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "ImportManifest.h"
+#include "Rig.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+const char *ImportManifest::kFileName = "Import.manifest";
+const uint64_t ImportManifest::kHashBasis;
+const uint32_t ImportManifest::kVersion;
+
+namespace {
+
+//! Returns true if \a path is a mesh or a definition file of the export.
+bool isSourceFile( const fs::path &path )
+{
+	if ( !fs::is_regular_file( path ) )
+		return false;
+
+	std::string extension = path.extension().string();
+	return ( extension == ".obj" ) || ( extension == ".trimesh" ) || ( extension == ".xml" );
+}
+
+uint64_t hashFile( const fs::path &path )
+{
+	std::ifstream is( path.string().c_str(), std::ios::in | std::ios::binary );
+	if ( !is )
+		throw RigExc( "cannot open " + path.string() );
+
+	uint64_t hash = ImportManifest::kHashBasis;
+	std::vector< char > buffer( 64 * 1024 );
+	while ( is )
+	{
+		is.read( &buffer[ 0 ], buffer.size() );
+		hash = ImportManifest::hashBytes( &buffer[ 0 ], static_cast< size_t >( is.gcount() ), hash );
+	}
+	if ( is.bad() )
+		throw RigExc( "cannot read " + path.string() );
+	return hash;
+}
+
+} // anonymous namespace
+
+ImportManifest ImportManifest::scan( const fs::path &folder, const ImportManifest *previous /* = NULL */ )
+{
+	ImportManifest manifest;
+	std::time_t scanTime = std::time( NULL );
+	for ( fs::directory_iterator it( folder ); it != fs::directory_iterator(); ++it )
+	{
+		if ( !isSourceFile( it->path() ) )
+			continue;
+
+		std::string fileName = it->path().filename().string();
+		const Entry *previousEntry = previous ? previous->find( fileName ) : NULL;
+		manifest.add( it->path() );
+		Entry &entry = manifest.mEntries[ fileName ];
+		// the file can still change within the second of its write time,
+		// without a write time it is compared by its contents next time
+		if ( entry.mWriteTime >= scanTime )
+			entry.mWriteTime = 0;
+		if ( previousEntry == NULL )
+			continue;
+
+		if ( ( entry.mWriteTime != 0 ) && ( previousEntry->mWriteTime == entry.mWriteTime ) )
+		{
+			if ( previousEntry->mSize == entry.mSize )
+				entry = *previousEntry;
+		}
+		else if ( previousEntry->mSize == entry.mSize )
+		{
+			// possibly written again with the same contents
+			entry.mHash = hashFile( it->path() );
+		}
+	}
+	return manifest;
+}
+
+void ImportManifest::add( const fs::path &path )
+{
+	Entry entry;
+	entry.mSize = fs::file_size( path );
+	entry.mWriteTime = fs::last_write_time( path );
+	mEntries[ path.filename().string() ] = entry;
+}
+
+void ImportManifest::hash( const fs::path &path )
+{
+	std::string fileName = path.filename().string();
+	if ( mEntries.find( fileName ) == mEntries.end() )
+		add( path );
+
+	Entry &entry = mEntries[ fileName ];
+	if ( entry.mHash == 0 )
+		entry.mHash = hashFile( path );
+}
+
+ImportManifest ImportManifest::read( const fs::path &path )
+{
+	ImportManifest manifest;
+	std::ifstream is( path.string().c_str() );
+	std::string line;
+	// the manifests of other versions are ignored
+	std::string tag;
+	uint32_t version = 0;
+	if ( std::getline( is, line ) )
+	{
+		std::istringstream versionStream( line );
+		versionStream >> tag >> version;
+	}
+	if ( ( tag != "version" ) || ( version != kVersion ) )
+		return manifest;
+
+	while ( std::getline( is, line ) )
+	{
+		// size, write time and hash, followed by the file name, which can contain spaces
+		std::istringstream lineStream( line );
+		Entry entry;
+		lineStream >> entry.mSize >> entry.mWriteTime >> std::hex >> entry.mHash;
+		std::string fileName;
+		if ( !lineStream || !std::getline( lineStream >> std::ws, fileName ) || fileName.empty() )
+			continue;
+
+		manifest.mEntries[ fileName ] = entry;
+	}
+	return manifest;
+}
+
+void ImportManifest::write( const fs::path &path ) const
+{
+	std::ofstream os( path.string().c_str(), std::ios::out | std::ios::trunc );
+	os << "version " << kVersion << "\n";
+	for ( std::map< std::string, Entry >::const_iterator it = mEntries.begin(); it != mEntries.end(); ++it )
+		os << std::dec << it->second.mSize << " " << it->second.mWriteTime << " "
+		   << std::hex << it->second.mHash << " " << it->first << "\n";
+	if ( !os )
+		throw RigExc( "cannot write " + path.string() );
+}
+
+const ImportManifest::Entry* ImportManifest::find( const std::string &fileName ) const
+{
+	std::map< std::string, Entry >::const_iterator it = mEntries.find( fileName );
+	return ( it != mEntries.end() ) ? &it->second : NULL;
+}
+
+bool ImportManifest::isModified( const fs::path &folder ) const
+{
+	size_t numFiles = 0;
+	for ( fs::directory_iterator it( folder ); it != fs::directory_iterator(); ++it )
+	{
+		if ( !isSourceFile( it->path() ) )
+			continue;
+
+		const Entry *entry = find( it->path().filename().string() );
+		if ( !entry || ( entry->mSize != fs::file_size( it->path() ) ) ||
+			 ( entry->mWriteTime != fs::last_write_time( it->path() ) ) )
+			return true;
+		numFiles++;
+	}
+	return numFiles != mEntries.size();
+}
+
+uint64_t ImportManifest::hashBytes( const void *data, size_t size, uint64_t hash /* = kHashBasis */ )
+{
+	const uint8_t *bytes = static_cast< const uint8_t * >( data );
+	for ( size_t i = 0; i < size; i++ )
+	{
+		hash ^= bytes[ i ];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool ImportManifest::isSame( const ImportManifest &a, const ImportManifest &b, const std::string &fileName )
+{
+	const Entry *entryA = a.find( fileName );
+	const Entry *entryB = b.find( fileName );
+	if ( !entryA || !entryB )
+		return entryA == entryB;
+	return entryA->isSameContents( *entryB );
+}
+
+bool ImportManifest::Entry::isSameContents( const Entry &rhs ) const
+{
+	if ( mSize != rhs.mSize )
+		return false;
+	if ( ( mHash != 0 ) && ( rhs.mHash != 0 ) )
+		return mHash == rhs.mHash;
+	return ( mWriteTime != 0 ) && ( mWriteTime == rhs.mWriteTime );
+}
+
+} } // namespace mndl::faceshift
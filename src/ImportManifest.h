@@ -0,0 +1,113 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <string>
+
+#include "cinder/Cinder.h"
+
+namespace mndl { namespace faceshift {
+
+/*! Size, write time and content hash of the .obj, .trimesh and .xml files
+ * of an fsStudio model export, keyed by file name. A rig keeps the manifest
+ * of its import to find the files which changed since. The manifest written
+ * next to the exported .trimesh files records the .obj each one was
+ * converted from. Listing the folder does not read the files, the import
+ * hashes the files it reads, so a file exported again with the same
+ * contents can be told apart from a modified one.
+ */
+class ImportManifest
+{
+	public:
+		struct Entry
+		{
+			Entry() : mSize( 0 ), mHash( 0 ), mWriteTime( 0 ) {}
+
+			uint64_t mSize;
+			//! 64-bit FNV-1a hash of the file contents, 0 if the file was not hashed.
+			uint64_t mHash;
+			//! 0 if the file was written in the second of the scan and can still change.
+			std::time_t mWriteTime;
+
+			/*! Returns true if the file has the same contents as in \a rhs.
+			 * The hashes are compared if both entries are hashed, otherwise
+			 * the same size and write time are taken as the same contents.
+			 */
+			bool isSameContents( const Entry &rhs ) const;
+		};
+
+		/*! Lists the .obj, .trimesh and .xml files in \a folder. Only the
+		 * files in \a previous with the same size and a different write time
+		 * are hashed, the entries of the unchanged ones are reused.
+		 * Files written in the current second are entered without a write
+		 * time and compared by their contents.
+		 * \throws RigExc if a file cannot be read.
+		 */
+		static ImportManifest scan( const ci::fs::path &folder, const ImportManifest *previous = NULL );
+		/*! Reads the manifest file at \a path. Returns an empty manifest if
+		 * the file does not exist or was written with another version.
+		 */
+		static ImportManifest read( const ci::fs::path &path );
+		/*! Writes the manifest file to \a path.
+		 * \throws RigExc if the file cannot be written.
+		 */
+		void write( const ci::fs::path &path ) const;
+
+		//! Returns the entry of \a fileName or NULL if the manifest has no such file.
+		const Entry* find( const std::string &fileName ) const;
+		void set( const std::string &fileName, const Entry &entry ) { mEntries[ fileName ] = entry; }
+		//! Sets the entry of the file at \a path from its size and write time, without hashing it.
+		void add( const ci::fs::path &path );
+		/*! Hashes the file at \a path unless its entry is hashed already,
+		 * adding the entry if the manifest has none.
+		 * \throws RigExc if the file cannot be read.
+		 */
+		void hash( const ci::fs::path &path );
+		bool isEmpty() const { return mEntries.empty(); }
+
+		/*! Returns true if the .obj, .trimesh or .xml files in \a folder were
+		 * added or removed, or changed their size or write time since the scan.
+		 * Only the directory is listed, the files are not read. The files
+		 * entered without a write time count as modified.
+		 */
+		bool isModified( const ci::fs::path &folder ) const;
+
+		/*! Returns true if \a fileName has the same contents in \a a and
+		 * \a b, or is missing from both.
+		 */
+		static bool isSame( const ImportManifest &a, const ImportManifest &b, const std::string &fileName );
+
+		//! Returns the 64-bit FNV-1a hash of \a size bytes at \a data, continuing from \a hash.
+		static uint64_t hashBytes( const void *data, size_t size, uint64_t hash = kHashBasis );
+		//! Initial value of the FNV-1a hash.
+		static const uint64_t kHashBasis = 14695981039346656037ULL;
+
+		//! Name of the manifest file written next to the exported .trimesh files.
+		static const char *kFileName;
+		/*! Version of the manifest file, raised when the .obj import changes
+		 * the meshes, so the .trimesh files recorded by the manifests of
+		 * earlier versions are converted again.
+		 */
+		static const uint32_t kVersion = 2;
+
+	private:
+		std::map< std::string, Entry > mEntries;
+};
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,368 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include <boost/unordered_map.hpp>
+
+#if ! defined( CINDER_MSW )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ObjParser.h"
+#include "Rig.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+namespace {
+
+//! Read-only memory mapped file, read into memory where mapping is not available.
+class MappedFile
+{
+	public:
+		MappedFile( const fs::path &path ) : mData( NULL ), mSize( 0 ), mMapped( false )
+		{
+#if ! defined( CINDER_MSW )
+			int fd = open( path.string().c_str(), O_RDONLY );
+			if ( fd < 0 )
+				throw RigExc( "cannot open " + path.string() );
+
+			struct stat st;
+			if ( fstat( fd, &st ) != 0 )
+			{
+				::close( fd );
+				throw RigExc( "cannot stat " + path.string() );
+			}
+
+			mSize = st.st_size;
+			if ( mSize > 0 )
+			{
+				void *addr = mmap( NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+				if ( addr != MAP_FAILED )
+				{
+					madvise( addr, mSize, MADV_SEQUENTIAL );
+					mData = static_cast< const char * >( addr );
+					mMapped = true;
+				}
+			}
+			::close( fd );
+			if ( mMapped || ( mSize == 0 ) )
+				return;
+#endif
+			std::ifstream ifs( path.string().c_str(), std::ios::in | std::ios::binary );
+			if ( !ifs )
+				throw RigExc( "cannot open " + path.string() );
+			ifs.seekg( 0, std::ios::end );
+			mBuffer.resize( static_cast< size_t >( ifs.tellg() ) );
+			ifs.seekg( 0, std::ios::beg );
+			if ( !mBuffer.empty() )
+				ifs.read( &mBuffer[ 0 ], mBuffer.size() );
+			mData = mBuffer.empty() ? NULL : &mBuffer[ 0 ];
+			mSize = mBuffer.size();
+		}
+
+		~MappedFile()
+		{
+#if ! defined( CINDER_MSW )
+			if ( mMapped )
+				munmap( const_cast< char * >( mData ), mSize );
+#endif
+		}
+
+		const char* begin() const { return mData; }
+		const char* end() const { return mData + mSize; }
+
+	private:
+		MappedFile( const MappedFile & );
+		MappedFile& operator=( const MappedFile & );
+
+		const char *mData;
+		size_t mSize;
+		bool mMapped;
+		std::vector< char > mBuffer;
+};
+
+inline bool isDigit( char c ) { return ( c >= '0' ) && ( c <= '9' ); }
+
+inline const char* skipSpaces( const char *p, const char *end )
+{
+	while ( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) || ( *p == '\r' ) ) )
+		p++;
+	return p;
+}
+
+inline const char* nextLine( const char *p, const char *end )
+{
+	const char *eol = static_cast< const char * >( std::memchr( p, '\n', end - p ) );
+	return eol ? eol + 1 : end;
+}
+
+//! Parses a decimal floating point number independently of the locale.
+const char* parseFloat( const char *p, const char *end, float *result )
+{
+	static const double sPowersOf10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	p = skipSpaces( p, end );
+	bool negative = false;
+	if ( ( p < end ) && ( ( *p == '-' ) || ( *p == '+' ) ) )
+	{
+		negative = ( *p == '-' );
+		p++;
+	}
+
+	// collect up to 18 significant digits in an integer, which is exact
+	uint64_t mantissa = 0;
+	int numDigits = 0;
+	int exponent = 0;
+	for ( ; ( p < end ) && isDigit( *p ); p++ )
+	{
+		if ( numDigits < 18 )
+		{
+			mantissa = mantissa * 10 + ( *p - '0' );
+			if ( mantissa > 0 )
+				numDigits++;
+		}
+		else
+		{
+			exponent++;
+		}
+	}
+	if ( ( p < end ) && ( *p == '.' ) )
+	{
+		for ( p++; ( p < end ) && isDigit( *p ); p++ )
+		{
+			if ( numDigits < 18 )
+			{
+				mantissa = mantissa * 10 + ( *p - '0' );
+				if ( mantissa > 0 )
+					numDigits++;
+				exponent--;
+			}
+		}
+	}
+	if ( ( p < end ) && ( ( *p == 'e' ) || ( *p == 'E' ) ) )
+	{
+		p++;
+		bool negativeExponent = false;
+		if ( ( p < end ) && ( ( *p == '-' ) || ( *p == '+' ) ) )
+		{
+			negativeExponent = ( *p == '-' );
+			p++;
+		}
+		int e = 0;
+		for ( ; ( p < end ) && isDigit( *p ); p++ )
+			e = std::min( e * 10 + ( *p - '0' ), 1000 );
+		exponent += negativeExponent ? -e : e;
+	}
+
+	double value = static_cast< double >( mantissa );
+	if ( ( exponent >= 0 ) && ( exponent <= 22 ) )
+		value *= sPowersOf10[ exponent ];
+	else if ( ( exponent < 0 ) && ( exponent >= -22 ) )
+		value /= sPowersOf10[ -exponent ];
+	else
+		value *= std::pow( 10.0, exponent );
+
+	*result = static_cast< float >( negative ? -value : value );
+	return p;
+}
+
+const char* parseInt( const char *p, const char *end, int *result )
+{
+	bool negative = false;
+	if ( ( p < end ) && ( *p == '-' ) )
+	{
+		negative = true;
+		p++;
+	}
+	int value = 0;
+	for ( ; ( p < end ) && isDigit( *p ); p++ )
+		value = value * 10 + ( *p - '0' );
+	*result = negative ? -value : value;
+	return p;
+}
+
+//! Converts a 1-based or negative relative obj index to a 0-based index.
+inline int resolveIndex( int index, size_t count )
+{
+	return ( index < 0 ) ? static_cast< int >( count ) + index : index - 1;
+}
+
+} // anonymous namespace
+
+ObjParser::ObjParser( const fs::path &neutralPath )
+{
+	MappedFile file( neutralPath );
+	const char *end = file.end();
+
+	std::vector< Vec3f > positions;
+	std::vector< Vec2f > texCoords;
+	std::vector< Vec3f > &vertices = mNeutralMesh.getVertices();
+	std::vector< Vec2f > &meshTexCoords = mNeutralMesh.getTexCoords();
+	std::vector< uint32_t > &indices = mNeutralMesh.getIndices();
+
+	// mesh vertex of each position and texture coordinate pair
+	boost::unordered_map< uint64_t, uint32_t > vertexMap;
+	std::vector< uint32_t > *groupVertices = NULL;
+	std::vector< uint32_t > faceVertices;
+
+	for ( const char *p = file.begin(); p < end; p = nextLine( p, end ) )
+	{
+		p = skipSpaces( p, end );
+		if ( p + 1 >= end )
+			break;
+
+		if ( ( p[ 0 ] == 'v' ) && ( p[ 1 ] == ' ' ) )
+		{
+			Vec3f v;
+			p = parseFloat( p + 1, end, &v.x );
+			p = parseFloat( p, end, &v.y );
+			p = parseFloat( p, end, &v.z );
+			positions.push_back( v );
+		}
+		else if ( ( p[ 0 ] == 'v' ) && ( p[ 1 ] == 't' ) )
+		{
+			Vec2f t;
+			p = parseFloat( p + 2, end, &t.x );
+			p = parseFloat( p, end, &t.y );
+			texCoords.push_back( t );
+		}
+		else if ( ( ( p[ 0 ] == 'g' ) || ( p[ 0 ] == 'o' ) ) && ( p[ 1 ] == ' ' ) )
+		{
+			const char *nameBegin = skipSpaces( p + 1, end );
+			const char *nameEnd = nameBegin;
+			while ( ( nameEnd < end ) && ( *nameEnd != '\n' ) && ( *nameEnd != '\r' ) &&
+					( *nameEnd != ' ' ) )
+				nameEnd++;
+			groupVertices = &mGroupVertices[ std::string( nameBegin, nameEnd ) ];
+		}
+		else if ( ( p[ 0 ] == 'f' ) && ( p[ 1 ] == ' ' ) )
+		{
+			faceVertices.clear();
+			p = skipSpaces( p + 1, end );
+			while ( ( p < end ) && ( *p != '\n' ) )
+			{
+				int position = 0;
+				int texCoord = 0;
+				const char *token = p;
+				p = parseInt( p, end, &position );
+				if ( p == token )
+					throw RigExc( "invalid face in " + neutralPath.string() );
+				if ( ( p < end ) && ( *p == '/' ) )
+				{
+					p++;
+					if ( ( p < end ) && ( *p != '/' ) )
+						p = parseInt( p, end, &texCoord );
+					// skip the normal index
+					while ( ( p < end ) && ( *p != ' ' ) && ( *p != '\t' ) && ( *p != '\n' ) && ( *p != '\r' ) )
+						p++;
+				}
+
+				int positionIndex = resolveIndex( position, positions.size() );
+				if ( ( positionIndex < 0 ) || ( positionIndex >= static_cast< int >( positions.size() ) ) )
+					throw RigExc( "invalid face in " + neutralPath.string() );
+				int texCoordIndex = ( texCoord != 0 ) ? resolveIndex( texCoord, texCoords.size() ) : -1;
+				if ( texCoordIndex >= static_cast< int >( texCoords.size() ) )
+					throw RigExc( "invalid face in " + neutralPath.string() );
+
+				uint64_t key = ( static_cast< uint64_t >( positionIndex ) << 32 ) |
+								 static_cast< uint32_t >( texCoordIndex + 1 );
+				std::pair< boost::unordered_map< uint64_t, uint32_t >::iterator, bool > inserted =
+					vertexMap.insert( std::make_pair( key, static_cast< uint32_t >( vertices.size() ) ) );
+				if ( inserted.second )
+				{
+					vertices.push_back( positions[ positionIndex ] );
+					if ( !texCoords.empty() )
+						meshTexCoords.push_back( ( texCoordIndex >= 0 ) ? texCoords[ texCoordIndex ] : Vec2f() );
+					mVertexPositions.push_back( positionIndex );
+				}
+				faceVertices.push_back( inserted.first->second );
+				if ( groupVertices != NULL )
+					groupVertices->push_back( inserted.first->second );
+
+				p = skipSpaces( p, end );
+			}
+
+			// fsStudio exports triangles, other polygons are triangulated as fans
+			for ( size_t i = 2; i < faceVertices.size(); i++ )
+			{
+				indices.push_back( faceVertices[ 0 ] );
+				indices.push_back( faceVertices[ i - 1 ] );
+				indices.push_back( faceVertices[ i ] );
+			}
+		}
+	}
+
+	mNumPositions = positions.size();
+
+	for ( std::map< std::string, std::vector< uint32_t > >::iterator it = mGroupVertices.begin();
+			it != mGroupVertices.end(); ++it )
+	{
+		std::vector< uint32_t > &groupIndices = it->second;
+		std::sort( groupIndices.begin(), groupIndices.end() );
+		groupIndices.erase( std::unique( groupIndices.begin(), groupIndices.end() ), groupIndices.end() );
+	}
+}
+
+void ObjParser::parseBlendshape( const fs::path &path, TriMesh *mesh ) const
+{
+	MappedFile file( path );
+	const char *end = file.end();
+
+	std::vector< Vec3f > positions;
+	positions.reserve( mNumPositions );
+	for ( const char *p = file.begin(); p < end; p = nextLine( p, end ) )
+	{
+		p = skipSpaces( p, end );
+		if ( ( p + 1 < end ) && ( p[ 0 ] == 'v' ) && ( p[ 1 ] == ' ' ) )
+		{
+			Vec3f v;
+			p = parseFloat( p + 1, end, &v.x );
+			p = parseFloat( p, end, &v.y );
+			p = parseFloat( p, end, &v.z );
+			positions.push_back( v );
+		}
+	}
+
+	if ( positions.size() != mNumPositions )
+		throw RigExc( "vertex count of " + path.string() + " does not match Neutral" );
+
+	*mesh = mNeutralMesh;
+	std::vector< Vec3f > &vertices = mesh->getVertices();
+	for ( size_t i = 0; i < vertices.size(); i++ )
+		vertices[ i ] = positions[ mVertexPositions[ i ] ];
+}
+
+std::vector< uint32_t > ObjParser::getGroupVertices( const std::string &group ) const
+{
+	std::map< std::string, std::vector< uint32_t > >::const_iterator it = mGroupVertices.find( group );
+	if ( it == mGroupVertices.end() )
+		return std::vector< uint32_t >();
+	return it->second;
+}
+
+} } // namespace mndl::faceshift
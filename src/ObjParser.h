@@ -0,0 +1,70 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/TriMesh.h"
+#include "cinder/Vector.h"
+
+namespace mndl { namespace faceshift {
+
+/*! Wavefront .obj parser specialized for fsStudio model exports, where
+ * every blendshape has the topology of the neutral mesh. The faces and
+ * texture coordinates are parsed from the neutral mesh only, the
+ * blendshapes only contribute their vertex positions. Files are memory
+ * mapped and parsed without locale dependent number conversion.
+ * \note The mesh vertices are ordered by the first occurrence of their
+ * position and texture coordinate pair in all faces. ci::ObjLoader may
+ * order them differently, the .trimesh files converted with it are
+ * converted again, see ImportManifest::kVersion.
+ */
+class ObjParser
+{
+	public:
+		/*! Parses the neutral mesh at \a neutralPath.
+		 * \throws RigExc if the file cannot be read.
+		 */
+		ObjParser( const ci::fs::path &neutralPath );
+
+		//! Returns the neutral mesh without normals.
+		const ci::TriMesh& getNeutralMesh() const { return mNeutralMesh; }
+
+		/*! Parses the vertex positions of the blendshape at \a path into
+		 * \a mesh, which gets the faces and texture coordinates of the
+		 * neutral mesh.
+		 * \throws RigExc if the file cannot be read or its vertex count
+		 * does not match the neutral mesh.
+		 */
+		void parseBlendshape( const ci::fs::path &path, ci::TriMesh *mesh ) const;
+
+		//! Returns the sorted mesh vertex indices used by the faces of \a group, or an empty vector.
+		std::vector< uint32_t > getGroupVertices( const std::string &group ) const;
+
+	private:
+		ci::TriMesh mNeutralMesh;
+		//! Number of positions in the neutral obj.
+		size_t mNumPositions;
+		//! Obj position index of each mesh vertex.
+		std::vector< uint32_t > mVertexPositions;
+		std::map< std::string, std::vector< uint32_t > > mGroupVertices;
+};
+
+} } // namespace mndl::faceshift
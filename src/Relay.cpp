@@ -0,0 +1,194 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "Relay.h"
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+namespace mndl { namespace faceshift {
+
+Relay::Relay( boost::asio::io_service &ioService, unsigned short tcpPort ) :
+	mIoService( ioService ),
+	mAcceptor( ioService ),
+	mUdpSocket( ioService ),
+	mNumDroppedFrames( 0 ),
+	mNumSendErrors( 0 ),
+	mClosed( false )
+{
+	if ( tcpPort != 0 )
+	{
+		tcp::endpoint endpoint( tcp::v4(), tcpPort );
+		mAcceptor.open( endpoint.protocol() );
+		mAcceptor.set_option( tcp::acceptor::reuse_address( true ) );
+		mAcceptor.bind( endpoint );
+		mAcceptor.listen();
+	}
+}
+
+std::shared_ptr< Relay > Relay::create( boost::asio::io_service &ioService, unsigned short tcpPort )
+{
+	return std::shared_ptr< Relay >( new Relay( ioService, tcpPort ) );
+}
+
+void Relay::start()
+{
+	if ( mAcceptor.is_open() )
+		startAccept();
+}
+
+Relay::~Relay()
+{
+	close();
+}
+
+void Relay::addUdpTarget( const udp::endpoint &endpoint )
+{
+	if ( !mUdpSocket.is_open() )
+		mUdpSocket.open( udp::v4() );
+
+	UdpTarget target;
+	target.mEndpoint = endpoint;
+	target.mSending = false;
+	mUdpTargets.push_back( target );
+}
+
+void Relay::close()
+{
+	mClosed = true;
+	boost::system::error_code error;
+	mAcceptor.close( error );
+	mUdpSocket.close( error );
+	for ( std::list< ClientRef >::iterator it = mClients.begin(); it != mClients.end(); ++it )
+	{
+		( *it )->mSocket.close( error );
+	}
+	mClients.clear();
+}
+
+void Relay::startAccept()
+{
+	ClientRef client( new Client( mIoService ) );
+	mAcceptor.async_accept( client->mSocket,
+			boost::bind( &Relay::handleAccept, shared_from_this(), client,
+				boost::asio::placeholders::error ) );
+}
+
+void Relay::handleAccept( ClientRef client, const boost::system::error_code& error )
+{
+	if ( mClosed || ( error == boost::asio::error::operation_aborted ) )
+		return;
+
+	if ( !error )
+	{
+		client->mSocket.set_option( tcp::no_delay( true ) );
+		mClients.push_back( client );
+	}
+	startAccept();
+}
+
+void Relay::broadcast( BufferRef buffer )
+{
+	if ( mClosed )
+		return;
+
+	for ( std::list< ClientRef >::iterator it = mClients.begin(); it != mClients.end(); ++it )
+	{
+		ClientRef client = *it;
+		if ( client->mSending )
+		{
+			// keep only the newest frame for a slow client
+			if ( client->mPendingBuffer )
+				mNumDroppedFrames++;
+			client->mPendingBuffer = buffer;
+		}
+		else
+		{
+			send( client, buffer );
+		}
+	}
+
+	for ( size_t i = 0; i < mUdpTargets.size(); i++ )
+	{
+		UdpTarget &target = mUdpTargets[ i ];
+		if ( target.mSending )
+		{
+			mNumDroppedFrames++;
+			continue;
+		}
+
+		target.mSending = true;
+		target.mSendBuffer = buffer;
+		mUdpSocket.async_send_to( boost::asio::buffer( *buffer ), target.mEndpoint,
+				boost::bind( &Relay::handleUdpSend, shared_from_this(), i,
+					boost::asio::placeholders::error ) );
+	}
+}
+
+void Relay::send( ClientRef client, BufferRef buffer )
+{
+	client->mSending = true;
+	client->mSendBuffer = buffer;
+	boost::asio::async_write( client->mSocket, boost::asio::buffer( *buffer ),
+			boost::bind( &Relay::handleSend, shared_from_this(), client,
+				boost::asio::placeholders::error ) );
+}
+
+void Relay::handleSend( ClientRef client, const boost::system::error_code& error )
+{
+	client->mSending = false;
+	client->mSendBuffer.reset();
+	if ( mClosed )
+		return;
+
+	if ( error )
+	{
+		mNumSendErrors++;
+		boost::system::error_code closeError;
+		client->mSocket.close( closeError );
+		mClients.remove( client );
+		return;
+	}
+
+	if ( client->mPendingBuffer )
+	{
+		BufferRef buffer;
+		buffer.swap( client->mPendingBuffer );
+		send( client, buffer );
+	}
+}
+
+void Relay::handleUdpSend( size_t target, const boost::system::error_code& error )
+{
+	if ( mClosed || ( error == boost::asio::error::operation_aborted ) ||
+		 ( target >= mUdpTargets.size() ) )
+		return;
+
+	// a datagram is not retried, the target gets the next frame, for
+	// instance after a port unreachable error while the receiver restarts
+	if ( error )
+		mNumSendErrors++;
+
+	mUdpTargets[ target ].mSending = false;
+	mUdpTargets[ target ].mSendBuffer.reset();
+}
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,105 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "cinder/Cinder.h"
+
+#include <boost/asio.hpp>
+
+namespace mndl { namespace faceshift {
+
+/*! Re-serves encoded fsStudio frames to downstream TCP clients and UDP
+ * targets. Every frame is encoded once and the same buffer is sent to all
+ * receivers. A receiver that is still sending the previous frame only keeps
+ * the newest pending frame, older ones are dropped instead of queued.
+ * All methods have to be called on the thread running the io_service.
+ */
+class Relay : public std::enable_shared_from_this< Relay >
+{
+	public:
+		typedef std::shared_ptr< const std::vector< char > > BufferRef;
+
+		/*! Creates a relay accepting TCP clients on \a tcpPort, or not
+		 * listening if \a tcpPort is 0. Call start() afterwards.
+		 */
+		static std::shared_ptr< Relay > create( boost::asio::io_service &ioService, unsigned short tcpPort );
+		~Relay();
+
+		//! Starts accepting clients.
+		void start();
+
+		//! Sends every frame to the UDP \a endpoint as well.
+		void addUdpTarget( const boost::asio::ip::udp::endpoint &endpoint );
+
+		//! Sends the encoded frame in \a buffer to all receivers.
+		void broadcast( BufferRef buffer );
+
+		//! Closes the listening socket and disconnects all clients.
+		void close();
+
+		//! Returns the number of connected TCP clients.
+		size_t getNumClients() const { return mClients.size(); }
+		//! Returns the number of frames replaced by a newer one before they could be sent.
+		size_t getNumDroppedFrames() const { return mNumDroppedFrames; }
+		/*! Returns the number of failed sends. A TCP client is disconnected
+		 * after a failed send, a UDP target keeps receiving the next frames.
+		 */
+		size_t getNumSendErrors() const { return mNumSendErrors; }
+
+	private:
+		Relay( boost::asio::io_service &ioService, unsigned short tcpPort );
+
+		struct Client
+		{
+			Client( boost::asio::io_service &ioService ) : mSocket( ioService ), mSending( false ) {}
+
+			boost::asio::ip::tcp::socket mSocket;
+			bool mSending;
+			BufferRef mSendBuffer;
+			BufferRef mPendingBuffer;
+		};
+		typedef std::shared_ptr< Client > ClientRef;
+
+		struct UdpTarget
+		{
+			boost::asio::ip::udp::endpoint mEndpoint;
+			bool mSending;
+			BufferRef mSendBuffer;
+		};
+
+		void startAccept();
+		void handleAccept( ClientRef client, const boost::system::error_code& error );
+		void send( ClientRef client, BufferRef buffer );
+		void handleSend( ClientRef client, const boost::system::error_code& error );
+		void handleUdpSend( size_t target, const boost::system::error_code& error );
+
+		boost::asio::io_service &mIoService;
+		boost::asio::ip::tcp::acceptor mAcceptor;
+		boost::asio::ip::udp::socket mUdpSocket;
+
+		std::list< ClientRef > mClients;
+		std::vector< UdpTarget > mUdpTargets;
+		size_t mNumDroppedFrames;
+		size_t mNumSendErrors;
+		bool mClosed;
+};
+
+} } // namespace mndl::faceshift
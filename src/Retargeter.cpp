@@ -0,0 +1,135 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+#include "cinder/Xml.h"
+
+#include "Retargeter.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+static uint32_t findName( const std::vector< std::string > &names, const std::string &name,
+						  const char *kind )
+{
+	std::vector< std::string >::const_iterator it = std::find( names.begin(), names.end(), name );
+	if ( it == names.end() )
+		throw RetargeterExc( std::string( "unknown " ) + kind + " " + name );
+	return static_cast< uint32_t >( it - names.begin() );
+}
+
+RetargeterRef Retargeter::create( DataSourceRef source,
+								  const std::vector< std::string > &sourceNames,
+								  const std::vector< std::string > &targetNames )
+{
+	std::shared_ptr< Retargeter > retargeter( new Retargeter() );
+	retargeter->mNumSources = sourceNames.size();
+	retargeter->mNumTargets = targetNames.size();
+
+	XmlTree doc( source );
+	if ( !doc.hasChild( "retarget" ) )
+		throw RetargeterExc( "missing retarget element" );
+	const XmlTree &root = doc.getChild( "retarget" );
+
+	std::vector< bool > targetUsed( targetNames.size(), false );
+	retargeter->mRowOffsets.push_back( 0 );
+	retargeter->mCurveOffsets.push_back( 0 );
+	for ( XmlTree::ConstIter targetIt = root.begin( "target" ); targetIt != root.end(); ++targetIt )
+	{
+		std::string targetName = targetIt->getAttributeValue< std::string >( "name" );
+		uint32_t target = findName( targetNames, targetName, "target" );
+		if ( targetUsed[ target ] )
+			throw RetargeterExc( "duplicate target " + targetName );
+		targetUsed[ target ] = true;
+
+		retargeter->mRowTargets.push_back( target );
+		retargeter->mRowMin.push_back( targetIt->getAttributeValue< float >( "min", -FLT_MAX ) );
+		retargeter->mRowMax.push_back( targetIt->getAttributeValue< float >( "max", FLT_MAX ) );
+
+		for ( XmlTree::ConstIter sourceIt = targetIt->begin( "source" ); sourceIt != targetIt->end(); ++sourceIt )
+		{
+			std::string sourceName = sourceIt->getAttributeValue< std::string >( "name" );
+			retargeter->mColumns.push_back( findName( sourceNames, sourceName, "source" ) );
+			retargeter->mCoefficients.push_back( sourceIt->getAttributeValue< float >( "weight", 1.f ) );
+		}
+		retargeter->mRowOffsets.push_back( retargeter->mColumns.size() );
+
+		if ( targetIt->hasChild( "curve" ) )
+		{
+			const XmlTree &curve = targetIt->getChild( "curve" );
+			size_t firstOffset = retargeter->mKeys.size();
+			for ( XmlTree::ConstIter keyIt = curve.begin( "key" ); keyIt != curve.end(); ++keyIt )
+			{
+				Key key;
+				key.mIn = keyIt->getAttributeValue< float >( "in" );
+				key.mOut = keyIt->getAttributeValue< float >( "out" );
+				retargeter->mKeys.push_back( key );
+			}
+			std::sort( retargeter->mKeys.begin() + firstOffset, retargeter->mKeys.end() );
+		}
+		retargeter->mCurveOffsets.push_back( retargeter->mKeys.size() );
+	}
+
+	return retargeter;
+}
+
+float Retargeter::evaluateCurve( size_t row, float value ) const
+{
+	uint32_t begin = mCurveOffsets[ row ];
+	uint32_t end = mCurveOffsets[ row + 1 ];
+	if ( begin == end )
+		return value;
+
+	const Key *first = &mKeys[ 0 ] + begin;
+	const Key *last = &mKeys[ 0 ] + end - 1;
+	if ( value <= first->mIn )
+		return first->mOut;
+	if ( value >= last->mIn )
+		return last->mOut;
+
+	Key key;
+	key.mIn = value;
+	const Key *next = std::upper_bound( first, last, key );
+	const Key *prev = next - 1;
+	float t = ( value - prev->mIn ) / ( next->mIn - prev->mIn );
+	return prev->mOut + t * ( next->mOut - prev->mOut );
+}
+
+void Retargeter::evaluate( const float *sources, size_t numSources, float *targets ) const
+{
+	std::memset( targets, 0, mNumTargets * sizeof( float ) );
+
+	for ( size_t row = 0; row < mRowTargets.size(); row++ )
+	{
+		float sum = 0.f;
+		for ( uint32_t k = mRowOffsets[ row ]; k < mRowOffsets[ row + 1 ]; k++ )
+		{
+			uint32_t column = mColumns[ k ];
+			if ( column < numSources )
+				sum += mCoefficients[ k ] * sources[ column ];
+		}
+
+		sum = std::max( mRowMin[ row ], std::min( sum, mRowMax[ row ] ) );
+		targets[ mRowTargets[ row ] ] = evaluateCurve( row, sum );
+	}
+}
+
+} } // namespace mndl::faceshift
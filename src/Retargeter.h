@@ -0,0 +1,108 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/DataSource.h"
+
+namespace mndl { namespace faceshift {
+
+class Retargeter;
+typedef std::shared_ptr< const Retargeter > RetargeterRef;
+
+//! Thrown when a retargeting definition cannot be loaded or compiled.
+class RetargeterExc : public std::runtime_error
+{
+	public:
+		RetargeterExc( const std::string &msg ) : std::runtime_error( msg ) {}
+};
+
+/*! Maps fsStudio blendshape weights to the weights of a custom rig with a
+ * sparse linear combination per target shape. The definition is loaded
+ * from an xml file like this:
+ * \code
+ * <retarget>
+ *   <target name="SmileWide" min="0" max="1">
+ *     <source name="MouthSmile_L" weight=".5" />
+ *     <source name="MouthSmile_R" weight=".5" />
+ *     <curve>
+ *       <key in="0" out="0" />
+ *       <key in=".5" out=".2" />
+ *       <key in="1" out="1" />
+ *     </curve>
+ *   </target>
+ * </retarget>
+ * \endcode
+ * Each target weight is the weighted sum of its sources, clamped to
+ * [min, max] and mapped through the optional piecewise linear curve.
+ * Targets not mentioned in the definition are zero.
+ */
+class Retargeter
+{
+	public:
+		/*! Loads the definition from \a source and compiles it to map the
+		 * weights named \a sourceNames to the weights named \a targetNames.
+		 * \throws RetargeterExc if the definition refers to unknown names.
+		 */
+		static RetargeterRef create( ci::DataSourceRef source,
+									 const std::vector< std::string > &sourceNames,
+									 const std::vector< std::string > &targetNames );
+
+		//! Returns the number of source weights.
+		size_t getNumSources() const { return mNumSources; }
+		//! Returns the number of target weights written by evaluate().
+		size_t getNumTargets() const { return mNumTargets; }
+
+		/*! Evaluates the \a numSources \a sources into getNumTargets()
+		 * \a targets in a single pass. Missing sources are treated as zero.
+		 */
+		void evaluate( const float *sources, size_t numSources, float *targets ) const;
+
+	private:
+		Retargeter() {}
+
+		struct Key
+		{
+			float mIn;
+			float mOut;
+
+			bool operator<( const Key &rhs ) const { return mIn < rhs.mIn; }
+		};
+
+		float evaluateCurve( size_t row, float value ) const;
+
+		size_t mNumSources;
+		size_t mNumTargets;
+
+		// compressed sparse rows, one row per target in the definition
+		std::vector< uint32_t > mRowTargets;
+		std::vector< uint32_t > mRowOffsets;
+		std::vector< uint32_t > mColumns;
+		std::vector< float > mCoefficients;
+
+		std::vector< float > mRowMin;
+		std::vector< float > mRowMax;
+		//! Offsets into mKeys for the curve of each row, with an extra end offset.
+		std::vector< uint32_t > mCurveOffsets;
+		std::vector< Key > mKeys;
+};
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,1103 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <map>
+
+#include <boost/lexical_cast.hpp>
+
+#include "cinder/DataSource.h"
+#include "cinder/DataTarget.h"
+#include "cinder/ObjLoader.h"
+#include "cinder/Xml.h"
+
+#include "ObjParser.h"
+#include "Rig.h"
+
+using namespace ci;
+
+namespace mndl { namespace faceshift {
+
+const size_t Rig::kTileSize;
+
+namespace {
+
+/*! Returns true if the .trimesh at \a trimeshPath can be loaded instead of
+ * the .obj at \a objPath. The \a conversions manifest records the .obj
+ * contents each .trimesh was converted from, a .trimesh it has no entry
+ * for was converted by another version and is stale. The .obj entry of
+ * \a manifest takes the recorded hash if the file is unchanged, or is
+ * hashed if it was written again with the same size.
+ */
+bool isTrimeshCurrent( const fs::path &objPath, const fs::path &trimeshPath,
+					   ImportManifest *manifest, const ImportManifest &conversions )
+{
+	if ( !fs::exists( trimeshPath ) )
+		return false;
+	if ( !fs::exists( objPath ) )
+		return true;
+
+	std::string objName = objPath.filename().string();
+	const ImportManifest::Entry *converted = conversions.find( objName );
+	const ImportManifest::Entry *obj = manifest->find( objName );
+	if ( ( converted == NULL ) || ( obj == NULL ) )
+		return false;
+
+	if ( ( obj->mHash == 0 ) && ( converted->mHash != 0 ) && ( obj->mSize == converted->mSize ) )
+	{
+		if ( obj->isSameContents( *converted ) )
+		{
+			ImportManifest::Entry entry = *obj;
+			entry.mHash = converted->mHash;
+			manifest->set( objName, entry );
+		}
+		else
+		{
+			manifest->hash( objPath );
+		}
+		obj = manifest->find( objName );
+	}
+	return obj->isSameContents( *converted );
+}
+
+//! Corrective shape as defined in Correctives.xml.
+struct CorrectiveDefinition
+{
+	std::string mName;
+	std::vector< std::string > mDrivers;
+	//! In-between driver weight, 0 for combinations.
+	float mWeight;
+};
+
+//! Reads the corrective definitions at \a path, if the file exists.
+std::vector< CorrectiveDefinition > readCorrectives( const fs::path &path )
+{
+	std::vector< CorrectiveDefinition > definitions;
+	if ( !fs::exists( path ) )
+		return definitions;
+
+	XmlTree doc( loadFile( path ) );
+	if ( !doc.hasChild( "correctives" ) )
+		throw RigExc( "missing correctives element in " + path.string() );
+	const XmlTree &root = doc.getChild( "correctives" );
+
+	for ( XmlTree::ConstIter it = root.begin(); it != root.end(); ++it )
+	{
+		CorrectiveDefinition definition;
+		definition.mName = it->getAttributeValue< std::string >( "name" );
+		if ( it->getTag() == "combination" )
+		{
+			for ( XmlTree::ConstIter driverIt = it->begin( "driver" ); driverIt != it->end(); ++driverIt )
+				definition.mDrivers.push_back( driverIt->getAttributeValue< std::string >( "name" ) );
+			definition.mWeight = 0.f;
+			if ( definition.mDrivers.size() < 2 )
+				throw RigExc( "combination " + definition.mName + " has less than two drivers" );
+		}
+		else if ( it->getTag() == "inbetween" )
+		{
+			definition.mDrivers.push_back( it->getAttributeValue< std::string >( "driver" ) );
+			definition.mWeight = it->getAttributeValue< float >( "weight" );
+			if ( ( definition.mWeight <= 0.f ) || ( definition.mWeight >= 1.f ) )
+				throw RigExc( "weight of in-between " + definition.mName + " is not between 0 and 1" );
+		}
+		else
+		{
+			continue;
+		}
+		definitions.push_back( definition );
+	}
+	return definitions;
+}
+
+/*! Moves the vertices of the level \a shape, which starts as a copy of the
+ * level neutral mesh, with the deltas of \a sourceShape at the \a sourceVertices.
+ */
+void mapLevelShape( const TriMesh &sourceNeutral, const TriMesh &sourceShape,
+					const std::vector< uint32_t > &sourceVertices, TriMesh *shape )
+{
+	const std::vector< Vec3f >& sourceNeutralVertices = sourceNeutral.getVertices();
+	const std::vector< Vec3f >& shapeVertices = sourceShape.getVertices();
+	std::vector< Vec3f >& vertices = shape->getVertices();
+	for ( size_t j = 0; j < vertices.size(); j++ )
+	{
+		uint32_t s = sourceVertices[ j ];
+		vertices[ j ] += shapeVertices[ s ] - sourceNeutralVertices[ s ];
+	}
+	shape->recalculateNormals();
+}
+
+/*! Loads the neutral mesh of the resolution level in \a folder and sets
+ * \a manifest to the files of the folder. The .trimesh is chosen like in
+ * the export folder, \a previous is the manifest of the previous import.
+ */
+TriMesh loadLevelNeutral( const fs::path &folder, bool exportTrimesh, const ImportManifest *previous,
+						  ImportManifest *manifest )
+{
+	fs::path trimeshPath = folder / "Neutral.trimesh";
+	fs::path objPath = folder / "Neutral.obj";
+	*manifest = ImportManifest::scan( folder, previous );
+	fs::path conversionsPath = folder / ImportManifest::kFileName;
+	ImportManifest conversions = ImportManifest::read( conversionsPath );
+
+	TriMesh trimesh;
+	if ( isTrimeshCurrent( objPath, trimeshPath, manifest, conversions ) )
+	{
+		trimesh.read( loadFile( trimeshPath ) );
+	}
+	else if ( fs::exists( objPath ) )
+	{
+		trimesh = ObjParser( objPath ).getNeutralMesh();
+		trimesh.recalculateNormals();
+		if ( exportTrimesh )
+		{
+			manifest->hash( objPath );
+			trimesh.write( writeFile( trimeshPath ) );
+			manifest->add( trimeshPath );
+			conversions.set( objPath.filename().string(), *manifest->find( objPath.filename().string() ) );
+			conversions.write( conversionsPath );
+		}
+	}
+	else
+	{
+		throw RigExc( "no Neutral mesh in " + folder.string() );
+	}
+	return trimesh;
+}
+
+/*! Simplifies \a mesh by clustering its vertices of the same vertex group
+ * in a grid of \a cellSize. Every cluster is represented by its vertex
+ * closest to the cluster center, which is written to \a sourceVertices.
+ */
+void clusterVertices( const TriMesh &mesh, const std::vector< uint8_t > &groups, float cellSize,
+					  TriMesh *result, std::vector< uint32_t > *sourceVertices )
+{
+	const std::vector< Vec3f >& vertices = mesh.getVertices();
+	size_t numVertices = vertices.size();
+
+	Vec3f minCorner = vertices[ 0 ];
+	for ( size_t j = 1; j < numVertices; j++ )
+	{
+		minCorner.x = std::min( minCorner.x, vertices[ j ].x );
+		minCorner.y = std::min( minCorner.y, vertices[ j ].y );
+		minCorner.z = std::min( minCorner.z, vertices[ j ].z );
+	}
+
+	// 20 bits for each cell coordinate and 2 bits for the vertex group,
+	// clusters are numbered in the order of their first vertex. A zero
+	// cell size, as from a single point mesh, puts every vertex group in
+	// one cell.
+	const uint64_t cellMask = ( 1 << 20 ) - 1;
+	const float maxCell = static_cast< float >( cellMask );
+	std::map< uint64_t, uint32_t > cells;
+	std::vector< uint32_t > vertexClusters( numVertices );
+	std::vector< Vec3f > centers;
+	std::vector< uint32_t > counts;
+	for ( size_t j = 0; j < numVertices; j++ )
+	{
+		Vec3f cell = ( cellSize > 0.f ) ? ( vertices[ j ] - minCorner ) / cellSize : Vec3f::zero();
+		uint64_t key = ( uint64_t( std::min( cell.x, maxCell ) ) << 42 ) |
+					   ( uint64_t( std::min( cell.y, maxCell ) ) << 22 ) |
+					   ( uint64_t( std::min( cell.z, maxCell ) ) << 2 ) |
+					   ( groups.empty() ? 0 : groups[ j ] );
+
+		std::pair< std::map< uint64_t, uint32_t >::iterator, bool > inserted =
+			cells.insert( std::make_pair( key, uint32_t( centers.size() ) ) );
+		if ( inserted.second )
+		{
+			centers.push_back( Vec3f::zero() );
+			counts.push_back( 0 );
+		}
+		uint32_t c = inserted.first->second;
+		vertexClusters[ j ] = c;
+		centers[ c ] += vertices[ j ];
+		counts[ c ]++;
+	}
+
+	size_t numClusters = centers.size();
+	std::vector< float > distances( numClusters, std::numeric_limits< float >::max() );
+	sourceVertices->assign( numClusters, 0 );
+	for ( size_t j = 0; j < numVertices; j++ )
+	{
+		uint32_t c = vertexClusters[ j ];
+		float distance = vertices[ j ].distanceSquared( centers[ c ] / static_cast< float >( counts[ c ] ) );
+		if ( distance < distances[ c ] )
+		{
+			distances[ c ] = distance;
+			( *sourceVertices )[ c ] = j;
+		}
+	}
+
+	result->clear();
+	bool hasTexCoords = mesh.hasTexCoords();
+	for ( size_t c = 0; c < numClusters; c++ )
+	{
+		uint32_t j = ( *sourceVertices )[ c ];
+		result->appendVertex( vertices[ j ] );
+		if ( hasTexCoords )
+			result->appendTexCoord( mesh.getTexCoords()[ j ] );
+	}
+
+	// triangles collapsed into a cluster are dropped
+	const std::vector< uint32_t >& indices = mesh.getIndices();
+	for ( size_t i = 0; i + 2 < indices.size(); i += 3 )
+	{
+		uint32_t a = vertexClusters[ indices[ i ] ];
+		uint32_t b = vertexClusters[ indices[ i + 1 ] ];
+		uint32_t c = vertexClusters[ indices[ i + 2 ] ];
+		if ( ( a != b ) && ( b != c ) && ( c != a ) )
+			result->appendTriangle( a, b, c );
+	}
+	result->recalculateNormals();
+}
+
+//! Orders vertex indices by the x coordinate of the vertices.
+struct VertexXLess
+{
+	VertexXLess( const std::vector< Vec3f > &vertices ) : mVertices( vertices ) {}
+
+	bool operator()( uint32_t a, uint32_t b ) const { return mVertices[ a ].x < mVertices[ b ].x; }
+	bool operator()( uint32_t a, float x ) const { return mVertices[ a ].x < x; }
+
+	const std::vector< Vec3f > &mVertices;
+};
+
+//! Finds the nearest \a source vertex for each of the \a targets.
+void findNearestVertices( const std::vector< Vec3f > &source, const std::vector< Vec3f > &targets,
+						  std::vector< uint32_t > *nearest )
+{
+	// the search walks away from the target along the x sorted vertices
+	// until the x distance alone exceeds the nearest match
+	std::vector< uint32_t > order( source.size() );
+	for ( size_t j = 0; j < order.size(); j++ )
+		order[ j ] = j;
+	VertexXLess xLess( source );
+	std::sort( order.begin(), order.end(), xLess );
+
+	nearest->resize( targets.size() );
+	for ( size_t i = 0; i < targets.size(); i++ )
+	{
+		const Vec3f &target = targets[ i ];
+		size_t start = std::lower_bound( order.begin(), order.end(), target.x, xLess ) - order.begin();
+		float nearestDistance = std::numeric_limits< float >::max();
+		uint32_t nearestIndex = 0;
+
+		for ( size_t k = start; k < order.size(); k++ )
+		{
+			float dx = source[ order[ k ] ].x - target.x;
+			if ( dx * dx >= nearestDistance )
+				break;
+			float distance = source[ order[ k ] ].distanceSquared( target );
+			if ( distance < nearestDistance )
+			{
+				nearestDistance = distance;
+				nearestIndex = order[ k ];
+			}
+		}
+		for ( size_t k = start; k-- > 0; )
+		{
+			float dx = target.x - source[ order[ k ] ].x;
+			if ( dx * dx >= nearestDistance )
+				break;
+			float distance = source[ order[ k ] ].distanceSquared( target );
+			if ( distance < nearestDistance )
+			{
+				nearestDistance = distance;
+				nearestIndex = order[ k ];
+			}
+		}
+		( *nearest )[ i ] = nearestIndex;
+	}
+}
+
+} // anonymous namespace
+
+RigRef Rig::create( const fs::path &folder, bool exportTrimesh /* = false */ )
+{
+	return create( folder, Format().exportTrimesh( exportTrimesh ) );
+}
+
+RigRef Rig::create( const fs::path &folder, const Format &format )
+{
+	return create( folder, format, NULL );
+}
+
+bool Rig::isModified() const
+{
+	if ( mManifest.isModified( mFolder ) )
+		return true;
+
+	for ( size_t l = 0; l < mLevels.size(); l++ )
+	{
+		const Rig &level = *mLevels[ l ];
+		if ( !level.mFolder.empty() && level.mManifest.isModified( level.mFolder ) )
+			return true;
+	}
+	return false;
+}
+
+RigRef Rig::reimport( const RigRef &rig )
+{
+	if ( !rig->isModified() )
+		return rig;
+
+	return create( rig->mFolder, rig->mFormat, rig.get() );
+}
+
+RigRef Rig::create( const fs::path &folder, const Format &format, const Rig *previous )
+{
+	std::shared_ptr< Rig > rig( new Rig() );
+	rig->mFolder = folder;
+	rig->mFormat = format;
+	rig->mManifest = ImportManifest::scan( folder, previous ? &previous->mManifest : NULL );
+
+	// the .obj files the .trimesh files were converted from
+	fs::path conversionsPath = folder / ImportManifest::kFileName;
+	ImportManifest conversions = ImportManifest::read( conversionsPath );
+	bool conversionsChanged = false;
+
+	// the blendshape deltas are relative to the neutral mesh, nothing can be
+	// reused if it changed
+	bool reuseNeutral = ( previous != NULL ) &&
+		ImportManifest::isSame( rig->mManifest, previous->mManifest, "Neutral.obj" ) &&
+		ImportManifest::isSame( rig->mManifest, previous->mManifest, "Neutral.trimesh" );
+	// blendshape of the previous rig each blendshape is reused from or -1
+	std::vector< int > previousShapes;
+
+	std::vector< CorrectiveDefinition > correctives = readCorrectives( folder / "Correctives.xml" );
+	std::map< std::string, TriMesh > correctiveMeshes;
+	for ( size_t i = 0; i < correctives.size(); i++ )
+		correctiveMeshes[ correctives[ i ].mName ] = TriMesh();
+
+	std::vector< fs::path > folderContents;
+	copy( fs::directory_iterator( folder ), fs::directory_iterator(), std::back_inserter( folderContents ) );
+	std::sort( folderContents.begin(), folderContents.end() );
+
+	// the topology and the vertex groups are parsed from the neutral obj
+	// only, the blendshape objs just provide the vertex positions
+	std::shared_ptr< ObjParser > parser;
+	fs::path neutralObjPath = folder / "Neutral.obj";
+	if ( !reuseNeutral && fs::exists( neutralObjPath ) )
+		parser = std::shared_ptr< ObjParser >( new ObjParser( neutralObjPath ) );
+
+	bool hasNeutral = false;
+	for ( std::vector< fs::path >::const_iterator it = folderContents.begin();
+			it != folderContents.end(); ++it )
+	{
+		if ( !fs::is_regular_file( *it ) )
+			continue;
+
+		std::string extension = it->extension().string();
+		if ( ( extension != ".obj" ) && ( extension != ".trimesh" ) )
+			continue;
+
+		// only one of the .obj and the .trimesh with the same name is loaded
+		fs::path objPath = *it;
+		objPath.replace_extension( ".obj" );
+		fs::path trimeshPath = *it;
+		trimeshPath.replace_extension( ".trimesh" );
+		bool trimeshCurrent = isTrimeshCurrent( objPath, trimeshPath, &rig->mManifest, conversions );
+		if ( ( extension == ".obj" ) == trimeshCurrent )
+			continue;
+
+		std::string stem = it->stem().string();
+		bool isCorrective = correctiveMeshes.count( stem ) > 0;
+		int previousShape = -1;
+		if ( reuseNeutral && ( stem != "Neutral" ) &&
+			 ImportManifest::isSame( rig->mManifest, previous->mManifest, objPath.filename().string() ) &&
+			 ImportManifest::isSame( rig->mManifest, previous->mManifest, trimeshPath.filename().string() ) )
+			previousShape = isCorrective ? previous->findCorrective( stem ) : previous->findBlendshape( stem );
+
+		TriMesh trimesh;
+		if ( ( stem == "Neutral" ) && reuseNeutral )
+		{
+			trimesh = previous->mNeutralMesh;
+		}
+		else if ( previousShape >= 0 )
+		{
+			trimesh = isCorrective ? previous->mCorrectiveMeshes[ previousShape ] :
+									 previous->mBlendshapeMeshes[ previousShape ];
+		}
+		else if ( extension == ".obj" )
+		{
+			if ( !parser && fs::exists( neutralObjPath ) )
+				parser = std::shared_ptr< ObjParser >( new ObjParser( neutralObjPath ) );
+
+			if ( stem == "Neutral" )
+			{
+				trimesh = parser->getNeutralMesh();
+			}
+			else if ( parser )
+			{
+				parser->parseBlendshape( *it, &trimesh );
+			}
+			else
+			{
+				ObjLoader loader( loadFile( *it ) );
+				// no normals, with texcoords, optimization
+				loader.load( &trimesh, false, true, true );
+			}
+
+			// the original faceshift models have no normals, it is
+			// better to recalculate the smooth normals
+			if ( !trimesh.hasNormals() )
+				trimesh.recalculateNormals();
+
+			// hashed while in the page cache, to recognize the file if it is exported again
+			rig->mManifest.hash( *it );
+			if ( format.getExportTrimesh() )
+			{
+				trimesh.write( writeFile( trimeshPath ) );
+				// the new .trimesh is not a change of the export
+				rig->mManifest.add( trimeshPath );
+				conversions.set( objPath.filename().string(), *rig->mManifest.find( objPath.filename().string() ) );
+				conversionsChanged = true;
+			}
+		}
+		else // .trimesh
+		{
+			trimesh.read( loadFile( *it ) );
+			rig->mManifest.hash( *it );
+		}
+
+		if ( stem == "Neutral" )
+		{
+			rig->mNeutralMesh = trimesh;
+			hasNeutral = true;
+		}
+		else if ( isCorrective )
+		{
+			correctiveMeshes[ stem ] = trimesh;
+		}
+		else
+		{
+			rig->mBlendshapeMeshes.push_back( trimesh );
+			rig->mBlendshapeNames.push_back( stem );
+			previousShapes.push_back( previousShape );
+		}
+	}
+
+	if ( !hasNeutral )
+		throw RigExc( "no Neutral mesh in " + folder.string() );
+
+	if ( conversionsChanged )
+		conversions.write( conversionsPath );
+
+	for ( size_t i = 0; i < correctives.size(); i++ )
+	{
+		const CorrectiveDefinition &definition = correctives[ i ];
+		const TriMesh &mesh = correctiveMeshes[ definition.mName ];
+		if ( mesh.getNumVertices() == 0 )
+			throw RigExc( "no mesh for corrective " + definition.mName + " in " + folder.string() );
+
+		Corrective corrective;
+		for ( size_t d = 0; d < definition.mDrivers.size(); d++ )
+		{
+			int driver = rig->findBlendshape( definition.mDrivers[ d ] );
+			if ( driver < 0 )
+				throw RigExc( "unknown driver " + definition.mDrivers[ d ] + " of corrective " + definition.mName );
+			corrective.mDrivers.push_back( driver );
+		}
+		std::sort( corrective.mDrivers.begin(), corrective.mDrivers.end() );
+		corrective.mWeight = definition.mWeight;
+		corrective.mWeightBelow = 0.f;
+		corrective.mWeightAbove = 1.f;
+
+		rig->mCorrectiveMeshes.push_back( mesh );
+		rig->mCorrectiveNames.push_back( definition.mName );
+		rig->mCorrectives.push_back( corrective );
+	}
+
+	// every in-between fades out at the neighbouring in-betweens of its driver
+	for ( size_t i = 0; i < rig->mCorrectives.size(); i++ )
+	{
+		Corrective &corrective = rig->mCorrectives[ i ];
+		if ( corrective.mWeight == 0.f )
+			continue;
+
+		for ( size_t k = 0; k < rig->mCorrectives.size(); k++ )
+		{
+			const Corrective &other = rig->mCorrectives[ k ];
+			if ( ( k == i ) || ( other.mWeight == 0.f ) || ( other.mDrivers != corrective.mDrivers ) )
+				continue;
+
+			if ( other.mWeight == corrective.mWeight )
+				throw RigExc( "in-betweens " + rig->mCorrectiveNames[ i ] + " and " +
+							  rig->mCorrectiveNames[ k ] + " have the same weight" );
+			if ( other.mWeight < corrective.mWeight )
+				corrective.mWeightBelow = std::max( corrective.mWeightBelow, other.mWeight );
+			else
+				corrective.mWeightAbove = std::min( corrective.mWeightAbove, other.mWeight );
+		}
+	}
+
+	rig->compileDeltas( previous, &previousShapes );
+
+	if ( reuseNeutral )
+	{
+		rig->mVertexGroups = previous->mVertexGroups;
+		std::copy( previous->mEyePivots, previous->mEyePivots + 2, rig->mEyePivots );
+		std::copy( previous->mEyeRadii, previous->mEyeRadii + 2, rig->mEyeRadii );
+		rig->mHasEyeGroups = previous->mHasEyeGroups;
+	}
+	else if ( parser )
+	{
+		rig->tagEyeGroups( *parser, format );
+	}
+
+	if ( rig->getNumVertices() == 0 )
+		return rig;
+
+	size_t numLevels = format.getLevels();
+	while ( fs::is_directory( folder / ( "lod" + boost::lexical_cast< std::string >( numLevels + 1 ) ) ) )
+		numLevels++;
+
+	const std::vector< Vec3f >& neutralVertices = rig->mNeutralMesh.getVertices();
+	Vec3f extent = rig->mNeutralMesh.calcBoundingBox().getSize();
+	float cellSize = format.getLevelCellSize() * std::max( extent.x, std::max( extent.y, extent.z ) );
+	for ( size_t l = 1; l <= numLevels; l++, cellSize *= 2.f )
+	{
+		fs::path levelFolder = folder / ( "lod" + boost::lexical_cast< std::string >( l ) );
+		const Rig *previousLevel = NULL;
+		TriMesh neutral;
+		std::vector< uint32_t > sourceVertices;
+		ImportManifest levelManifest;
+		if ( fs::is_directory( levelFolder ) )
+		{
+			const ImportManifest *previousManifest = NULL;
+			if ( previous && ( l <= previous->mLevels.size() ) && ( previous->mLevels[ l - 1 ]->mFolder == levelFolder ) )
+				previousManifest = &previous->mLevels[ l - 1 ]->mManifest;
+			neutral = loadLevelNeutral( levelFolder, format.getExportTrimesh(), previousManifest, &levelManifest );
+			findNearestVertices( neutralVertices, neutral.getVertices(), &sourceVertices );
+		}
+		else if ( reuseNeutral && ( l <= previous->mLevels.size() ) && previous->mLevels[ l - 1 ]->mFolder.empty() )
+		{
+			// a generated level only depends on the neutral mesh
+			previousLevel = previous->mLevels[ l - 1 ].get();
+			neutral = previousLevel->mNeutralMesh;
+			sourceVertices = previousLevel->mSourceVertices;
+		}
+		else
+		{
+			clusterVertices( rig->mNeutralMesh, rig->mVertexGroups, cellSize, &neutral, &sourceVertices );
+		}
+
+		std::shared_ptr< Rig > level = createLevel( *rig, neutral, sourceVertices, previousLevel, &previousShapes );
+		if ( fs::is_directory( levelFolder ) )
+		{
+			level->mFolder = levelFolder;
+			level->mManifest = levelManifest;
+		}
+		rig->mLevels.push_back( level );
+	}
+
+	return rig;
+}
+
+std::shared_ptr< Rig > Rig::createLevel( const Rig &source, const TriMesh &neutral,
+										 const std::vector< uint32_t > &sourceVertices,
+										 const Rig *previousLevel /* = NULL */,
+										 const std::vector< int > *previousShapes /* = NULL */ )
+{
+	std::shared_ptr< Rig > level( new Rig() );
+	level->mNeutralMesh = neutral;
+	level->mBlendshapeNames = source.mBlendshapeNames;
+	level->mSourceVertices = sourceVertices;
+	level->mFormat = source.mFormat;
+	level->mCorrectiveNames = source.mCorrectiveNames;
+	level->mCorrectives = source.mCorrectives;
+
+	// the level blendshapes and correctives move their vertices with the
+	// deltas of the source vertices
+	size_t numVertices = neutral.getNumVertices();
+	level->mBlendshapeMeshes.resize( source.mBlendshapeMeshes.size(), neutral );
+	for ( size_t i = 0; i < source.mBlendshapeMeshes.size(); i++ )
+	{
+		int previousShape = ( previousLevel && previousShapes ) ? ( *previousShapes )[ i ] : -1;
+		if ( previousShape >= 0 )
+			level->mBlendshapeMeshes[ i ] = previousLevel->mBlendshapeMeshes[ previousShape ];
+		else
+			mapLevelShape( source.mNeutralMesh, source.mBlendshapeMeshes[ i ], sourceVertices,
+						   &level->mBlendshapeMeshes[ i ] );
+	}
+	level->mCorrectiveMeshes.resize( source.mCorrectiveMeshes.size(), neutral );
+	for ( size_t i = 0; i < source.mCorrectiveMeshes.size(); i++ )
+	{
+		mapLevelShape( source.mNeutralMesh, source.mCorrectiveMeshes[ i ], sourceVertices,
+					   &level->mCorrectiveMeshes[ i ] );
+	}
+	level->compileDeltas( previousLevel, previousShapes );
+
+	if ( source.mHasEyeGroups )
+	{
+		level->mVertexGroups.resize( numVertices );
+		for ( size_t j = 0; j < numVertices; j++ )
+			level->mVertexGroups[ j ] = source.mVertexGroups[ sourceVertices[ j ] ];
+		level->mEyePivots[ 0 ] = source.mEyePivots[ 0 ];
+		level->mEyePivots[ 1 ] = source.mEyePivots[ 1 ];
+		level->mHasEyeGroups = true;
+		level->calcEyeRadii();
+	}
+
+	return level;
+}
+
+void Rig::tagEyeGroups( const ObjParser &parser, const Format &format )
+{
+	size_t numVertices = getNumVertices();
+	if ( parser.getNeutralMesh().getNumVertices() != numVertices )
+		return;
+
+	std::vector< uint32_t > groups[ 2 ] = {
+		parser.getGroupVertices( format.getLeftEyeGroup() ),
+		parser.getGroupVertices( format.getRightEyeGroup() ) };
+	if ( groups[ 0 ].empty() || groups[ 1 ].empty() )
+		return;
+
+	const std::vector< Vec3f >& neutralVertices = mNeutralMesh.getVertices();
+	mVertexGroups.assign( numVertices, GROUP_NONE );
+	for ( int g = 0; g < 2; g++ )
+	{
+		Vec3f pivot = Vec3f::zero();
+		for ( size_t i = 0; i < groups[ g ].size(); i++ )
+		{
+			mVertexGroups[ groups[ g ][ i ] ] = GROUP_LEFT_EYE + g;
+			pivot += neutralVertices[ groups[ g ][ i ] ];
+		}
+		mEyePivots[ g ] = pivot / static_cast< float >( groups[ g ].size() );
+	}
+	mHasEyeGroups = true;
+	calcEyeRadii();
+}
+
+void Rig::calcEyeRadii()
+{
+	const std::vector< Vec3f >& neutralVertices = mNeutralMesh.getVertices();
+	mEyeRadii[ 0 ] = mEyeRadii[ 1 ] = 0.f;
+	for ( size_t j = 0; j < mVertexGroups.size(); j++ )
+	{
+		if ( mVertexGroups[ j ] == GROUP_NONE )
+			continue;
+
+		int g = mVertexGroups[ j ] - GROUP_LEFT_EYE;
+		mEyeRadii[ g ] = std::max( mEyeRadii[ g ], neutralVertices[ j ].distance( mEyePivots[ g ] ) );
+	}
+}
+
+void Rig::compileDeltas( const Rig *previous /* = NULL */, const std::vector< int > *previousShapes /* = NULL */ )
+{
+	const std::vector< Vec3f >& neutralVertices = mNeutralMesh.getVertices();
+	size_t numVertices = neutralVertices.size();
+	mNumTiles = ( numVertices + kTileSize - 1 ) / kTileSize;
+
+	// the corrective deltas depend on the blendshapes, they are always compiled
+	size_t numShapes = mBlendshapeMeshes.size() + mCorrectiveMeshes.size();
+	mDeltas.resize( numShapes );
+	mDeltaBounds.resize( numShapes );
+	for ( size_t i = 0; i < numShapes; i++ )
+	{
+		int previousShape = ( previous && previousShapes && ( i < previousShapes->size() ) ) ?
+							( *previousShapes )[ i ] : -1;
+		if ( previousShape >= 0 )
+		{
+			mDeltas[ i ] = previous->mDeltas[ previousShape ];
+			mDeltaBounds[ i ] = previous->mDeltaBounds[ previousShape ];
+		}
+		else
+		{
+			compileShapeDeltas( i );
+		}
+	}
+
+	if ( numVertices == 0 )
+		return;
+
+	Vec3f neutralMin = neutralVertices[ 0 ];
+	Vec3f neutralMax = neutralVertices[ 0 ];
+	for ( size_t j = 1; j < numVertices; j++ )
+	{
+		neutralMin.x = std::min( neutralMin.x, neutralVertices[ j ].x );
+		neutralMin.y = std::min( neutralMin.y, neutralVertices[ j ].y );
+		neutralMin.z = std::min( neutralMin.z, neutralVertices[ j ].z );
+		neutralMax.x = std::max( neutralMax.x, neutralVertices[ j ].x );
+		neutralMax.y = std::max( neutralMax.y, neutralVertices[ j ].y );
+		neutralMax.z = std::max( neutralMax.z, neutralVertices[ j ].z );
+	}
+	mNeutralBounds = AxisAlignedBox3f( neutralMin, neutralMax );
+
+	Vec3f center = mNeutralBounds.getCenter();
+	mNeutralRadius = 0.f;
+	for ( size_t j = 0; j < numVertices; j++ )
+		mNeutralRadius = std::max( mNeutralRadius, neutralVertices[ j ].distance( center ) );
+}
+
+void Rig::compileShapeDeltas( size_t i )
+{
+	const std::vector< Vec3f >& neutralVertices = mNeutralMesh.getVertices();
+	size_t numVertices = neutralVertices.size();
+	size_t numBlendshapes = mBlendshapeMeshes.size();
+	bool isCorrective = i >= numBlendshapes;
+	const TriMesh &mesh = isCorrective ? mCorrectiveMeshes[ i - numBlendshapes ] : mBlendshapeMeshes[ i ];
+	const std::vector< Vec3f >& vertices = mesh.getVertices();
+	if ( vertices.size() != numVertices )
+	{
+		const std::string &name = isCorrective ? mCorrectiveNames[ i - numBlendshapes ] : mBlendshapeNames[ i ];
+		throw RigExc( "vertex count of " + name + " does not match Neutral" );
+	}
+
+	// most of the face does not move in a blendshape, only the non-zero
+	// deltas are stored
+	SparseDeltas &deltas = mDeltas[ i ];
+	deltas.mIndices.clear();
+	deltas.mDeltas.clear();
+	deltas.mTileOffsets.clear();
+	deltas.mTileOffsets.reserve( mNumTiles + 1 );
+	for ( size_t j = 0; j < numVertices; j++ )
+	{
+		if ( ( j % kTileSize ) == 0 )
+			deltas.mTileOffsets.push_back( deltas.mIndices.size() );
+
+		Vec3f delta = isCorrective ? getCorrectiveDelta( i - numBlendshapes, j ) :
+									 vertices[ j ] - neutralVertices[ j ];
+		if ( delta != Vec3f::zero() )
+		{
+			deltas.mIndices.push_back( j );
+			deltas.mDeltas.push_back( delta );
+		}
+	}
+	deltas.mTileOffsets.push_back( deltas.mIndices.size() );
+
+	// the bounds include the zero delta of the vertices the blendshape
+	// does not move
+	DeltaBounds &bounds = mDeltaBounds[ i ];
+	bounds.mMin = bounds.mMax = Vec3f::zero();
+	bounds.mMaxLength = 0.f;
+	for ( size_t k = 0; k < deltas.mDeltas.size(); k++ )
+	{
+		const Vec3f &delta = deltas.mDeltas[ k ];
+		bounds.mMin.x = std::min( bounds.mMin.x, delta.x );
+		bounds.mMin.y = std::min( bounds.mMin.y, delta.y );
+		bounds.mMin.z = std::min( bounds.mMin.z, delta.z );
+		bounds.mMax.x = std::max( bounds.mMax.x, delta.x );
+		bounds.mMax.y = std::max( bounds.mMax.y, delta.y );
+		bounds.mMax.z = std::max( bounds.mMax.z, delta.z );
+		bounds.mMaxLength = std::max( bounds.mMaxLength, delta.length() );
+	}
+}
+
+float Rig::calcDeltaRadius( const float *weights, size_t numWeights ) const
+{
+	float radius = 0.f;
+	size_t numShapes = std::min( numWeights, mDeltaBounds.size() );
+	for ( size_t i = 0; i < numShapes; i++ )
+		radius += std::abs( weights[ i ] ) * mDeltaBounds[ i ].mMaxLength;
+	return radius;
+}
+
+AxisAlignedBox3f Rig::calcBounds( const float *weights, size_t numWeights,
+								  const Pose *pose /* = NULL */ ) const
+{
+	// every vertex moves by the sum of its weighted deltas, which lies in
+	// the sum of the weighted delta bounds
+	Vec3f minCorner = mNeutralBounds.getMin();
+	Vec3f maxCorner = mNeutralBounds.getMax();
+	size_t numShapes = std::min( numWeights, mDeltaBounds.size() );
+	for ( size_t i = 0; i < numShapes; i++ )
+	{
+		float w = weights[ i ];
+		if ( w == 0.f )
+			continue;
+
+		const DeltaBounds &bounds = mDeltaBounds[ i ];
+		minCorner += w * ( ( w > 0.f ) ? bounds.mMin : bounds.mMax );
+		maxCorner += w * ( ( w > 0.f ) ? bounds.mMax : bounds.mMin );
+	}
+
+	if ( pose == NULL )
+		return AxisAlignedBox3f( minCorner, maxCorner );
+
+	// the rotated eyes stay in a sphere around their pivots
+	if ( mHasEyeGroups )
+	{
+		float deltaRadius = calcDeltaRadius( weights, numWeights );
+		for ( int g = 0; g < 2; g++ )
+		{
+			float eyeRadius = mEyeRadii[ g ] + deltaRadius;
+			Vec3f extent( eyeRadius, eyeRadius, eyeRadius );
+			Vec3f eyeMin = mEyePivots[ g ] - extent;
+			Vec3f eyeMax = mEyePivots[ g ] + extent;
+			minCorner.x = std::min( minCorner.x, eyeMin.x );
+			minCorner.y = std::min( minCorner.y, eyeMin.y );
+			minCorner.z = std::min( minCorner.z, eyeMin.z );
+			maxCorner.x = std::max( maxCorner.x, eyeMax.x );
+			maxCorner.y = std::max( maxCorner.y, eyeMax.y );
+			maxCorner.z = std::max( maxCorner.z, eyeMax.z );
+		}
+	}
+
+	// bounds of the box rotated and translated by the head pose
+	Matrix33f rotation = pose->mHeadRotation.toMatrix33();
+	Vec3f center = rotation * ( ( minCorner + maxCorner ) * .5f ) + pose->mHeadPosition;
+	Vec3f halfSize = ( maxCorner - minCorner ) * .5f;
+	Vec3f axes[ 3 ] = { rotation * Vec3f::xAxis(), rotation * Vec3f::yAxis(), rotation * Vec3f::zAxis() };
+	Vec3f extent = Vec3f::zero();
+	for ( int a = 0; a < 3; a++ )
+	{
+		Vec3f axis( std::abs( axes[ a ].x ), std::abs( axes[ a ].y ), std::abs( axes[ a ].z ) );
+		extent += axis * halfSize[ a ];
+	}
+	return AxisAlignedBox3f( center - extent, center + extent );
+}
+
+Sphere Rig::calcBoundingSphere( const float *weights, size_t numWeights,
+								const Pose *pose /* = NULL */ ) const
+{
+	float deltaRadius = calcDeltaRadius( weights, numWeights );
+	Vec3f center = mNeutralBounds.getCenter();
+	float radius = mNeutralRadius + deltaRadius;
+	if ( pose == NULL )
+		return Sphere( center, radius );
+
+	if ( mHasEyeGroups )
+	{
+		for ( int g = 0; g < 2; g++ )
+		{
+			radius = std::max( radius, center.distance( mEyePivots[ g ] ) +
+							   mEyeRadii[ g ] + deltaRadius );
+		}
+	}
+	return Sphere( pose->mHeadRotation * center + pose->mHeadPosition, radius );
+}
+
+int Rig::findBlendshape( const std::string &name ) const
+{
+	std::vector< std::string >::const_iterator it =
+		std::find( mBlendshapeNames.begin(), mBlendshapeNames.end(), name );
+	if ( it == mBlendshapeNames.end() )
+		return -1;
+	return static_cast< int >( it - mBlendshapeNames.begin() );
+}
+
+int Rig::findCorrective( const std::string &name ) const
+{
+	std::vector< std::string >::const_iterator it = std::find( mCorrectiveNames.begin(), mCorrectiveNames.end(), name );
+	if ( it == mCorrectiveNames.end() )
+		return -1;
+	return static_cast< int >( it - mCorrectiveNames.begin() );
+}
+
+Vec3f Rig::getCorrectiveDelta( size_t i, uint32_t vertex ) const
+{
+	const Corrective &corrective = mCorrectives[ i ];
+	const Vec3f &neutral = mNeutralMesh.getVertices()[ vertex ];
+	Vec3f delta = mCorrectiveMeshes[ i ].getVertices()[ vertex ] - neutral;
+
+	// a combination is sculpted with its drivers at 1, an in-between at its weight
+	float driverWeight = ( corrective.mWeight > 0.f ) ? corrective.mWeight : 1.f;
+	for ( size_t d = 0; d < corrective.mDrivers.size(); d++ )
+		delta -= driverWeight * ( mBlendshapeMeshes[ corrective.mDrivers[ d ] ].getVertices()[ vertex ] - neutral );
+
+	if ( corrective.mWeight > 0.f )
+		return delta;
+
+	// the combinations of a subset of the drivers are fully active as well
+	for ( size_t k = 0; k < mCorrectives.size(); k++ )
+	{
+		const Corrective &other = mCorrectives[ k ];
+		if ( ( other.mWeight == 0.f ) && ( other.mDrivers.size() < corrective.mDrivers.size() ) &&
+			 std::includes( corrective.mDrivers.begin(), corrective.mDrivers.end(),
+							other.mDrivers.begin(), other.mDrivers.end() ) )
+			delta -= getCorrectiveDelta( k, vertex );
+	}
+	return delta;
+}
+
+void Rig::evaluateCorrectives( const float *weights, size_t numWeights, float *activations ) const
+{
+	for ( size_t i = 0; i < mCorrectives.size(); i++ )
+	{
+		const Corrective &corrective = mCorrectives[ i ];
+		float activation = 1.f;
+		for ( size_t d = 0; ( d < corrective.mDrivers.size() ) && ( activation != 0.f ); d++ )
+		{
+			uint32_t driver = corrective.mDrivers[ d ];
+			activation *= ( driver < numWeights ) ? weights[ driver ] : 0.f;
+		}
+
+		// in-betweens peak at their weight and fade out linearly towards
+		// the neighbouring in-betweens
+		if ( corrective.mWeight > 0.f )
+		{
+			float weight = activation;
+			if ( ( weight <= corrective.mWeightBelow ) || ( weight >= corrective.mWeightAbove ) )
+				activation = 0.f;
+			else if ( weight <= corrective.mWeight )
+				activation = ( weight - corrective.mWeightBelow ) / ( corrective.mWeight - corrective.mWeightBelow );
+			else
+				activation = ( corrective.mWeightAbove - weight ) / ( corrective.mWeightAbove - corrective.mWeight );
+		}
+		activations[ i ] = activation;
+	}
+}
+
+const Rig& Rig::getLevel( size_t level ) const
+{
+	if ( ( level == 0 ) || mLevels.empty() )
+		return *this;
+	return *mLevels[ std::min( level, mLevels.size() ) - 1 ];
+}
+
+void Rig::blend( const float *weights, size_t numWeights, Vec3f *output ) const
+{
+	blend( 1, &weights, numWeights, &output );
+}
+
+void Rig::blend( size_t numInstances, const float * const *weights, size_t numWeights,
+				 Vec3f * const *outputs ) const
+{
+	blend( numInstances, weights, numWeights, outputs, NULL, NULL );
+}
+
+void Rig::blend( size_t numInstances, const float * const *weights, size_t numWeights,
+				 Vec3f * const *outputs, const Pose *poses, Vec3f * const *normalOutputs ) const
+{
+	const std::vector< Vec3f >& neutralVertices = mNeutralMesh.getVertices();
+	size_t numVertices = neutralVertices.size();
+	size_t numShapes = std::min( numWeights, mDeltas.size() );
+
+	for ( size_t t = 0; t < mNumTiles; t++ )
+	{
+		size_t tileBegin = t * kTileSize;
+		size_t tileSize = std::min( kTileSize, numVertices - tileBegin );
+
+		for ( size_t n = 0; n < numInstances; n++ )
+		{
+			std::memcpy( outputs[ n ] + tileBegin, &neutralVertices[ tileBegin ],
+						 tileSize * sizeof( Vec3f ) );
+		}
+
+		for ( size_t i = 0; i < numShapes; i++ )
+		{
+			const SparseDeltas &deltas = mDeltas[ i ];
+			uint32_t begin = deltas.mTileOffsets[ t ];
+			uint32_t end = deltas.mTileOffsets[ t + 1 ];
+			if ( begin == end )
+				continue;
+
+			const uint32_t *indices = &deltas.mIndices[ 0 ];
+			const Vec3f *shapeDeltas = &deltas.mDeltas[ 0 ];
+			for ( size_t n = 0; n < numInstances; n++ )
+			{
+				float weight = weights[ n ][ i ];
+				if ( weight == 0.f )
+					continue;
+
+				Vec3f *output = outputs[ n ];
+				for ( uint32_t k = begin; k < end; k++ )
+				{
+					output[ indices[ k ] ] += weight * shapeDeltas[ k ];
+				}
+			}
+		}
+
+		if ( poses != NULL )
+		{
+			for ( size_t n = 0; n < numInstances; n++ )
+			{
+				transformTile( poses[ n ], tileBegin, tileSize, outputs[ n ],
+							   ( normalOutputs != NULL ) ? normalOutputs[ n ] : NULL );
+			}
+		}
+	}
+}
+
+void Rig::transform( const Pose &pose, Vec3f *output, Vec3f *normalOutput ) const
+{
+	size_t numVertices = getNumVertices();
+	for ( size_t t = 0; t < mNumTiles; t++ )
+	{
+		size_t tileBegin = t * kTileSize;
+		transformTile( pose, tileBegin, std::min( kTileSize, numVertices - tileBegin ),
+					   output, normalOutput );
+	}
+}
+
+void Rig::transformPoints( const Pose &pose, const uint32_t *vertices, size_t numPoints,
+						   Vec3f *positions, Vec3f *normals, Vec3f *tangents ) const
+{
+	Matrix33f rotations[ GROUP_COUNT ];
+	Vec3f translations[ GROUP_COUNT ];
+	calcGroupTransforms( pose, rotations, translations );
+
+	for ( size_t i = 0; i < numPoints; i++ )
+	{
+		uint8_t g = mVertexGroups.empty() ? static_cast< uint8_t >( GROUP_NONE ) : mVertexGroups[ vertices[ i ] ];
+		positions[ i ] = rotations[ g ] * positions[ i ] + translations[ g ];
+		if ( normals != NULL )
+			normals[ i ] = rotations[ g ] * normals[ i ];
+		if ( tangents != NULL )
+			tangents[ i ] = rotations[ g ] * tangents[ i ];
+	}
+}
+
+void Rig::calcGroupTransforms( const Pose &pose, Matrix33f *rotations, Vec3f *translations ) const
+{
+	// combined rotation and translation for each vertex group, the eyes
+	// are rotated around their pivots before the head transformation
+	rotations[ GROUP_NONE ] = pose.mHeadRotation.toMatrix33();
+	translations[ GROUP_NONE ] = pose.mHeadPosition;
+	const Quatf *eyeRotations[ 2 ] = { &pose.mLeftEyeRotation, &pose.mRightEyeRotation };
+	for ( int g = 0; g < 2; g++ )
+	{
+		rotations[ GROUP_LEFT_EYE + g ] = ( pose.mHeadRotation * *eyeRotations[ g ] ).toMatrix33();
+		translations[ GROUP_LEFT_EYE + g ] = pose.mHeadRotation *
+			( mEyePivots[ g ] - *eyeRotations[ g ] * mEyePivots[ g ] ) + pose.mHeadPosition;
+	}
+}
+
+void Rig::transformTile( const Pose &pose, size_t tileBegin, size_t tileSize,
+						 Vec3f *output, Vec3f *normalOutput ) const
+{
+	Matrix33f rotations[ GROUP_COUNT ];
+	Vec3f translations[ GROUP_COUNT ];
+	calcGroupTransforms( pose, rotations, translations );
+
+	const uint8_t *groups = mVertexGroups.empty() ? NULL : &mVertexGroups[ tileBegin ];
+	Vec3f *vertices = output + tileBegin;
+	for ( size_t j = 0; j < tileSize; j++ )
+	{
+		uint8_t g = ( groups != NULL ) ? groups[ j ] : static_cast< uint8_t >( GROUP_NONE );
+		vertices[ j ] = rotations[ g ] * vertices[ j ] + translations[ g ];
+	}
+
+	const std::vector< Vec3f >& neutralNormals = mNeutralMesh.getNormals();
+	if ( ( normalOutput == NULL ) || ( neutralNormals.size() != mNeutralMesh.getNumVertices() ) )
+		return;
+
+	const Vec3f *normals = &neutralNormals[ tileBegin ];
+	Vec3f *outputNormals = normalOutput + tileBegin;
+	for ( size_t j = 0; j < tileSize; j++ )
+	{
+		uint8_t g = ( groups != NULL ) ? groups[ j ] : static_cast< uint8_t >( GROUP_NONE );
+		outputNormals[ j ] = rotations[ g ] * normals[ j ];
+	}
+}
+
+} } // namespace mndl::faceshift
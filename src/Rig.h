@@ -0,0 +1,377 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cinder/AxisAlignedBox.h"
+#include "cinder/Cinder.h"
+#include "cinder/Matrix.h"
+#include "cinder/Quaternion.h"
+#include "cinder/Sphere.h"
+#include "cinder/TriMesh.h"
+#include "cinder/Vector.h"
+
+#include "ImportManifest.h"
+
+namespace mndl { namespace faceshift {
+
+class ObjParser;
+
+class Rig;
+typedef std::shared_ptr< const Rig > RigRef;
+
+//! Thrown when an fsStudio model export cannot be imported.
+class RigExc : public std::runtime_error
+{
+	public:
+		RigExc( const std::string &msg ) : std::runtime_error( msg ) {}
+};
+
+/*! Immutable blendshape rig imported from an fsStudio model export. A rig
+ * is loaded once and can be shared between any number of ciFaceShift
+ * instances, which only keep their weights and blended output.
+ */
+class Rig
+{
+	public:
+		//! Rig import options.
+		class Format
+		{
+			public:
+				Format() : mExportTrimesh( false ),
+					mLeftEyeGroup( "EyeLeft" ), mRightEyeGroup( "EyeRight" ),
+					mNumLevels( 0 ), mLevelCellSize( .01f ) {}
+
+				//! Converts the Wavefront .obj files to .trimesh if \a exportTrimesh is true.
+				Format& exportTrimesh( bool exportTrimesh = true ) { mExportTrimesh = exportTrimesh; return *this; }
+				//! Sets the name of the group in Neutral.obj holding the left eye vertices.
+				Format& leftEyeGroup( const std::string &name ) { mLeftEyeGroup = name; return *this; }
+				//! Sets the name of the group in Neutral.obj holding the right eye vertices.
+				Format& rightEyeGroup( const std::string &name ) { mRightEyeGroup = name; return *this; }
+				//! Generates \a numLevels simplified resolution levels besides the full resolution rig.
+				Format& levels( size_t numLevels ) { mNumLevels = numLevels; return *this; }
+				/*! Sets the vertex clustering cell size of the first simplified
+				 * level relative to the largest extent of the neutral mesh, the
+				 * cell size doubles on each further level.
+				 */
+				Format& levelCellSize( float cellSize ) { mLevelCellSize = cellSize; return *this; }
+
+				bool getExportTrimesh() const { return mExportTrimesh; }
+				const std::string& getLeftEyeGroup() const { return mLeftEyeGroup; }
+				const std::string& getRightEyeGroup() const { return mRightEyeGroup; }
+				size_t getLevels() const { return mNumLevels; }
+				float getLevelCellSize() const { return mLevelCellSize; }
+
+			private:
+				bool mExportTrimesh;
+				std::string mLeftEyeGroup;
+				std::string mRightEyeGroup;
+				size_t mNumLevels;
+				float mLevelCellSize;
+		};
+
+		//! Rigid head and eye transformation applied to the blended vertices.
+		struct Pose
+		{
+			ci::Quatf mHeadRotation;
+			ci::Vec3f mHeadPosition;
+			ci::Quatf mLeftEyeRotation;
+			ci::Quatf mRightEyeRotation;
+		};
+
+		/*! Imports the contents of the fsStudio model export \a folder.
+		 * Converts the Wavefront .obj files to .trimesh if \a exportTrimesh
+		 * is true. If .obj and .trimesh files exist with the same name, the
+		 * .trimesh is loaded, which is much faster, unless it is stale. A
+		 * .trimesh is stale if the import manifest in the folder records it
+		 * was converted from a different .obj, or has no entry for it, as
+		 * the manifests of other versions are not read.
+		 * \throws RigExc if the folder has no Neutral mesh or the blendshape
+		 * vertex counts do not match the neutral mesh.
+		 */
+		static RigRef create( const ci::fs::path &folder, bool exportTrimesh = false );
+		/*! Imports the contents of the fsStudio model export \a folder with
+		 * the options in \a format. The eye vertex groups are tagged from
+		 * the groups of Neutral.obj, they are not available if the rig is
+		 * loaded from .trimesh files only. The .obj files are read with
+		 * ObjParser, which takes the faces from Neutral.obj only.
+		 *
+		 * A Neutral mesh in the lod1, lod2... subfolders is used as the
+		 * neutral mesh of the corresponding resolution level, the missing
+		 * levels are simplified from the full resolution neutral mesh by
+		 * vertex clustering. Every level vertex takes the blendshape deltas
+		 * and the eye group of the nearest full resolution vertex.
+		 *
+		 * Combination and in-between corrective shapes are defined in
+		 * Correctives.xml in the export folder like this:
+		 * \code
+		 * <correctives>
+		 *   <combination name="SmileJawOpen">
+		 *     <driver name="MouthSmile_L" />
+		 *     <driver name="JawOpen" />
+		 *   </combination>
+		 *   <inbetween name="JawOpen_50" driver="JawOpen" weight=".5" />
+		 * </correctives>
+		 * \endcode
+		 * The named meshes of the folder are imported as correctives instead
+		 * of blendshapes. A combination is sculpted with its drivers at
+		 * weight 1 and is activated by the product of their weights. An
+		 * in-between is sculpted at \a weight of its driver, the driver
+		 * moves the vertices piecewise linearly through its in-betweens.
+		 */
+		static RigRef create( const ci::fs::path &folder, const Format &format );
+
+		/*! Imports the export folder of \a rig again with the same format.
+		 * Only the blendshapes whose files changed are parsed, the meshes
+		 * and deltas of the others are taken from \a rig, which is not
+		 * modified. A changed neutral mesh imports every blendshape again.
+		 * Returns \a rig itself if no file changed.
+		 * \throws RigExc like create().
+		 */
+		static RigRef reimport( const RigRef &rig );
+		/*! Returns true if the mesh files of the export folder or its lod
+		 * folders changed since the import. Only compares the sizes and
+		 * write times.
+		 */
+		bool isModified() const;
+		//! Returns the export folder the rig was imported from.
+		const ci::fs::path& getFolder() const { return mFolder; }
+
+		//! Returns the neutral mesh.
+		const ci::TriMesh& getNeutralMesh() const { return mNeutralMesh; }
+		//! Returns the number of vertices of the neutral mesh.
+		size_t getNumVertices() const { return mNeutralMesh.getNumVertices(); }
+
+		//! Returns true if the rig has left and right eye vertex groups tagged.
+		bool hasEyeGroups() const { return mHasEyeGroups; }
+		//! Returns the center of rotation of the left eye.
+		const ci::Vec3f& getLeftEyePivot() const { return mEyePivots[ GROUP_LEFT_EYE - 1 ]; }
+		//! Returns the center of rotation of the right eye.
+		const ci::Vec3f& getRightEyePivot() const { return mEyePivots[ GROUP_RIGHT_EYE - 1 ]; }
+
+		//! Returns the number of blendshapes in the rig.
+		size_t getNumBlendshapes() const { return mBlendshapeMeshes.size(); }
+		//! Returns the \a i'th blendshape mesh.
+		const ci::TriMesh& getBlendshapeMesh( size_t i ) const { return mBlendshapeMeshes[ i ]; }
+		//! Returns the names of the blendshapes.
+		const std::vector< std::string >& getBlendshapeNames() const { return mBlendshapeNames; }
+		//! Returns the name of the \a i'th blendshape, the stem of the file it was imported from.
+		const std::string& getBlendshapeName( size_t i ) const { return mBlendshapeNames[ i ]; }
+		//! Returns the index of the blendshape called \a name or -1 if the rig has no such shape.
+		int findBlendshape( const std::string &name ) const;
+
+		//! Returns the number of corrective shapes in the rig.
+		size_t getNumCorrectives() const { return mCorrectiveMeshes.size(); }
+		//! Returns the \a i'th corrective mesh as sculpted.
+		const ci::TriMesh& getCorrectiveMesh( size_t i ) const { return mCorrectiveMeshes[ i ]; }
+		//! Returns the name of the \a i'th corrective.
+		const std::string& getCorrectiveName( size_t i ) const { return mCorrectiveNames[ i ]; }
+		//! Returns the index of the corrective called \a name or -1 if the rig has no such shape.
+		int findCorrective( const std::string &name ) const;
+		/*! Returns the delta of \a vertex in the \a i'th corrective, which
+		 * is the sculpted delta minus the deltas the blendshapes and the
+		 * smaller combinations already apply where the corrective is sculpted.
+		 */
+		ci::Vec3f getCorrectiveDelta( size_t i, uint32_t vertex ) const;
+
+		/*! Returns the number of weights blended, the getNumBlendshapes()
+		 * blendshape weights followed by the getNumCorrectives() corrective
+		 * activations.
+		 */
+		size_t getNumBlendWeights() const { return mDeltas.size(); }
+		/*! Calculates the activations of the correctives from \a numWeights
+		 * blendshape \a weights into \a activations, which has to hold
+		 * getNumCorrectives() values. Missing weights are treated as zero.
+		 * The activations are meant to be calculated once per frame and
+		 * passed to blend() after the blendshape weights, the correctives
+		 * with zero activation are skipped.
+		 */
+		void evaluateCorrectives( const float *weights, size_t numWeights, float *activations ) const;
+
+		//! Returns the number of resolution levels including the full resolution level 0.
+		size_t getNumLevels() const { return mLevels.size() + 1; }
+		/*! Returns the rig of resolution \a level, which has the blendshapes
+		 * of this rig with less vertices. Level 0 is this rig, levels beyond
+		 * getNumLevels() return the lowest resolution.
+		 */
+		const Rig& getLevel( size_t level ) const;
+
+		/*! Blends the neutral vertices with \a numWeights \a weights into
+		 * \a output, which has to hold getNumVertices() vertices. The
+		 * weights beyond the blendshape weights are the corrective
+		 * activations, see evaluateCorrectives(). Weights beyond
+		 * getNumBlendWeights() are ignored.
+		 */
+		void blend( const float *weights, size_t numWeights, ci::Vec3f *output ) const;
+
+		/*! Blends \a numInstances weight vectors in one pass. The \a i'th
+		 * instance reads \a numWeights weights from \a weights[ i ] and
+		 * writes to \a outputs[ i ]. The deltas are visited once per
+		 * vertex tile for all instances, so they are read from cache instead
+		 * of memory for every instance after the first.
+		 */
+		void blend( size_t numInstances, const float * const *weights, size_t numWeights,
+					ci::Vec3f * const *outputs ) const;
+
+		/*! Blends like above and transforms the result with the \a poses of
+		 * the instances in the same pass, while each vertex tile is still in
+		 * cache. The eye vertex groups are rotated around their pivots, then
+		 * every vertex is rotated and translated by the head pose. The neutral
+		 * normals are rotated into \a normalOutputs.
+		 */
+		void blend( size_t numInstances, const float * const *weights, size_t numWeights,
+					ci::Vec3f * const *outputs, const Pose *poses,
+					ci::Vec3f * const *normalOutputs ) const;
+
+		/*! Transforms the blended \a output vertices and the neutral normals
+		 * into \a normalOutput with \a pose without blending. \a normalOutput
+		 * can be NULL.
+		 */
+		void transform( const Pose &pose, ci::Vec3f *output, ci::Vec3f *normalOutput ) const;
+
+		/*! Transforms \a numPoints \a positions with \a pose, where each point
+		 * follows the vertex group of the neutral vertex in \a vertices. The
+		 * \a normals and \a tangents are rotated the same way, both can be
+		 * NULL.
+		 */
+		void transformPoints( const Pose &pose, const uint32_t *vertices, size_t numPoints,
+							  ci::Vec3f *positions, ci::Vec3f *normals, ci::Vec3f *tangents ) const;
+
+		/*! Returns a conservative bounding box of the vertices blended with
+		 * \a numWeights \a weights, transformed by \a pose if it is not NULL.
+		 * Calculated from the neutral bounds and the delta bounds of the
+		 * blendshapes in O(blendshapes) without touching the vertices.
+		 */
+		ci::AxisAlignedBox3f calcBounds( const float *weights, size_t numWeights,
+										 const Pose *pose = NULL ) const;
+		//! Returns a conservative bounding sphere like calcBounds().
+		ci::Sphere calcBoundingSphere( const float *weights, size_t numWeights,
+									   const Pose *pose = NULL ) const;
+
+		//! Number of vertices blended together while the deltas stay in cache.
+		static const size_t kTileSize = 256;
+
+	private:
+		Rig() : mNumTiles( 0 ), mNeutralRadius( 0.f ), mHasEyeGroups( false )
+		{
+			mEyeRadii[ 0 ] = mEyeRadii[ 1 ] = 0.f;
+		}
+
+		//! Imports \a folder, reusing the unchanged blendshapes of \a previous if it is not NULL.
+		static RigRef create( const ci::fs::path &folder, const Format &format, const Rig *previous );
+
+		/*! Compiles the sparse deltas of the blendshapes and the correctives.
+		 * The deltas of the i'th blendshape are copied from the
+		 * \a previousShapes[ i ] blendshape of \a previous if it is not
+		 * negative.
+		 */
+		void compileDeltas( const Rig *previous = NULL, const std::vector< int > *previousShapes = NULL );
+		/*! Compiles the sparse deltas and the delta bounds of the \a i'th
+		 * blend weight, a blendshape or a corrective.
+		 */
+		void compileShapeDeltas( size_t i );
+		//! Calculates the distance of the farthest eye vertex from its pivot.
+		void calcEyeRadii();
+		//! Returns the sum of the weighted maximum delta lengths.
+		float calcDeltaRadius( const float *weights, size_t numWeights ) const;
+		/*! Creates a resolution level of \a source with the \a neutral mesh,
+		 * where the i'th vertex follows the \a sourceVertices[ i ] vertex of
+		 * \a source. The blendshapes are reused from \a previousLevel like
+		 * in compileDeltas().
+		 */
+		static std::shared_ptr< Rig > createLevel( const Rig &source, const ci::TriMesh &neutral,
+												   const std::vector< uint32_t > &sourceVertices,
+												   const Rig *previousLevel = NULL,
+												   const std::vector< int > *previousShapes = NULL );
+		void tagEyeGroups( const ObjParser &parser, const Format &format );
+		void transformTile( const Pose &pose, size_t tileBegin, size_t tileSize,
+							ci::Vec3f *output, ci::Vec3f *normalOutput ) const;
+		//! Calculates the rotation and translation of each vertex group for \a pose.
+		void calcGroupTransforms( const Pose &pose, ci::Matrix33f *rotations,
+								  ci::Vec3f *translations ) const;
+
+		enum
+		{
+			GROUP_NONE = 0,
+			GROUP_LEFT_EYE,
+			GROUP_RIGHT_EYE,
+			GROUP_COUNT
+		};
+
+		//! Non-zero blendshape deltas sorted by vertex index.
+		struct SparseDeltas
+		{
+			std::vector< uint32_t > mIndices;
+			std::vector< ci::Vec3f > mDeltas;
+			//! Offsets into mIndices and mDeltas for the first vertex of each tile, with an extra end offset.
+			std::vector< uint32_t > mTileOffsets;
+		};
+
+		ci::TriMesh mNeutralMesh;
+		std::vector< ci::TriMesh > mBlendshapeMeshes;
+		std::vector< std::string > mBlendshapeNames;
+		//! Deltas of the blendshapes followed by the deltas of the correctives.
+		std::vector< SparseDeltas > mDeltas;
+		size_t mNumTiles;
+
+		//! Extents of the deltas of a blendshape.
+		struct DeltaBounds
+		{
+			ci::Vec3f mMin;
+			ci::Vec3f mMax;
+			float mMaxLength;
+		};
+		std::vector< DeltaBounds > mDeltaBounds;
+		ci::AxisAlignedBox3f mNeutralBounds;
+		float mNeutralRadius;
+
+		struct Corrective
+		{
+			//! Sorted blendshapes the activation is calculated from.
+			std::vector< uint32_t > mDrivers;
+			//! Driver weight an in-between is sculpted at, 0 for combinations.
+			float mWeight;
+			//! Driver weights of the neighbouring in-betweens, or 0 and 1, where an in-between fades out.
+			float mWeightBelow;
+			float mWeightAbove;
+		};
+		std::vector< ci::TriMesh > mCorrectiveMeshes;
+		std::vector< std::string > mCorrectiveNames;
+		std::vector< Corrective > mCorrectives;
+
+		//! Vertex group of each vertex.
+		std::vector< uint8_t > mVertexGroups;
+		ci::Vec3f mEyePivots[ 2 ];
+		float mEyeRadii[ 2 ];
+		bool mHasEyeGroups;
+
+		//! Simplified resolution levels starting from level 1.
+		std::vector< RigRef > mLevels;
+		//! Vertex of the full resolution rig each vertex of a level follows.
+		std::vector< uint32_t > mSourceVertices;
+
+		//! Export folder, or the lod folder of a level, empty for generated levels.
+		ci::fs::path mFolder;
+		Format mFormat;
+		//! Mesh files of mFolder at the time of the import.
+		ImportManifest mManifest;
+};
+
+} } // namespace mndl::faceshift
@@ -0,0 +1,190 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if ! defined( CINDER_MSW )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SharedFrame.h"
+
+using namespace mndl::faceshift::detail;
+
+namespace mndl { namespace faceshift {
+
+const size_t SharedFrame::kMaxBlendshapes;
+const size_t SharedFrame::kMaxMarkers;
+
+static const uint32_t sSharedFrameMagic = 0x46534652; // 'FSFR'
+
+static size_t segmentSize( size_t numSlots )
+{
+	return sizeof( SharedFrameHeader ) + numSlots * sizeof( SharedFrameSlot );
+}
+
+SharedFramePublisher::SharedFramePublisher( const std::string &name, size_t numSlots /* = 4 */ ) :
+	mName( name ),
+	mSize( segmentSize( std::max< size_t >( numSlots, 2 ) ) )
+{
+#if defined( CINDER_MSW )
+	throw SharedFrameExc( "shared memory publishing is not supported on this platform" );
+#else
+	int fd = shm_open( name.c_str(), O_CREAT | O_RDWR, 0644 );
+	if ( fd < 0 )
+		throw SharedFrameExc( "cannot create shared memory " + name );
+
+	if ( ftruncate( fd, mSize ) != 0 )
+	{
+		::close( fd );
+		shm_unlink( name.c_str() );
+		throw SharedFrameExc( "cannot resize shared memory " + name );
+	}
+
+	void *addr = mmap( NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	::close( fd );
+	if ( addr == MAP_FAILED )
+	{
+		shm_unlink( name.c_str() );
+		throw SharedFrameExc( "cannot map shared memory " + name );
+	}
+
+	std::memset( addr, 0, mSize );
+	mHeader = static_cast< SharedFrameHeader * >( addr );
+	mSlots = reinterpret_cast< SharedFrameSlot * >( mHeader + 1 );
+	mHeader->mNumSlots = std::max< size_t >( numSlots, 2 );
+	mHeader->mFrameSize = sizeof( SharedFrame );
+	mHeader->mNumFrames.store( 0 );
+	// readers check the magic last
+	std::atomic_thread_fence( std::memory_order_release );
+	mHeader->mMagic = sSharedFrameMagic;
+#endif
+}
+
+SharedFramePublisher::~SharedFramePublisher()
+{
+#if ! defined( CINDER_MSW )
+	munmap( mHeader, mSize );
+	shm_unlink( mName.c_str() );
+#endif
+}
+
+void SharedFramePublisher::publish( SharedFrame &frame )
+{
+	uint64_t frameNumber = mHeader->mNumFrames.load( std::memory_order_relaxed );
+	frame.mFrameNumber = frameNumber;
+
+	SharedFrameSlot &slot = mSlots[ frameNumber % mHeader->mNumSlots ];
+	uint64_t sequence = slot.mSequence.load( std::memory_order_relaxed );
+	slot.mSequence.store( sequence + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+	std::memcpy( &slot.mFrame, &frame, sizeof( SharedFrame ) );
+	slot.mSequence.store( sequence + 2, std::memory_order_release );
+
+	mHeader->mNumFrames.store( frameNumber + 1, std::memory_order_release );
+}
+
+SharedFrameReader::SharedFrameReader( const std::string &name )
+{
+#if defined( CINDER_MSW )
+	throw SharedFrameExc( "shared memory reading is not supported on this platform" );
+#else
+	int fd = shm_open( name.c_str(), O_RDONLY, 0 );
+	if ( fd < 0 )
+		throw SharedFrameExc( "cannot open shared memory " + name );
+
+	struct stat st;
+	if ( ( fstat( fd, &st ) != 0 ) || ( static_cast< size_t >( st.st_size ) < sizeof( SharedFrameHeader ) ) )
+	{
+		::close( fd );
+		throw SharedFrameExc( "invalid shared memory " + name );
+	}
+
+	mSize = st.st_size;
+	void *addr = mmap( NULL, mSize, PROT_READ, MAP_SHARED, fd, 0 );
+	::close( fd );
+	if ( addr == MAP_FAILED )
+		throw SharedFrameExc( "cannot map shared memory " + name );
+
+	mHeader = static_cast< const SharedFrameHeader * >( addr );
+	mSlots = reinterpret_cast< const SharedFrameSlot * >( mHeader + 1 );
+	if ( ( mHeader->mMagic != sSharedFrameMagic ) ||
+		 ( mHeader->mFrameSize != sizeof( SharedFrame ) ) ||
+		 ( segmentSize( mHeader->mNumSlots ) > mSize ) )
+	{
+		munmap( const_cast< SharedFrameHeader * >( mHeader ), mSize );
+		throw SharedFrameExc( "incompatible shared memory " + name );
+	}
+	std::atomic_thread_fence( std::memory_order_acquire );
+#endif
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+#if ! defined( CINDER_MSW )
+	munmap( const_cast< SharedFrameHeader * >( mHeader ), mSize );
+#endif
+}
+
+uint64_t SharedFrameReader::getNumFrames() const
+{
+	return mHeader->mNumFrames.load( std::memory_order_acquire );
+}
+
+const SharedFrame* SharedFrameReader::acquire( uint64_t &version ) const
+{
+	uint64_t numFrames = mHeader->mNumFrames.load( std::memory_order_acquire );
+	if ( numFrames == 0 )
+		return NULL;
+
+	const SharedFrameSlot &slot = mSlots[ ( numFrames - 1 ) % mHeader->mNumSlots ];
+	version = slot.mSequence.load( std::memory_order_acquire );
+	return &slot.mFrame;
+}
+
+bool SharedFrameReader::validate( const SharedFrame *frame, uint64_t version ) const
+{
+	if ( ( version & 1 ) != 0 )
+		return false;
+
+	const SharedFrameSlot *slot = reinterpret_cast< const SharedFrameSlot * >(
+			reinterpret_cast< const char * >( frame ) - offsetof( SharedFrameSlot, mFrame ) );
+	std::atomic_thread_fence( std::memory_order_acquire );
+	return slot->mSequence.load( std::memory_order_relaxed ) == version;
+}
+
+bool SharedFrameReader::read( SharedFrame &frame ) const
+{
+	for ( ;; )
+	{
+		uint64_t version;
+		const SharedFrame *shared = acquire( version );
+		if ( shared == NULL )
+			return false;
+
+		std::memcpy( &frame, shared, sizeof( SharedFrame ) );
+		if ( validate( shared, version ) )
+			return true;
+	}
+}
+
+} } // namespace mndl::faceshift
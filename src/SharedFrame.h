@@ -0,0 +1,141 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#include "cinder/Cinder.h"
+#include "cinder/Quaternion.h"
+#include "cinder/Vector.h"
+
+namespace mndl { namespace faceshift {
+
+//! Thrown when a shared memory segment cannot be created or attached.
+class SharedFrameExc : public std::runtime_error
+{
+	public:
+		SharedFrameExc( const std::string &msg ) : std::runtime_error( msg ) {}
+};
+
+//! Tracking frame in the fixed layout stored in shared memory.
+struct SharedFrame
+{
+	static const size_t kMaxBlendshapes = 64;
+	static const size_t kMaxMarkers = 64;
+
+	uint64_t mFrameNumber;
+	double mTimestamp;
+	uint32_t mTrackingSuccessful;
+	ci::Quatf mHeadOrientation;
+	ci::Vec3f mHeadPosition;
+	ci::Quatf mLeftEyeRotation;
+	ci::Quatf mRightEyeRotation;
+
+	uint32_t mNumBlendshapes;
+	float mBlendshapeWeights[ kMaxBlendshapes ];
+
+	uint32_t mNumMarkers;
+	ci::Vec3f mMarkers[ kMaxMarkers ];
+};
+
+namespace detail {
+
+struct SharedFrameHeader
+{
+	uint32_t mMagic;
+	uint32_t mNumSlots;
+	uint32_t mFrameSize;
+	//! Number of frames published, the latest one is in slot ( mNumFrames - 1 ) % mNumSlots.
+	std::atomic< uint64_t > mNumFrames;
+};
+
+//! Frame slot guarded by a sequence counter, which is odd while the slot is written.
+struct SharedFrameSlot
+{
+	std::atomic< uint64_t > mSequence;
+	SharedFrame mFrame;
+};
+
+} // namespace detail
+
+/*! Publishes frames into a POSIX shared memory ring of \a numSlots frames.
+ * There can be only one publisher for a segment name, the frames can be
+ * read by any number of SharedFrameReader instances in other processes.
+ */
+class SharedFramePublisher
+{
+	public:
+		//! Creates the shared memory segment \a name, for example "/faceshift".
+		SharedFramePublisher( const std::string &name, size_t numSlots = 4 );
+		//! Unmaps and removes the shared memory segment.
+		~SharedFramePublisher();
+
+		//! Publishes \a frame and assigns its frame number.
+		void publish( SharedFrame &frame );
+
+		const std::string& getName() const { return mName; }
+
+	private:
+		SharedFramePublisher( const SharedFramePublisher & );
+		SharedFramePublisher& operator=( const SharedFramePublisher & );
+
+		std::string mName;
+		size_t mSize;
+		detail::SharedFrameHeader *mHeader;
+		detail::SharedFrameSlot *mSlots;
+};
+
+/*! Reads the latest frame from a shared memory ring created by a
+ * SharedFramePublisher. The reader only maps the memory, reading does not
+ * involve system calls.
+ */
+class SharedFrameReader
+{
+	public:
+		//! Attaches to the shared memory segment \a name.
+		SharedFrameReader( const std::string &name );
+		~SharedFrameReader();
+
+		/*! Returns the latest frame in place without copying it, or NULL if
+		 * nothing has been published yet. The frame can be overwritten by
+		 * the publisher while it is read, so the data is only consistent if
+		 * validate() returns true with the \a version set here afterwards.
+		 */
+		const SharedFrame* acquire( uint64_t &version ) const;
+		//! Returns true if the frame returned by acquire() with \a version has not been modified since.
+		bool validate( const SharedFrame *frame, uint64_t version ) const;
+
+		/*! Copies the latest consistent frame to \a frame. Returns false if
+		 * nothing has been published yet.
+		 */
+		bool read( SharedFrame &frame ) const;
+
+		//! Returns the number of frames published so far.
+		uint64_t getNumFrames() const;
+
+	private:
+		SharedFrameReader( const SharedFrameReader & );
+		SharedFrameReader& operator=( const SharedFrameReader & );
+
+		size_t mSize;
+		const detail::SharedFrameHeader *mHeader;
+		const detail::SharedFrameSlot *mSlots;
+};
+
+} } // namespace mndl::faceshift
@@ -17,18 +17,20 @@
 
 #include <iostream>
 #include <algorithm>
+#include <fstream>
 #include <iterator>
 
 #include <boost/assign.hpp>
+#include <boost/lexical_cast.hpp>
 
-#include "cinder/app/App.h"
 #include "cinder/DataSource.h"
-#include "cinder/ObjLoader.h"
 
+#include "AssetPath.h"
 #include "ciFaceShift.h"
 
 using namespace ci;
 using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
 
 namespace mndl { namespace faceshift {
 
@@ -47,48 +49,162 @@ const std::vector< std::string > ciFaceShift::sBlendshapeNames =
 		( "ChinLowerRaise" )( "ChinUpperRaise" )( "Sneer" )( "Puff" )
 		( "CheekSquint_L" )( "CheekSquint_R" );
 
+const size_t ciFaceShift::kMaxMarkers;
+const size_t ciFaceShift::kBlendBatchReserve;
+
+static const boost::posix_time::time_duration sMinReconnectDelay = boost::posix_time::milliseconds( 250 );
+static const boost::posix_time::time_duration sMaxReconnectDelay = boost::posix_time::seconds( 8 );
+
 ciFaceShift::ciFaceShift() :
+	mResolver( mIoService ),
 	mSocket ( mIoService ),
+	mReconnectTimer( mIoService ),
+	mIoMode( IO_THREAD ),
+	mNumFramesReceived( 0 ),
+	mConnected( false ),
+	mAutoReconnect( true ),
+	mReconnecting( false ),
+	mImporting( false ),
+	mImportGeneration( 0 ),
+	mAutoReload( false ),
+	mReloadInterval( 1.0 ),
+	mReloadCheckTime( 0.0 ),
 	mTimestamp( 0 ),
 	mTrackingSuccessful( false ),
-	mBlendNeedsUpdate( false )
+	mLocalClock( true ),
+	mReceiveTime( 0.0 ),
+	mNumMarkers( 0 ),
+	mBlendMeshes( 1 ),
+	mBlendMeshSerials( 1, 0 ),
+	mBlendSerial( 0 ),
+	mBlendNeedsUpdate( false ),
+	mOutputMode( OUTPUT_LOCAL ),
+	mExactBoundsSerial( 0 ),
+	mExactBoundsValid( false ),
+	mBlendCacheBudget( 0 ),
+	mBlendCacheQuantizationStep( 0.f )
 {
+	// the frame storage is preallocated, so receiving and blending frames
+	// does not allocate
+	mBlendshapeWeights.reserve( SharedFrame::kMaxBlendshapes );
 	mBlendshapeWeights.assign( sBlendshapeNames.size(), 0.f );
+	mBlendWeights.reserve( SharedFrame::kMaxBlendshapes );
 }
 
 ciFaceShift::~ciFaceShift()
 {
 	close();
+	// run the handlers closing the connection and the relay
 	if ( mThread )
+	{
 		mThread->join();
+	}
+	else
+	{
+		if ( mIoService.stopped() )
+			mIoService.reset();
+		mIoService.poll();
+	}
+	// superseded imports finish in the background, wait for all of them
+	for ( size_t i = 0; i < mImportThreads.size(); i++ )
+		mImportThreads[ i ]->join();
 }
 
 void ciFaceShift::connect( std::string host /* = "127.0.0.1" */,
 						   std::string port /* = "33433" */ )
 {
-	tcp::resolver resolver( mIoService );
+	if ( mIoMode == IO_POLL )
+	{
+		// the handlers run in poll() on the caller's thread
+		if ( !mWork )
+		{
+			mIoService.reset();
+			mWork = std::shared_ptr< boost::asio::io_service::work >(
+					new boost::asio::io_service::work( mIoService ) );
+		}
+	}
+	else
+	{
+		// wait for the I/O thread of a closed connection to finish
+		if ( mThread && !mWork )
+		{
+			mThread->join();
+			mThread.reset();
+		}
+
+		if ( !mThread )
+		{
+			mIoService.reset();
+			mWork = std::shared_ptr< boost::asio::io_service::work >(
+					new boost::asio::io_service::work( mIoService ) );
+			mThread = std::shared_ptr< boost::thread >( new boost::thread( boost::bind(
+							&boost::asio::io_service::run, &mIoService ) ) );
+		}
+	}
+
+	mIoService.post( boost::bind( &ciFaceShift::doClose, this ) );
+	{
+		FrameLock lock( this );
+		mHost = host;
+		mPort = port;
+		mReconnectDelay = sMinReconnectDelay;
+	}
+	mIoService.post( boost::bind( &ciFaceShift::doConnect, this ) );
+}
+
+void ciFaceShift::doConnect()
+{
+	std::string host;
+	std::string port;
+	{
+		FrameLock lock( this );
+		host = mHost;
+		port = mPort;
+		mReconnecting = true;
+	}
+
 	tcp::resolver::query query( host, port );
-	tcp::resolver::iterator iterator = resolver.resolve( query );
-	tcp::endpoint endpoint = *iterator;
+	mResolver.async_resolve( query,
+			boost::bind( &ciFaceShift::handleResolve, this,
+				boost::asio::placeholders::error, boost::asio::placeholders::iterator ) );
+}
+
+void ciFaceShift::handleResolve( const boost::system::error_code& error,
+								 tcp::resolver::iterator endpoint_iterator )
+{
+	if ( error == boost::asio::error::operation_aborted )
+		return;
 
+	if ( error )
+	{
+		scheduleReconnect( error );
+		return;
+	}
+
+	tcp::endpoint endpoint = *endpoint_iterator;
 	mSocket.async_connect( endpoint,
 							boost::bind( &ciFaceShift::handleConnect, this,
-							boost::asio::placeholders::error, ++iterator ) );
-
-	mThread = std::shared_ptr< boost::thread >( new boost::thread( boost::bind(
-					&boost::asio::io_service::run, &mIoService ) ) );
+							boost::asio::placeholders::error, ++endpoint_iterator ) );
 }
 
 void ciFaceShift::handleConnect( const boost::system::error_code& error,
 								 tcp::resolver::iterator endpoint_iterator )
 {
+	if ( error == boost::asio::error::operation_aborted )
+		return;
+
 	if ( !error )
 	{
-		boost::asio::async_read( mSocket,
-				mStream,
-				boost::asio::transfer_at_least( 1 ),
-				boost::bind( &ciFaceShift::handleRead, this,
-					boost::asio::placeholders::error ) );
+		{
+			FrameLock lock( this );
+			mConnected = true;
+			mConnectionError.clear();
+			mReconnectDelay = sMinReconnectDelay;
+			// fsStudio might have been restarted with a different clock
+			mClockSync.reset();
+		}
+
+		asyncRead();
 	}
 	else if ( endpoint_iterator != tcp::resolver::iterator() )
 	{
@@ -100,20 +216,103 @@ void ciFaceShift::handleConnect( const boost::system::error_code& error,
 	}
 	else
 	{
-		throw boost::system::system_error( error );
+		scheduleReconnect( error );
 	}
 }
 
+void ciFaceShift::scheduleReconnect( const boost::system::error_code& error )
+{
+	mSocket.close();
+	mStream.consume( mStream.size() );
+
+	FrameLock lock( this );
+	mConnected = false;
+	mConnectionError = error.message();
+	if ( !mAutoReconnect || !mReconnecting )
+		return;
+
+	mReconnectTimer.expires_from_now( mReconnectDelay );
+	mReconnectTimer.async_wait( boost::bind( &ciFaceShift::handleReconnectTimer, this,
+				boost::asio::placeholders::error ) );
+	mReconnectDelay = std::min( mReconnectDelay * 2, sMaxReconnectDelay );
+}
+
+void ciFaceShift::handleReconnectTimer( const boost::system::error_code& error )
+{
+	if ( error )
+		return;
+
+	doConnect();
+}
+
 void ciFaceShift::handleRead( const boost::system::error_code& error )
 {
 	if ( error )
 	{
-		doClose();
+		if ( error != boost::asio::error::operation_aborted )
+			scheduleReconnect( error );
 		return;
 	}
 
-	std::istream is( &mStream );
+	mNumFramesReceived += decodeFrames( mLocalClock.getSeconds() );
+	asyncRead();
+}
+
+size_t ciFaceShift::decodeFrames( double receiveTime )
+{
+	const size_t headerSize = 2 * sizeof( uint16_t ) + sizeof( uint32_t );
+	size_t numFrames = 0;
+	while ( mStream.size() >= headerSize )
+	{
+		const char *header = boost::asio::buffer_cast< const char * >( mStream.data() );
+		uint16_t blockId;
+		uint32_t blockSize;
+		std::copy( header, header + sizeof( uint16_t ), reinterpret_cast< char * >( &blockId ) );
+		std::copy( header + 2 * sizeof( uint16_t ), header + headerSize, reinterpret_cast< char * >( &blockSize ) );
+		if ( blockId != FS_DATA_CONTAINER_BLOCK )
+		{
+			// out of sync, drop the buffered data
+			mStream.consume( mStream.size() );
+			break;
+		}
+
+		size_t frameSize = headerSize + blockSize;
+		if ( mStream.size() < frameSize )
+			break;
+
+		size_t bufferedSize = mStream.size();
+		std::istream is( &mStream );
+		if ( readFrame( is ) )
+		{
+			{
+				FrameLock lock( this );
+				mReceiveTime = receiveTime;
+				mClockSync.addSample( mTimestamp, receiveTime );
+			}
+			publishFrame();
+			numFrames++;
+		}
+
+		// skip the blocks of the frame which were not read
+		size_t readSize = bufferedSize - mStream.size();
+		if ( readSize < frameSize )
+			mStream.consume( frameSize - readSize );
+	}
+	return numFrames;
+}
+
+void ciFaceShift::asyncRead()
+{
+	boost::asio::async_read( mSocket,
+			mStream,
+			boost::asio::transfer_at_least( 1 ),
+			detail::makeAllocHandler( mReadAllocator,
+				boost::bind( &ciFaceShift::handleRead, this,
+					boost::asio::placeholders::error ) ) );
+}
 
+bool ciFaceShift::readFrame( std::istream& is )
+{
 	uint16_t blockId;
 	uint16_t versionNumber;
 	uint32_t blockSize;
@@ -121,6 +320,8 @@ void ciFaceShift::handleRead( const boost::system::error_code& error )
 	readRaw( is, blockId );
 	readRaw( is, versionNumber );
 	readRaw( is, blockSize );
+	if ( !is )
+		return false;
 
 	if ( blockId == FS_DATA_CONTAINER_BLOCK )
 	{
@@ -136,7 +337,7 @@ void ciFaceShift::handleRead( const boost::system::error_code& error )
 			{
 				case FS_FRAME_INFO_BLOCK:
 				{
-					boost::lock_guard< boost::mutex > lock( mMutex );
+					FrameLock lock( this );
 					readRaw( is, mTimestamp );
 					uint8_t success;
 					readRaw( is, success );
@@ -146,7 +347,7 @@ void ciFaceShift::handleRead( const boost::system::error_code& error )
 
 				case FS_POSE_BLOCK:
 				{
-					boost::lock_guard< boost::mutex > lock( mMutex );
+					FrameLock lock( this );
 					readRaw( is, mHeadOrientation.v.x );
 					readRaw( is, mHeadOrientation.v.y );
 					readRaw( is, mHeadOrientation.v.z );
@@ -154,14 +355,20 @@ void ciFaceShift::handleRead( const boost::system::error_code& error )
 					readRaw( is, mHeadPosition.x );
 					readRaw( is, mHeadPosition.y );
 					readRaw( is, mHeadPosition.z );
+					if ( mOutputMode == OUTPUT_WORLD )
+						mBlendNeedsUpdate = true;
 					break;
 				}
 
 				case FS_BLENDSHAPES_BLOCK:
 				{
-					boost::lock_guard< boost::mutex > lock( mMutex );
+					FrameLock lock( this );
 					uint32_t blendshapeCount;
 					readRaw( is, blendshapeCount );
+					// a corrupt count would allocate on the I/O thread, the frame is dropped
+					if ( !is || ( blendshapeCount > SharedFrame::kMaxBlendshapes ) ||
+						 ( blockSize < sizeof( uint32_t ) + blendshapeCount * sizeof( float ) ) )
+						return false;
 
 					if ( blendshapeCount != mBlendshapeWeights.size() )
 					{
@@ -178,153 +385,613 @@ void ciFaceShift::handleRead( const boost::system::error_code& error )
 
 				case FS_EYES_BLOCK:
 				{
-					boost::lock_guard< boost::mutex > lock( mMutex );
+					FrameLock lock( this );
 					readRaw( is, mLeftEyeRotation.theta );
 					readRaw( is, mLeftEyeRotation.phi );
 					readRaw( is, mRightEyeRotation.theta );
 					readRaw( is, mRightEyeRotation.phi );
+					if ( mOutputMode == OUTPUT_WORLD )
+						mBlendNeedsUpdate = true;
 					break;
 				}
 
 				case FS_MARKERS_BLOCK:
 				{
-					boost::lock_guard< boost::mutex > lock( mMutex );
-					mMarkers.clear();
+					FrameLock lock( this );
 					uint16_t markerCount;
 					readRaw( is, markerCount );
+					mNumMarkers = std::min< size_t >( markerCount, kMaxMarkers );
 					for ( uint16_t i = 0; i < markerCount; ++i )
 					{
 						Vec3f marker;
 						readRaw( is, marker.x );
 						readRaw( is, marker.y );
 						readRaw( is, marker.z );
-						mMarkers.push_back( marker );
+						if ( i < kMaxMarkers )
+							mMarkers[ i ] = marker;
 					}
 					break;
 				}
 			}
 		}
+
+		return is.good();
 	}
 
-	mStream.consume( mStream.size() );
-	boost::asio::async_read( mSocket,
-			mStream,
-			boost::asio::transfer_at_least( 1 ),
-			boost::bind( &ciFaceShift::handleRead, this,
-				boost::asio::placeholders::error ) );
+	return false;
 }
 
 void ciFaceShift::doClose()
 {
+	{
+		FrameLock lock( this );
+		mConnected = false;
+		mReconnecting = false;
+	}
+	mReconnectTimer.cancel();
+	mResolver.cancel();
 	mSocket.close();
+	mStream.consume( mStream.size() );
 }
 
 void ciFaceShift::close()
 {
 	mIoService.post( boost::bind( &ciFaceShift::doClose, this ) );
+	// the listening relay always has an accept pending, which would keep
+	// the I/O thread running
+	mIoService.post( boost::bind( &ciFaceShift::doSetRelay, this, std::shared_ptr< Relay >() ) );
+	// let the I/O thread finish when the pending handlers are done
+	mWork.reset();
 }
 
-void ciFaceShift::import( fs::path folder, bool exportTrimesh /* = false */ )
+void ciFaceShift::setIoMode( IoMode mode )
+{
+	if ( mode == mIoMode )
+		return;
+
+	// finish the pending handlers in the current mode
+	close();
+	if ( mThread )
+	{
+		mThread->join();
+		mThread.reset();
+	}
+	else
+	{
+		mIoService.poll();
+	}
+	mIoMode = mode;
+}
+
+size_t ciFaceShift::poll()
+{
+	if ( mIoMode != IO_POLL )
+		return 0;
+
+	// the service stops when it runs out of work, for instance after close()
+	if ( mIoService.stopped() )
+		mIoService.reset();
+
+	size_t numFrames = mNumFramesReceived;
+	mIoService.poll();
+	return mNumFramesReceived - numFrames;
+}
+
+void ciFaceShift::publishSharedMemory( const std::string &name /* = "/faceshift" */,
+									  size_t numSlots /* = 4 */ )
 {
-	fs::path dataPath = app::getAssetPath( folder );
+	std::shared_ptr< SharedFramePublisher > publisher( new SharedFramePublisher( name, numSlots ) );
+	FrameLock lock( this );
+	mSharedFramePublisher = publisher;
+}
 
-	std::vector< fs::path > folderContents;
-	copy( fs::directory_iterator( dataPath ), fs::directory_iterator(), std::back_inserter( folderContents ) );
-	std::sort( folderContents.begin(), folderContents.end() );
+void ciFaceShift::stopPublishingSharedMemory()
+{
+	FrameLock lock( this );
+	mSharedFramePublisher.reset();
+}
 
-	for ( std::vector< fs::path >::const_iterator it = folderContents.begin();
-			it != folderContents.end(); ++it )
+void ciFaceShift::startRelay( unsigned short tcpPort /* = 33434 */ )
+{
+	std::shared_ptr< Relay > relay = Relay::create( mIoService, tcpPort );
+	mIoService.post( boost::bind( &ciFaceShift::doSetRelay, this, relay ) );
+}
+
+void ciFaceShift::addRelayUdpTarget( const std::string &host, const std::string &port /* = "33433" */ )
+{
+	mIoService.post( boost::bind( &ciFaceShift::doAddRelayUdpTarget, this, host, port ) );
+}
+
+void ciFaceShift::stopRelay()
+{
+	mIoService.post( boost::bind( &ciFaceShift::doSetRelay, this, std::shared_ptr< Relay >() ) );
+}
+
+void ciFaceShift::doSetRelay( std::shared_ptr< Relay > relay )
+{
+	if ( mRelay )
+		mRelay->close();
+	mRelay = relay;
+	if ( mRelay )
+		mRelay->start();
+}
+
+void ciFaceShift::doAddRelayUdpTarget( std::string host, std::string port )
+{
+	std::shared_ptr< udp::resolver > resolver( new udp::resolver( mIoService ) );
+	udp::resolver::query query( udp::v4(), host, port );
+	resolver->async_resolve( query,
+			boost::bind( &ciFaceShift::handleRelayUdpResolve, this, resolver, host + ":" + port,
+				boost::asio::placeholders::error, boost::asio::placeholders::iterator ) );
+}
+
+// the resolver is bound to the handler to keep it alive until the handler is called
+void ciFaceShift::handleRelayUdpResolve( std::shared_ptr< udp::resolver > /* resolver */, std::string target,
+										 const boost::system::error_code& error,
+										 udp::resolver::iterator endpoint_iterator )
+{
+	if ( error == boost::asio::error::operation_aborted )
+		return;
+
+	if ( error || ( endpoint_iterator == udp::resolver::iterator() ) )
 	{
-		if ( fs::is_regular_file( *it ) && ( it->extension().string() == ".obj" ) ||
-			 ( it->extension().string() == ".trimesh" ) )
-		{
-			if ( it->filename().extension().string() == ".obj" )
-			{
-				fs::path trimeshPath = *it;
-				trimeshPath.replace_extension( ".trimesh" );
+		FrameLock lock( this );
+		mRelayError = "cannot resolve relay target " + target + ": " +
+			( error ? error.message() : std::string( "no address" ) );
+		return;
+	}
 
-				if ( fs::exists( trimeshPath ) )
-					continue;
+	if ( mRelay )
+		mRelay->addUdpTarget( *endpoint_iterator );
+}
 
-				ObjLoader loader( loadFile( *it ) );
-				if ( it->filename().stem() == "Neutral" )
-				{
-					// no normals, with texcoords, optimization
-					loader.load( &mNeutralMesh, false, true, true );
-					// the original faceshift models have no normals, it is
-					// better to recalculate the smooth normals
-					if ( !mNeutralMesh.hasNormals() )
-						mNeutralMesh.recalculateNormals();
-
-					if ( exportTrimesh )
-						mNeutralMesh.write( writeFile( trimeshPath ) );
-				}
-				else
-				{
-					TriMesh trimesh;
-					// no normals, with texcoords, optimization
-					loader.load( &trimesh, false, true, true );
-					if ( !trimesh.hasNormals() )
-						trimesh.recalculateNormals();
-					mBlendshapeMeshes.push_back( trimesh );
-
-					if ( exportTrimesh )
-						trimesh.write( writeFile( trimeshPath ) );
-				}
-			}
-			else // .trimesh
-			{
-				if ( it->filename().stem() == "Neutral" )
-				{
-					mNeutralMesh.read( loadFile( *it ) );
-				}
-				else
-				{
-					TriMesh trimesh;
-					trimesh.read( loadFile( *it ) );
-					mBlendshapeMeshes.push_back( trimesh );
-				}
-			}
+std::string ciFaceShift::getRelayError() const
+{
+	FrameLock lock( this );
+	return mRelayError;
+}
+
+void ciFaceShift::encodeFrame( std::vector< char > &data ) const
+{
+	data.clear();
+	size_t containerSizeOffset = beginBlock( data, FS_DATA_CONTAINER_BLOCK );
+	writeRaw( data, uint16_t( 5 ) ); // number of blocks
+
+	size_t sizeOffset = beginBlock( data, FS_FRAME_INFO_BLOCK );
+	writeRaw( data, mTimestamp );
+	writeRaw( data, uint8_t( mTrackingSuccessful ? 1 : 0 ) );
+	endBlock( data, sizeOffset );
+
+	sizeOffset = beginBlock( data, FS_POSE_BLOCK );
+	writeRaw( data, mHeadOrientation.v.x );
+	writeRaw( data, mHeadOrientation.v.y );
+	writeRaw( data, mHeadOrientation.v.z );
+	writeRaw( data, mHeadOrientation.w );
+	writeRaw( data, mHeadPosition.x );
+	writeRaw( data, mHeadPosition.y );
+	writeRaw( data, mHeadPosition.z );
+	endBlock( data, sizeOffset );
+
+	sizeOffset = beginBlock( data, FS_BLENDSHAPES_BLOCK );
+	writeRaw( data, uint32_t( mBlendshapeWeights.size() ) );
+	for ( size_t i = 0; i < mBlendshapeWeights.size(); i++ )
+		writeRaw( data, mBlendshapeWeights[ i ] );
+	endBlock( data, sizeOffset );
+
+	sizeOffset = beginBlock( data, FS_EYES_BLOCK );
+	writeRaw( data, mLeftEyeRotation.theta );
+	writeRaw( data, mLeftEyeRotation.phi );
+	writeRaw( data, mRightEyeRotation.theta );
+	writeRaw( data, mRightEyeRotation.phi );
+	endBlock( data, sizeOffset );
+
+	sizeOffset = beginBlock( data, FS_MARKERS_BLOCK );
+	writeRaw( data, uint16_t( mNumMarkers ) );
+	for ( size_t i = 0; i < mNumMarkers; i++ )
+	{
+		writeRaw( data, mMarkers[ i ].x );
+		writeRaw( data, mMarkers[ i ].y );
+		writeRaw( data, mMarkers[ i ].z );
+	}
+	endBlock( data, sizeOffset );
+
+	endBlock( data, containerSizeOffset );
+}
+
+size_t ciFaceShift::beginBlock( std::vector< char >& buffer, uint16_t blockId )
+{
+	writeRaw( buffer, blockId );
+	writeRaw( buffer, uint16_t( 1 ) ); // version
+	size_t sizeOffset = buffer.size();
+	writeRaw( buffer, uint32_t( 0 ) );
+	return sizeOffset;
+}
+
+void ciFaceShift::endBlock( std::vector< char >& buffer, size_t sizeOffset )
+{
+	// the block size does not include the block header
+	uint32_t blockSize = buffer.size() - sizeOffset - sizeof( uint32_t );
+	const char *bytes = reinterpret_cast< const char * >( &blockSize );
+	std::copy( bytes, bytes + sizeof( uint32_t ), buffer.begin() + sizeOffset );
+}
+
+void ciFaceShift::startRecording( const fs::path &path )
+{
+	std::shared_ptr< std::ofstream > stream( new std::ofstream( path.string().c_str(),
+				std::ios::out | std::ios::binary | std::ios::trunc ) );
+	mIoService.post( boost::bind( &ciFaceShift::doSetRecording, this, stream ) );
+}
+
+void ciFaceShift::stopRecording()
+{
+	mIoService.post( boost::bind( &ciFaceShift::doSetRecording, this, std::shared_ptr< std::ofstream >() ) );
+}
+
+void ciFaceShift::doSetRecording( std::shared_ptr< std::ofstream > stream )
+{
+	mRecordingStream = stream;
+}
+
+void ciFaceShift::publishFrame()
+{
+	if ( mRelay || mRecordingStream )
+	{
+		// the relay holds on to the buffers of slow clients, a new buffer
+		// is only allocated while the previous one is still in use
+		if ( !mFrameBuffer || !mFrameBuffer.unique() )
+			mFrameBuffer = std::shared_ptr< std::vector< char > >( new std::vector< char >() );
+		{
+			FrameLock lock( this );
+			encodeFrame( *mFrameBuffer );
 		}
+		Relay::BufferRef buffer = mFrameBuffer;
+
+		if ( mRelay )
+			mRelay->broadcast( buffer );
+		if ( mRecordingStream )
+			mRecordingStream->write( &( *buffer )[ 0 ], buffer->size() );
+	}
+
+	FrameLock lock( this );
+	if ( !mSharedFramePublisher )
+		return;
+
+	SharedFrame frame;
+	frame.mTimestamp = mTimestamp;
+	frame.mTrackingSuccessful = mTrackingSuccessful;
+	frame.mHeadOrientation = mHeadOrientation;
+	frame.mHeadPosition = mHeadPosition;
+	frame.mLeftEyeRotation = mLeftEyeRotation.toQuat();
+	frame.mRightEyeRotation = mRightEyeRotation.toQuat();
+
+	frame.mNumBlendshapes = std::min( mBlendshapeWeights.size(), SharedFrame::kMaxBlendshapes );
+	std::copy( mBlendshapeWeights.begin(), mBlendshapeWeights.begin() + frame.mNumBlendshapes,
+			   frame.mBlendshapeWeights );
+
+	frame.mNumMarkers = std::min( mNumMarkers, SharedFrame::kMaxMarkers );
+	std::copy( mMarkers, mMarkers + frame.mNumMarkers, frame.mMarkers );
+
+	mSharedFramePublisher->publish( frame );
+}
+
+bool ciFaceShift::isConnected() const
+{
+	FrameLock lock( this );
+	return mConnected;
+}
+
+void ciFaceShift::setAutoReconnect( bool enable /* = true */ )
+{
+	FrameLock lock( this );
+	mAutoReconnect = enable;
+}
+
+std::string ciFaceShift::getConnectionError() const
+{
+	FrameLock lock( this );
+	return mConnectionError;
+}
+
+void ciFaceShift::import( fs::path folder, bool exportTrimesh /* = false */ )
+{
+	import( folder, Rig::Format().exportTrimesh( exportTrimesh ) );
+}
+
+void ciFaceShift::import( fs::path folder, const Rig::Format &format )
+{
+	setRig( Rig::create( detail::findAssetPath( folder ), format ) );
+}
+
+void ciFaceShift::importAsync( fs::path folder, bool exportTrimesh /* = false */,
+							   ImportCallback callback /* = ImportCallback() */ )
+{
+	importAsync( folder, Rig::Format().exportTrimesh( exportTrimesh ), callback );
+}
+
+void ciFaceShift::importAsync( fs::path folder, const Rig::Format &format,
+							   ImportCallback callback /* = ImportCallback() */ )
+{
+	uint32_t generation;
+	{
+		// supersede the running import and drop a finished one which was not installed yet
+		boost::lock_guard< boost::mutex > lock( mMutex );
+		mImporting = true;
+		mImportError.clear();
+		mImportedRig.reset();
+		generation = ++mImportGeneration;
+	}
+
+	// the asset path is resolved on the caller's thread
+	startImportThread( boost::bind( &ciFaceShift::importThread, this, detail::findAssetPath( folder ),
+									format, callback, generation ) );
+}
+
+void ciFaceShift::startImportThread( const boost::function< void () > &function )
+{
+	// the superseded imports still running are joined later
+	for ( size_t i = 0; i < mImportThreads.size(); )
+	{
+		if ( mImportThreads[ i ]->timed_join( boost::posix_time::seconds( 0 ) ) )
+			mImportThreads.erase( mImportThreads.begin() + i );
+		else
+			i++;
 	}
 
-	/*
-	const std::vector< Vec3f >& neutralVertices = mNeutralMesh.getVertices();
-	for ( std::vector< TriMesh >::iterator it = mBlendshapeMeshes.begin();
-			it != mBlendshapeMeshes.end(); ++it )
+	mImportThreads.push_back( std::shared_ptr< boost::thread >( new boost::thread( function ) ) );
+}
+
+void ciFaceShift::importThread( fs::path folder, Rig::Format format, ImportCallback callback,
+								uint32_t generation )
+{
+	RigRef rig;
+	std::string error;
+	try
 	{
-		std::vector< Vec3f >& vertices = it->getVertices();
-		for ( size_t n = 0; n < vertices.size(); n++ )
+		rig = Rig::create( folder, format );
+	}
+	catch ( const std::exception &exc )
+	{
+		error = exc.what();
+	}
+
+	{
+		boost::lock_guard< boost::mutex > lock( mMutex );
+		// a newer import started in the meantime
+		if ( generation != mImportGeneration )
+			return;
+
+		mImportedRig = rig;
+		mImportError = error;
+		mImporting = false;
+	}
+
+	if ( callback )
+		callback( rig );
+}
+
+bool ciFaceShift::isImporting() const
+{
+	boost::lock_guard< boost::mutex > lock( mMutex );
+	return mImporting;
+}
+
+std::string ciFaceShift::getImportError() const
+{
+	boost::lock_guard< boost::mutex > lock( mMutex );
+	return mImportError;
+}
+
+void ciFaceShift::installImportedRig()
+{
+	RigRef rig;
+	{
+		boost::lock_guard< boost::mutex > lock( mMutex );
+		if ( !mImportedRig )
+			return;
+		rig.swap( mImportedRig );
+	}
+	setRig( rig );
+}
+
+void ciFaceShift::setAutoReload( bool enable /* = true */, double interval /* = 1.0 */ )
+{
+	mAutoReload = enable;
+	mReloadInterval = interval;
+}
+
+void ciFaceShift::checkReload()
+{
+	if ( !mAutoReload || !mRig || mRig->getFolder().empty() )
+		return;
+
+	double time = mLocalClock.getSeconds();
+	if ( time - mReloadCheckTime < mReloadInterval )
+		return;
+	mReloadCheckTime = time;
+
+	try
+	{
+		if ( !mRig->isModified() )
+			return;
+	}
+	catch ( const std::exception & )
+	{
+		// the folder might be replaced by the export, checked again next time
+		return;
+	}
+
+	uint32_t generation;
+	{
+		boost::lock_guard< boost::mutex > lock( mMutex );
+		if ( mImporting || mImportedRig )
+			return;
+		mImporting = true;
+		generation = ++mImportGeneration;
+	}
+
+	startImportThread( boost::bind( &ciFaceShift::reloadThread, this, mRig, generation ) );
+}
+
+void ciFaceShift::reloadThread( RigRef rig, uint32_t generation )
+{
+	RigRef reloaded;
+	std::string error;
+	try
+	{
+		reloaded = Rig::reimport( rig );
+	}
+	catch ( const std::exception &exc )
+	{
+		// the export might still be written, it is retried on the next check
+		error = exc.what();
+	}
+
+	boost::lock_guard< boost::mutex > lock( mMutex );
+	// superseded by an import
+	if ( generation != mImportGeneration )
+		return;
+
+	if ( reloaded && ( reloaded != rig ) )
+		mImportedRig = reloaded;
+	mImportError = error;
+	mImporting = false;
+}
+
+void ciFaceShift::setRig( RigRef rig )
+{
+	mRig = rig;
+	if ( mRig )
+	{
+		mBlendMeshes.resize( mRig->getNumLevels() );
+		for ( size_t l = 0; l < mBlendMeshes.size(); l++ )
+			mBlendMeshes[ l ] = mRig->getLevel( l ).getNeutralMesh();
+	}
+	else
+	{
+		mBlendMeshes.assign( 1, TriMesh() );
+	}
+	mBlendMeshSerials.assign( mBlendMeshes.size(), mBlendSerial );
+	mExactBoundsValid = false;
+	mBlendBatch.reserve( kBlendBatchReserve );
+
+	if ( mBlendCache )
+		enableBlendCache( mBlendCacheBudget, mBlendCacheQuantizationStep );
+
+	// the loaded definition maps to the blendshape names of the new rig
+	if ( mRig && !mRetargeterFile.empty() )
+	{
+		try
 		{
-			vertices[ n ] -= neutralVertices[ n ];
+			compileRetargeter();
+		}
+		catch ( const std::exception &exc )
+		{
+			FrameLock lock( this );
+			mRetargeter.reset();
+			mRetargeterError = exc.what();
 		}
 	}
-	*/
 
-	mBlendMesh = mNeutralMesh;
+	FrameLock lock( this );
+	mBlendNeedsUpdate = true;
+}
+
+void ciFaceShift::loadRetargeter( fs::path file )
+{
+	mRetargeterFile = detail::findAssetPath( file );
+	if ( mRetargeterFile.empty() )
+		throw RetargeterExc( "cannot find " + file.string() );
+
+	// without a rig the definition is compiled when a rig is set
+	if ( mRig )
+		compileRetargeter();
+}
+
+void ciFaceShift::compileRetargeter()
+{
+	RetargeterRef retargeter = Retargeter::create( loadFile( mRetargeterFile ),
+			sBlendshapeNames, mRig->getBlendshapeNames() );
+
+	FrameLock lock( this );
+	mRetargeter = retargeter;
+	mRetargeterError.clear();
+	mBlendNeedsUpdate = true;
+}
+
+void ciFaceShift::setRetargeter( RetargeterRef retargeter )
+{
+	FrameLock lock( this );
+	mRetargeter = retargeter;
+	mRetargeterFile.clear();
+	mRetargeterError.clear();
+	mBlendNeedsUpdate = true;
+}
+
+std::string ciFaceShift::getRetargeterError() const
+{
+	FrameLock lock( this );
+	return mRetargeterError;
 }
 
 Quatf ciFaceShift::getRotation() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mHeadOrientation;
 }
 
 Vec3f ciFaceShift::getPosition() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mHeadPosition;
 }
 
 double ciFaceShift::getTimestamp() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mTimestamp;
 }
 
+double ciFaceShift::getReceiveTime() const
+{
+	FrameLock lock( this );
+	return mReceiveTime;
+}
+
+double ciFaceShift::toLocalTime( double timestamp ) const
+{
+	FrameLock lock( this );
+	return mClockSync.toLocalTime( timestamp );
+}
+
+double ciFaceShift::getFrameAge() const
+{
+	FrameLock lock( this );
+	if ( mClockSync.getNumSamples() == 0 )
+		return 0.0;
+	return mLocalClock.getSeconds() - mClockSync.toLocalTime( mTimestamp );
+}
+
+double ciFaceShift::getFrameDelay() const
+{
+	FrameLock lock( this );
+	return mClockSync.getDelay();
+}
+
+double ciFaceShift::getFrameJitter() const
+{
+	FrameLock lock( this );
+	return mClockSync.getJitter();
+}
+
+double ciFaceShift::getClockDrift() const
+{
+	FrameLock lock( this );
+	return mClockSync.getDrift();
+}
+
 bool ciFaceShift::isTrackingSuccessful() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mTrackingSuccessful;
 }
 
@@ -333,72 +1000,328 @@ const std::vector< std::string >& ciFaceShift::getBlendshapeNames() const
 	return sBlendshapeNames;
 }
 
-std::string ciFaceShift::getBlendshapeName( size_t i ) const
+const std::string& ciFaceShift::getBlendshapeName( size_t i ) const
 {
 	return sBlendshapeNames[ i ];
 }
 
 size_t ciFaceShift::getNumBlendshapes() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mBlendshapeWeights.size();
 }
 
 const std::vector< float >& ciFaceShift::getBlendshapeWeights() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mBlendshapeWeights;
 }
 
 float ciFaceShift::getBlendshapeWeight( size_t i ) const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mBlendshapeWeights[ i ];
 }
 
 Quatf ciFaceShift::getLeftEyeRotation() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mLeftEyeRotation.toQuat();
 }
 
 Quatf ciFaceShift::getRightEyeRotation() const
 {
-	boost::lock_guard< boost::mutex > lock( mMutex );
+	FrameLock lock( this );
 	return mRightEyeRotation.toQuat();
 }
 
 const TriMesh& ciFaceShift::getBlendshapeMesh( size_t i ) const
 {
-	return mBlendshapeMeshes[ i ];
+	return mRig->getBlendshapeMesh( i );
 }
 
-TriMesh& ciFaceShift::getBlendMesh()
+bool ciFaceShift::prepareBlend( size_t &level )
 {
-	if ( !mBlendshapeMeshes.empty() && mBlendNeedsUpdate )
+	installImportedRig();
+	checkReload();
+
+	level = std::min( level, mBlendMeshes.size() - 1 );
+	if ( !mRig || ( mRig->getNumBlendshapes() == 0 ) )
+		return false;
+
+	FrameLock lock( this );
+	if ( !mBlendNeedsUpdate )
+		return mBlendMeshSerials[ level ] != mBlendSerial;
+
+	if ( mRetargeter && ( mRetargeter->getNumTargets() != mRig->getNumBlendshapes() ) )
 	{
-		std::vector< Vec3f >& outputVertices = mBlendMesh.getVertices();
-		const std::vector< Vec3f >& neutralVertices = mNeutralMesh.getVertices();
-		outputVertices = neutralVertices;
+		// set for a different rig, the weights are blended as received
+		if ( mRetargeterError.empty() )
+			mRetargeterError = "the retargeter has " + boost::lexical_cast< std::string >( mRetargeter->getNumTargets() ) +
+				" targets, the rig has " + boost::lexical_cast< std::string >( mRig->getNumBlendshapes() ) + " blendshapes";
+	}
+	else if ( mRetargeter )
+	{
+		// the retargeter writes the rig weights directly into the blend buffer
+		mBlendWeights.resize( mRetargeter->getNumTargets() );
+		mRetargeter->evaluate( &mBlendshapeWeights[ 0 ], mBlendshapeWeights.size(),
+							   &mBlendWeights[ 0 ] );
+	}
+	else
+	{
+		mBlendWeights = mBlendshapeWeights;
+	}
+
+	if ( mRig->getNumCorrectives() > 0 )
+	{
+		// the corrective activations follow the blendshape weights
+		size_t numBlendshapes = mRig->getNumBlendshapes();
+		mBlendWeights.resize( mRig->getNumBlendWeights(), 0.f );
+		mRig->evaluateCorrectives( &mBlendWeights[ 0 ], numBlendshapes, &mBlendWeights[ numBlendshapes ] );
+	}
+
+	if ( mOutputMode == OUTPUT_WORLD )
+	{
+		mBlendPose.mHeadRotation = mHeadOrientation;
+		mBlendPose.mHeadPosition = mHeadPosition;
+		mBlendPose.mLeftEyeRotation = mLeftEyeRotation.toQuat();
+		mBlendPose.mRightEyeRotation = mRightEyeRotation.toQuat();
+	}
+	mBlendNeedsUpdate = false;
+	mBlendSerial++;
+	return true;
+}
 
-		for ( size_t i = 0; i < mBlendshapeWeights.size(); i++ )
+TriMesh& ciFaceShift::getBlendMesh( size_t level /* = 0 */ )
+{
+	if ( prepareBlend( level ) )
+		blend( level );
+
+	return mBlendMeshes[ level ];
+}
+
+void ciFaceShift::blend( size_t level )
+{
+	const Rig &rig = mRig->getLevel( level );
+	TriMesh &blendMesh = mBlendMeshes[ level ];
+	mBlendMeshSerials[ level ] = mBlendSerial;
+
+	const float *weights = &mBlendWeights[ 0 ];
+	Vec3f *output = &blendMesh.getVertices()[ 0 ];
+	Vec3f *normalOutput = blendMesh.hasNormals() ? &blendMesh.getNormals()[ 0 ] : NULL;
+
+	if ( mBlendCache && ( level == 0 ) )
+	{
+		const Vec3f *cached = mBlendCache->lookup( weights, mBlendWeights.size() );
+		if ( cached != NULL )
+		{
+			std::copy( cached, cached + mBlendCache->getNumVertices(), output );
+		}
+		else
 		{
-			float weight = getBlendshapeWeight( i );
-			std::vector< Vec3f >& blendshapeVertices = mBlendshapeMeshes[ i ].getVertices();
-			for ( size_t j = 0; j < outputVertices.size(); j++ )
+			rig.blend( weights, mBlendWeights.size(), output );
+			mBlendCache->store( output );
+		}
+
+		if ( mOutputMode == OUTPUT_WORLD )
+			rig.transform( mBlendPose, output, normalOutput );
+	}
+	else if ( mOutputMode == OUTPUT_WORLD )
+	{
+		rig.blend( 1, &weights, mBlendWeights.size(), &output, &mBlendPose,
+				   normalOutput ? &normalOutput : NULL );
+	}
+	else
+	{
+		rig.blend( weights, mBlendWeights.size(), output );
+	}
+}
+
+void ciFaceShift::enableBlendCache( size_t memoryBudget /* = 64 * 1024 * 1024 */,
+									float quantizationStep /* = 1.f / 256.f */ )
+{
+	mBlendCacheBudget = memoryBudget;
+	mBlendCacheQuantizationStep = quantizationStep;
+	mBlendCache = std::shared_ptr< BlendCache >( new BlendCache(
+				mRig ? mRig->getNumVertices() : 0, memoryBudget, quantizationStep ) );
+}
+
+void ciFaceShift::disableBlendCache()
+{
+	mBlendCache.reset();
+}
+
+BlendCache::Stats ciFaceShift::getBlendCacheStats() const
+{
+	return mBlendCache ? mBlendCache->getStats() : BlendCache::Stats();
+}
+
+void ciFaceShift::setOutputMode( OutputMode mode )
+{
+	FrameLock lock( this );
+	if ( mode == mOutputMode )
+		return;
+
+	mOutputMode = mode;
+	if ( mRig )
+	{
+		// restore the neutral normals rotated by the world transformation
+		for ( size_t l = 0; l < mBlendMeshes.size(); l++ )
+			mBlendMeshes[ l ].getNormals() = mRig->getLevel( l ).getNeutralMesh().getNormals();
+	}
+	mBlendNeedsUpdate = true;
+}
+
+AxisAlignedBox3f ciFaceShift::getBounds( bool exact /* = false */ )
+{
+	if ( exact )
+	{
+		const TriMesh &mesh = getBlendMesh();
+		if ( !mExactBoundsValid || ( mExactBoundsSerial != mBlendMeshSerials[ 0 ] ) )
+		{
+			mExactBounds = mesh.calcBoundingBox();
+			mExactBoundsSerial = mBlendMeshSerials[ 0 ];
+			mExactBoundsValid = true;
+		}
+		return mExactBounds;
+	}
+
+	size_t level = 0;
+	prepareBlend( level );
+	if ( !mRig )
+		return AxisAlignedBox3f();
+
+	return mRig->calcBounds( mBlendWeights.empty() ? NULL : &mBlendWeights[ 0 ], mBlendWeights.size(),
+							 ( mOutputMode == OUTPUT_WORLD ) ? &mBlendPose : NULL );
+}
+
+Sphere ciFaceShift::getBoundingSphere()
+{
+	size_t level = 0;
+	prepareBlend( level );
+	if ( !mRig )
+		return Sphere( Vec3f::zero(), 0.f );
+
+	return mRig->calcBoundingSphere( mBlendWeights.empty() ? NULL : &mBlendWeights[ 0 ], mBlendWeights.size(),
+									 ( mOutputMode == OUTPUT_WORLD ) ? &mBlendPose : NULL );
+}
+
+bool ciFaceShift::evaluateAttachments( Attachments *attachments )
+{
+	size_t level = 0;
+	prepareBlend( level );
+	if ( !mRig || mBlendWeights.empty() )
+		return false;
+	if ( ( attachments->getRig() != mRig ) && !attachments->setRig( mRig ) )
+		return false;
+
+	attachments->evaluate( &mBlendWeights[ 0 ], mBlendWeights.size(),
+						   ( mOutputMode == OUTPUT_WORLD ) ? &mBlendPose : NULL );
+	return true;
+}
+
+void ciFaceShift::updateBlendMeshes( const std::vector< ciFaceShift * > &instances, size_t level /* = 0 */ )
+{
+	if ( instances.empty() )
+		return;
+
+	// the scratch of the first instance keeps its capacity between frames
+	BlendBatch &batch = instances.front()->mBlendBatch;
+	batch.reserve( instances.size() );
+	std::vector< ciFaceShift * > &pending = batch.mPending;
+	std::vector< size_t > &pendingLevels = batch.mPendingLevels;
+	pending.clear();
+	pendingLevels.clear();
+	for ( std::vector< ciFaceShift * >::const_iterator it = instances.begin();
+			it != instances.end(); ++it )
+	{
+		size_t instanceLevel = level;
+		if ( !( *it )->prepareBlend( instanceLevel ) )
+			continue;
+
+		// cached instances copy or store their own results
+		if ( ( *it )->mBlendCache && ( instanceLevel == 0 ) )
+		{
+			( *it )->blend( instanceLevel );
+		}
+		else
+		{
+			pending.push_back( *it );
+			pendingLevels.push_back( instanceLevel );
+		}
+	}
+
+	// blend the instances sharing a rig and output mode together
+	std::vector< const float * > &weights = batch.mWeights;
+	std::vector< Vec3f * > &outputs = batch.mOutputs;
+	std::vector< Rig::Pose > &poses = batch.mPoses;
+	std::vector< Vec3f * > &normalOutputs = batch.mNormalOutputs;
+	while ( !pending.empty() )
+	{
+		RigRef rigRef = pending.front()->mRig;
+		size_t rigLevel = pendingLevels.front();
+		const Rig &rig = rigRef->getLevel( rigLevel );
+		size_t numWeights = pending.front()->mBlendWeights.size();
+		OutputMode mode = pending.front()->mOutputMode;
+		bool hasNormals = pending.front()->mBlendMeshes[ rigLevel ].hasNormals();
+
+		weights.clear();
+		outputs.clear();
+		poses.clear();
+		normalOutputs.clear();
+		size_t i = 0;
+		while ( i < pending.size() )
+		{
+			ciFaceShift *instance = pending[ i ];
+			TriMesh &blendMesh = instance->mBlendMeshes[ pendingLevels[ i ] ];
+			if ( ( instance->mRig == rigRef ) && ( pendingLevels[ i ] == rigLevel ) &&
+				 ( instance->mBlendWeights.size() == numWeights ) &&
+				 ( instance->mOutputMode == mode ) && ( blendMesh.hasNormals() == hasNormals ) )
 			{
-				outputVertices[ j ] += weight * ( blendshapeVertices[ j ] - neutralVertices[ j ] );
+				weights.push_back( &instance->mBlendWeights[ 0 ] );
+				outputs.push_back( &blendMesh.getVertices()[ 0 ] );
+				if ( mode == OUTPUT_WORLD )
+				{
+					poses.push_back( instance->mBlendPose );
+					if ( hasNormals )
+						normalOutputs.push_back( &blendMesh.getNormals()[ 0 ] );
+				}
+				instance->mBlendMeshSerials[ rigLevel ] = instance->mBlendSerial;
+				pending.erase( pending.begin() + i );
+				pendingLevels.erase( pendingLevels.begin() + i );
+			}
+			else
+			{
+				i++;
 			}
 		}
-		mBlendNeedsUpdate = false;
+
+		if ( mode == OUTPUT_WORLD )
+		{
+			rig.blend( weights.size(), &weights[ 0 ], numWeights, &outputs[ 0 ], &poses[ 0 ],
+						hasNormals ? &normalOutputs[ 0 ] : NULL );
+		}
+		else
+		{
+			rig.blend( weights.size(), &weights[ 0 ], numWeights, &outputs[ 0 ] );
+		}
 	}
+}
 
-	return mBlendMesh;
+void ciFaceShift::BlendBatch::reserve( size_t numInstances )
+{
+	mPending.reserve( numInstances );
+	mPendingLevels.reserve( numInstances );
+	mWeights.reserve( numInstances );
+	mOutputs.reserve( numInstances );
+	mPoses.reserve( numInstances );
+	mNormalOutputs.reserve( numInstances );
 }
 
 const ci::TriMesh& ciFaceShift::getNeutralMesh() const
 {
-	return mNeutralMesh;
+	static const TriMesh emptyMesh;
+	return mRig ? mRig->getNeutralMesh() : emptyMesh;
 }
 
 } } // mndl::faceshift
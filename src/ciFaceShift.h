@@ -16,42 +16,208 @@
 */
 #pragma once
 
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#include "cinder/AxisAlignedBox.h"
 #include "cinder/Cinder.h"
 #include "cinder/CinderMath.h"
 #include "cinder/Quaternion.h"
+#include "cinder/Sphere.h"
+#include "cinder/Timer.h"
 #include "cinder/TriMesh.h"
 #include "cinder/Vector.h"
 
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
 
+#include "Attachments.h"
+#include "BlendCache.h"
+#include "ClockSync.h"
+#include "HandlerAllocator.h"
+#include "Relay.h"
+#include "Retargeter.h"
+#include "Rig.h"
+#include "SharedFrame.h"
+
 namespace mndl { namespace faceshift {
 
 class ciFaceShift
 {
 	public:
+		//! Coordinate space of the blended mesh.
+		enum OutputMode
+		{
+			OUTPUT_LOCAL, //!< blended vertices in the space of the neutral mesh
+			OUTPUT_WORLD //!< blended vertices transformed by the eye rotations and the head pose
+		};
+
+		//! Thread the network I/O runs on.
+		enum IoMode
+		{
+			IO_THREAD, //!< on a background thread started by connect()
+			IO_POLL //!< on the application thread in poll()
+		};
+
 		ciFaceShift();
 		~ciFaceShift();
 
 		/*! Connects to fsStudio.  The optional \a host and \a port parameters
-		 * specify the fsStudio server.
+		 * specify the fsStudio server. Returns immediately, the host is
+		 * resolved and connected on the I/O thread, or in poll() in
+		 * \a IO_POLL mode. If the connection fails
+		 * or is lost, it is retried with an increasing delay unless automatic
+		 * reconnection is disabled.
 		 * \note Only supports TCP/IP at the moment, which can be set in fsStudio Preferences/Streaming/Network/Protocol.
 		 */
 		void connect( std::string host = "127.0.0.1", std::string port = "33433" );
-		//! Closes the connection to fsStudio.
+		//! Closes the connection to fsStudio and stops the relay.
 		void close();
 
+		/*! Sets the thread the network I/O runs on. In \a IO_POLL mode no
+		 * thread is started, the application calls poll() once per frame and
+		 * the frames are received on its thread, so the frame data is
+		 * accessed without locking. Closes the connection if the mode changes.
+		 * \note In \a IO_POLL mode the instance, including the relay, is
+		 * only serviced in poll() and must only be used from the thread
+		 * calling it.
+		 */
+		void setIoMode( IoMode mode );
+		//! Returns the thread the network I/O runs on.
+		IoMode getIoMode() const { return mIoMode; }
+		/*! Reads and decodes all data received since the last call without
+		 * blocking, so the newest frame is available immediately after it
+		 * returns. Returns the number of frames decoded. Only used in
+		 * \a IO_POLL mode.
+		 */
+		size_t poll();
+
+		//! Returns true if the connection to fsStudio is established.
+		bool isConnected() const;
+		//! Enables or disables reconnecting after the connection failed or was lost.
+		void setAutoReconnect( bool enable = true );
+		//! Returns the last connection error or an empty string.
+		std::string getConnectionError() const;
+
+		/*! Publishes every frame received into the POSIX shared memory
+		 * segment \a name, a ring of \a numSlots frames, which can be read by
+		 * other processes on the same machine with a SharedFrameReader.
+		 * \throws SharedFrameExc if the segment cannot be created.
+		 */
+		void publishSharedMemory( const std::string &name = "/faceshift", size_t numSlots = 4 );
+		//! Stops publishing frames and removes the shared memory segment.
+		void stopPublishingSharedMemory();
+
+		/*! Re-serves the received frames in the fsStudio format to clients
+		 * connecting to \a tcpPort, so several machines can share one fsStudio
+		 * stream. Slow clients skip frames instead of falling behind.
+		 * \note Runs on the I/O thread started by connect(), or in poll().
+		 */
+		void startRelay( unsigned short tcpPort = 33434 );
+		/*! Sends the relayed frames to \a host : \a port over UDP as well.
+		 * The host is resolved on the I/O thread, a failure is reported by
+		 * getRelayError().
+		 */
+		void addRelayUdpTarget( const std::string &host, const std::string &port = "33433" );
+		//! Stops relaying and disconnects the relay clients, which close() does as well.
+		void stopRelay();
+		//! Returns the last error resolving a relay target or an empty string.
+		std::string getRelayError() const;
+
+		/*! Records the received frames to the file at \a path in the fsStudio
+		 * streaming format, which can be played back with readFrame().
+		 */
+		void startRecording( const ci::fs::path &path );
+		//! Stops recording.
+		void stopRecording();
+
+		/*! Decodes one frame in the fsStudio streaming format from \a is, as
+		 * if it was received from fsStudio. Returns false if \a is did not
+		 * contain a complete frame. Can be used without connecting, for
+		 * example to play back a recording.
+		 */
+		bool readFrame( std::istream& is );
+
+		typedef boost::function< void ( RigRef ) > ImportCallback;
+
 		/*! Imports the contents of the fsStudio model export \a folder for
 		 * blending. Converts the Wavefront .obj files to .trimesh if
 		 * \a exportTrimesh is true. If .obj and .trimesh files exist with the
-		 * same name, the .trimesh is loaded, which is much faster.
+		 * same name, the .trimesh is loaded, which is much faster, unless it
+		 * is stale, see Rig::create(). The \a folder is looked up in the asset
+		 * folders of the app, or relative to the working directory in
+		 * programs built without the Cinder app.
+		 * \note To drive several characters with the same model, import it
+		 * once with Rig::create() and share it with setRig().
 		 */
 		void import( ci::fs::path folder, bool exportTrimesh = false );
+		//! Imports the fsStudio model export \a folder with the options in \a format, like the resolution levels.
+		void import( ci::fs::path folder, const Rig::Format &format );
+
+		/*! Imports the fsStudio model export \a folder on a background
+		 * thread and returns immediately. The rig is installed on the next
+		 * getBlendMesh() call after the import finished, until then the blend
+		 * mesh is empty and the application can draw a placeholder. The
+		 * optional \a callback is called on the import thread with the rig
+		 * or with an empty reference if the import failed. Starting another
+		 * import supersedes a running one without waiting for it, the
+		 * superseded import finishes in the background, its rig is discarded
+		 * and its callback is not called.
+		 */
+		void importAsync( ci::fs::path folder, bool exportTrimesh = false,
+						  ImportCallback callback = ImportCallback() );
+		//! Imports the fsStudio model export \a folder with the options in \a format on a background thread.
+		void importAsync( ci::fs::path folder, const Rig::Format &format,
+						  ImportCallback callback = ImportCallback() );
+		//! Returns true while a background import is running.
+		bool isImporting() const;
+		//! Returns the error message of the last failed background import or an empty string.
+		std::string getImportError() const;
+
+		/*! Imports the rig again on a background thread when the files of its
+		 * export folder change, which is checked every \a interval seconds
+		 * from getBlendMesh(). The check only lists the folder on the calling
+		 * thread, a background thread is started if the sizes or write times
+		 * changed. Only the changed blendshapes are parsed, see
+		 * Rig::reimport(). The new rig is installed on the next getBlendMesh()
+		 * call after the import finished, the old one is used until then.
+		 * Reloading counts as a background import for isImporting() and
+		 * getImportError(). Instances sharing a rig reload it separately.
+		 */
+		void setAutoReload( bool enable = true, double interval = 1.0 );
+
+		//! Sets the shared \a rig used for blending.
+		void setRig( RigRef rig );
+		//! Returns the rig used for blending.
+		RigRef getRig() const { return mRig; }
+
+		/*! Loads a retargeting definition from \a file, which maps the fsStudio
+		 * blendshape weights to the blendshapes of the rig by name. The
+		 * definition is compiled again for every rig set later, including
+		 * imported and reloaded rigs. Without a rig it is compiled when the
+		 * first rig is set.
+		 * \throws RetargeterExc if the definition does not match the rig.
+		 * \see Retargeter
+		 */
+		void loadRetargeter( ci::fs::path file );
+		/*! Sets the \a retargeter used to map the fsStudio blendshape weights to
+		 * the rig weights. Its targets have to be the blendshapes of the rig,
+		 * otherwise the weights are blended as received and the mismatch is
+		 * reported by getRetargeterError(). Setting an empty retargeter blends
+		 * the weights as received.
+		 */
+		void setRetargeter( RetargeterRef retargeter );
+		//! Returns the retargeter.
+		RetargeterRef getRetargeter() const { return mRetargeter; }
+		/*! Returns the reason why the retargeter is not applied, like a
+		 * definition which does not match a newly set rig, or an empty string.
+		 */
+		std::string getRetargeterError() const;
 
 		//! Returns head orientation.
 		ci::Quatf getRotation() const;
@@ -60,18 +226,42 @@ class ciFaceShift
 		 */
 		ci::Vec3f getPosition() const;
 
-		//! Returns the timestamp of the last frame received.
+		//! Returns the timestamp of the last frame received, in seconds on the clock of fsStudio.
 		double getTimestamp() const;
 		//! Returns true if the tracking of the last frame was successful.
 		bool isTrackingSuccessful() const;
 
+		//! Returns the seconds elapsed on the monotonic local clock the frames are timed with.
+		double getLocalTime() const { return mLocalClock.getSeconds(); }
+		//! Returns the local time the last frame was received at.
+		double getReceiveTime() const;
+		/*! Converts the fsStudio \a timestamp to the local time a frame with
+		 * this timestamp arrives at with the lowest delay seen recently. The
+		 * offset and drift between the clocks are fitted to the lower
+		 * envelope of the received frames, see ClockSync.
+		 */
+		double toLocalTime( double timestamp ) const;
+		/*! Returns the local time elapsed since the last frame would have
+		 * arrived with the lowest delay, which includes its extra network
+		 * delay.
+		 */
+		double getFrameAge() const;
+		//! Returns the mean delay of the frames above the lowest delay in seconds.
+		double getFrameDelay() const;
+		//! Returns the standard deviation of the frame delays in seconds.
+		double getFrameJitter() const;
+		//! Returns the drift of the local clock relative to the fsStudio clock in seconds per second.
+		double getClockDrift() const;
+
 		//! Returns the name of the blendshapes as a vector of strings.
 		const std::vector< std::string >& getBlendshapeNames() const;
 
 		//! Returns the name of the \a i'th blendshape.
-		std::string getBlendshapeName( size_t i ) const;
+		const std::string& getBlendshapeName( size_t i ) const;
 
-		//! Returns the blendshape coefficients for the last frame received.
+		/*! Returns the blendshape coefficients for the last frame received.
+		 * Frames with more than SharedFrame::kMaxBlendshapes coefficients are dropped.
+		 */
 		const std::vector< float >& getBlendshapeWeights() const;
 
 		//! Returns the total number of blendshapes.
@@ -89,21 +279,145 @@ class ciFaceShift
 		//! Returns the \a i'th blendshape mesh.
 		const ci::TriMesh& getBlendshapeMesh( size_t i ) const;
 
-		//! Returns the blended mesh.
-		ci::TriMesh& getBlendMesh();
+		/*! Returns the blended mesh of the resolution \a level of the rig.
+		 * Level 0 is the full resolution, lower resolutions blend faster and
+		 * can be used for distant characters. Levels beyond the number of
+		 * levels of the rig return the lowest resolution.
+		 * \note The blend cache is only used for level 0.
+		 */
+		ci::TriMesh& getBlendMesh( size_t level = 0 );
+
+		/*! Sets the coordinate space of the blended mesh. In \a OUTPUT_WORLD
+		 * mode the eye vertex groups of the rig are rotated by the eye
+		 * rotations and the mesh is rotated and translated by the head pose in
+		 * the same pass as blending, so the mesh should be drawn without
+		 * applying getRotation() again.
+		 */
+		void setOutputMode( OutputMode mode );
+		//! Returns the coordinate space of the blended mesh.
+		OutputMode getOutputMode() const { return mOutputMode; }
+
+		/*! Returns the bounding box of the blended mesh in the space of the
+		 * output mode. The box is conservative and calculated from the
+		 * weights only, without blending. If \a exact is true, the mesh is
+		 * blended if necessary and the box is fitted to its vertices, which
+		 * is cached until the mesh is blended again.
+		 */
+		ci::AxisAlignedBox3f getBounds( bool exact = false );
+		//! Returns a conservative bounding sphere of the blended mesh calculated from the weights.
+		ci::Sphere getBoundingSphere();
+
+		/*! Enables caching the blended vertices of recurring expressions in
+		 * at most \a memoryBudget bytes. Weight vectors are quantized to
+		 * multiples of \a quantizationStep to form the cache keys, a repeated
+		 * expression is copied from the cache instead of being blended.
+		 * \note In \a OUTPUT_WORLD mode the vertices are cached before the
+		 * rigid transformation, which runs as a separate pass.
+		 */
+		void enableBlendCache( size_t memoryBudget = 64 * 1024 * 1024, float quantizationStep = 1.f / 256.f );
+		//! Disables the blend cache and frees its memory.
+		void disableBlendCache();
+		//! Returns the blend cache hit and miss statistics.
+		BlendCache::Stats getBlendCacheStats() const;
 
 		//! Returns the neutral mesh.
 		const ci::TriMesh& getNeutralMesh() const;
 
+		/*! Evaluates the \a attachments with the weights of the last frame,
+		 * without blending the mesh. The points are transformed by the head
+		 * pose and the eye rotations in \a OUTPUT_WORLD mode. Attachments
+		 * created for another rig are moved to the rig of this instance,
+		 * which follows an auto reload, see Attachments::setRig(). Returns
+		 * false and leaves the points unchanged if the rig has a different
+		 * topology or there are no weights to evaluate.
+		 */
+		bool evaluateAttachments( Attachments *attachments );
+
+		/*! Updates the blended meshes of all \a instances. Instances sharing
+		 * the same rig are blended together in one pass over the blendshape
+		 * deltas, which is faster than calling getBlendMesh() on each one.
+		 * Only the blend meshes of the resolution \a level are updated.
+		 */
+		static void updateBlendMeshes( const std::vector< ciFaceShift * > &instances, size_t level = 0 );
+
 	private:
+		void doConnect();
+		void handleResolve( const boost::system::error_code& error,
+							boost::asio::ip::tcp::resolver::iterator endpoint_iterator );
 		void handleConnect( const boost::system::error_code& error,
 							boost::asio::ip::tcp::resolver::iterator endpoint_iterator );
 		void handleRead( const boost::system::error_code& error );
+		/*! Decodes the complete frames buffered in mStream, which were
+		 * received at \a receiveTime, and returns their number. Incomplete
+		 * frames are kept until the rest arrives.
+		 */
+		size_t decodeFrames( double receiveTime );
+		//! Starts reading the next chunk of the stream.
+		void asyncRead();
+		void handleReconnectTimer( const boost::system::error_code& error );
+		void scheduleReconnect( const boost::system::error_code& error );
 		void doClose();
 
 		boost::asio::io_service mIoService;
+		std::shared_ptr< boost::asio::io_service::work > mWork;
+		boost::asio::ip::tcp::resolver mResolver;
 		boost::asio::ip::tcp::socket mSocket;
 		boost::asio::streambuf mStream;
+		boost::asio::deadline_timer mReconnectTimer;
+		//! Storage of the read operation, which is always outstanding while connected.
+		detail::HandlerAllocator mReadAllocator;
+		IoMode mIoMode;
+		//! Number of frames decoded from the network, only used on the I/O thread.
+		size_t mNumFramesReceived;
+
+		std::string mHost;
+		std::string mPort;
+		bool mConnected;
+		bool mAutoReconnect;
+		bool mReconnecting;
+		boost::posix_time::time_duration mReconnectDelay;
+		std::string mConnectionError;
+
+		//! Starts a background import running \a function and joins the finished ones.
+		void startImportThread( const boost::function< void () > &function );
+		void importThread( ci::fs::path folder, Rig::Format format, ImportCallback callback,
+						   uint32_t generation );
+		//! Installs the rig of a finished background import.
+		void installImportedRig();
+		//! Starts reloading the rig if auto reload is enabled and the check interval elapsed.
+		void checkReload();
+		void reloadThread( RigRef rig, uint32_t generation );
+
+		void publishFrame();
+
+		//! Encodes the current frame in the fsStudio streaming format to \a data.
+		void encodeFrame( std::vector< char > &data ) const;
+		//! Frame buffer reused by publishFrame() once the relay released it.
+		std::shared_ptr< std::vector< char > > mFrameBuffer;
+		void doSetRelay( std::shared_ptr< Relay > relay );
+		void doAddRelayUdpTarget( std::string host, std::string port );
+		void handleRelayUdpResolve( std::shared_ptr< boost::asio::ip::udp::resolver > resolver, std::string target,
+									const boost::system::error_code& error,
+									boost::asio::ip::udp::resolver::iterator endpoint_iterator );
+		std::shared_ptr< Relay > mRelay;
+		std::string mRelayError;
+
+		void doSetRecording( std::shared_ptr< std::ofstream > stream );
+		std::shared_ptr< std::ofstream > mRecordingStream;
+
+		std::shared_ptr< SharedFramePublisher > mSharedFramePublisher;
+
+		//! Background imports, including superseded ones which have not finished yet.
+		std::vector< std::shared_ptr< boost::thread > > mImportThreads;
+		bool mImporting;
+		//! Incremented by every import, only the newest one installs its rig.
+		uint32_t mImportGeneration;
+		RigRef mImportedRig;
+		std::string mImportError;
+		bool mAutoReload;
+		double mReloadInterval;
+		//! Local time of the last check for changed rig files.
+		double mReloadCheckTime;
 
 		enum
 		{
@@ -121,11 +435,51 @@ class ciFaceShift
 			is.read( reinterpret_cast< char * >( &data), sizeof( T ) );
 		}
 
+		template <typename T>
+		static inline void writeRaw( std::vector< char >& buffer, const T& data )
+		{
+			const char *bytes = reinterpret_cast< const char * >( &data );
+			buffer.insert( buffer.end(), bytes, bytes + sizeof( T ) );
+		}
+
+		//! Writes a block header and returns the offset of its size field.
+		static size_t beginBlock( std::vector< char >& buffer, uint16_t blockId );
+		//! Fills in the size of the block started at \a sizeOffset.
+		static void endBlock( std::vector< char >& buffer, size_t sizeOffset );
+
 		std::shared_ptr< boost::thread > mThread;
 		mutable boost::mutex mMutex;
 
+		/*! Locks mMutex for accessing the frame data, unless the frames are
+		 * received on the application thread in \a IO_POLL mode. The
+		 * background import always locks mMutex.
+		 */
+		class FrameLock : private boost::noncopyable
+		{
+			public:
+				FrameLock( const ciFaceShift *faceShift ) :
+					mMutex( ( faceShift->mIoMode == IO_THREAD ) ? &faceShift->mMutex : NULL )
+				{
+					if ( mMutex )
+						mMutex->lock();
+				}
+
+				~FrameLock()
+				{
+					if ( mMutex )
+						mMutex->unlock();
+				}
+
+			private:
+				boost::mutex *mMutex;
+		};
+
 		double mTimestamp;
 		bool mTrackingSuccessful;
+
+		ci::Timer mLocalClock;
+		ClockSync mClockSync;
+		double mReceiveTime;
 		ci::Quatf mHeadOrientation;
 		ci::Vec3f mHeadPosition;
 		std::vector< float > mBlendshapeWeights;
@@ -145,14 +499,64 @@ class ciFaceShift
 		SpCoordf mLeftEyeRotation;
 		SpCoordf mRightEyeRotation;
 
-		std::vector< ci::Vec3f > mMarkers;
+		//! Markers beyond kMaxMarkers are skipped.
+		static const size_t kMaxMarkers = 64;
+		ci::Vec3f mMarkers[ kMaxMarkers ];
+		size_t mNumMarkers;
 
 		static const std::vector< std::string > sBlendshapeNames;
 
-		std::vector< ci::TriMesh > mBlendshapeMeshes;
-		ci::TriMesh mNeutralMesh;
-		ci::TriMesh mBlendMesh;
+		/*! Copies the weights for blending and returns true if the blend
+		 * mesh of \a level has to be updated. \a level is clamped to the
+		 * levels of the rig.
+		 */
+		bool prepareBlend( size_t &level );
+		//! Blends the copied weights into the blend mesh of \a level.
+		void blend( size_t level );
+
+		RigRef mRig;
+		RetargeterRef mRetargeter;
+		//! Definition loaded by loadRetargeter(), compiled again when the rig changes.
+		ci::fs::path mRetargeterFile;
+		std::string mRetargeterError;
+		//! Compiles mRetargeterFile for the blendshapes of mRig.
+		void compileRetargeter();
+		std::vector< float > mBlendWeights;
+		Rig::Pose mBlendPose;
+		//! Blended mesh of each resolution level of the rig.
+		std::vector< ci::TriMesh > mBlendMeshes;
+		//! Serial of the weights each blend mesh was blended with.
+		std::vector< uint32_t > mBlendMeshSerials;
+		//! Incremented every time new weights are copied for blending.
+		uint32_t mBlendSerial;
 		bool mBlendNeedsUpdate;
+		OutputMode mOutputMode;
+
+		//! Bounds of the full resolution blend mesh blended with the weights of mExactBoundsSerial.
+		ci::AxisAlignedBox3f mExactBounds;
+		uint32_t mExactBoundsSerial;
+		bool mExactBoundsValid;
+
+		std::shared_ptr< BlendCache > mBlendCache;
+		size_t mBlendCacheBudget;
+		float mBlendCacheQuantizationStep;
+
+		//! Scratch vectors of updateBlendMeshes(), kept between frames so the batching does not allocate.
+		struct BlendBatch
+		{
+			void reserve( size_t numInstances );
+
+			std::vector< ciFaceShift * > mPending;
+			std::vector< size_t > mPendingLevels;
+			std::vector< const float * > mWeights;
+			std::vector< ci::Vec3f * > mOutputs;
+			std::vector< Rig::Pose > mPoses;
+			std::vector< ci::Vec3f * > mNormalOutputs;
+		};
+		//! Used by updateBlendMeshes() when this is the first of its instances.
+		BlendBatch mBlendBatch;
+		//! Number of instances mBlendBatch is reserved for when the rig is set.
+		static const size_t kBlendBatchReserve = 16;
 };
 
 } } // namespace mndl::faceshift
@@ -0,0 +1,261 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/assign.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include "HandlerAllocator.h"
+#include "Rig.h"
+#include "ciFaceShift.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+using boost::asio::ip::tcp;
+
+/* Counts the heap allocations of the whole program while enabled. The
+ * default operator delete frees the storage, new[] calls operator new.
+ */
+static std::atomic< bool > sCountAllocations( false );
+static std::atomic< size_t > sNumAllocations( 0 );
+
+void* operator new( std::size_t size )
+{
+	if ( sCountAllocations )
+		sNumAllocations++;
+	void *pointer = std::malloc( size ? size : 1 );
+	if ( !pointer )
+		throw std::bad_alloc();
+	return pointer;
+}
+
+namespace fsTest {
+
+static void startCounting()
+{
+	sNumAllocations = 0;
+	sCountAllocations = true;
+}
+
+static size_t stopCounting()
+{
+	sCountAllocations = false;
+	return sNumAllocations;
+}
+
+template < typename T >
+static void writeRaw( vector< char > &data, const T &value )
+{
+	const char *bytes = reinterpret_cast< const char * >( &value );
+	data.insert( data.end(), bytes, bytes + sizeof( T ) );
+}
+
+template < typename T >
+static void writeBlockHeader( vector< char > &data, uint16_t blockId, T blockSize )
+{
+	writeRaw( data, blockId );
+	writeRaw( data, uint16_t( 1 ) );
+	writeRaw( data, uint32_t( blockSize ) );
+}
+
+/*! Encodes a frame in the fsStudio streaming format with a frame info
+ * and a blendshapes block to \a data, reusing its capacity.
+ */
+static void encodeFrame( vector< char > &data, double timestamp, const vector< float > &weights )
+{
+	const size_t headerSize = 2 * sizeof( uint16_t ) + sizeof( uint32_t );
+	size_t frameInfoSize = sizeof( double ) + sizeof( uint8_t );
+	size_t blendshapesSize = sizeof( uint32_t ) + weights.size() * sizeof( float );
+
+	data.clear();
+	writeBlockHeader( data, 33433, sizeof( uint16_t ) + 2 * headerSize + frameInfoSize + blendshapesSize );
+	writeRaw( data, uint16_t( 2 ) );
+	writeBlockHeader( data, 101, frameInfoSize );
+	writeRaw( data, timestamp );
+	writeRaw( data, uint8_t( 1 ) );
+	writeBlockHeader( data, 103, blendshapesSize );
+	writeRaw( data, uint32_t( weights.size() ) );
+	for ( size_t i = 0; i < weights.size(); i++ )
+		writeRaw( data, weights[ i ] );
+}
+
+//! Reads continuously from a socket with the handler storage of a HandlerAllocator.
+class ChainedReader
+{
+	public:
+		ChainedReader( tcp::socket &socket ) : mSocket( socket ), mNumBytes( 0 ) {}
+
+		void asyncRead()
+		{
+			mSocket.async_read_some( boost::asio::buffer( mBuffer ),
+					detail::makeAllocHandler( mAllocator,
+						boost::bind( &ChainedReader::handleRead, this,
+							boost::asio::placeholders::error,
+							boost::asio::placeholders::bytes_transferred ) ) );
+		}
+
+		size_t getNumBytes() const { return mNumBytes; }
+
+	private:
+		void handleRead( const boost::system::error_code &error, size_t bytesTransferred )
+		{
+			if ( error )
+				return;
+			mNumBytes += bytesTransferred;
+			asyncRead();
+		}
+
+		tcp::socket &mSocket;
+		detail::HandlerAllocator mAllocator;
+		char mBuffer[ 256 ];
+		size_t mNumBytes;
+};
+
+//! Connects \a client to \a server through a listening socket on the loopback interface.
+static void connectPair( boost::asio::io_service &ioService, tcp::socket &client, tcp::socket &server )
+{
+	tcp::acceptor acceptor( ioService, tcp::endpoint( boost::asio::ip::address_v4::loopback(), 0 ) );
+	client.connect( acceptor.local_endpoint() );
+	acceptor.accept( server );
+}
+
+static void testHandlerAllocator()
+{
+	boost::asio::io_service ioService;
+	tcp::socket client( ioService );
+	tcp::socket server( ioService );
+	connectPair( ioService, client, server );
+
+	ChainedReader reader( client );
+	reader.asyncRead();
+
+	const char message[] = "frame";
+	size_t numBytes = 0;
+	for ( size_t i = 0; i < 110; i++ )
+	{
+		// the first rounds warm up the reactor
+		if ( i == 10 )
+			startCounting();
+		boost::asio::write( server, boost::asio::buffer( message ) );
+		numBytes += sizeof( message );
+		while ( reader.getNumBytes() < numBytes )
+			ioService.run_one();
+	}
+	size_t numAllocations = stopCounting();
+	check( numAllocations == 0, "the read chain allocated " +
+		   boost::lexical_cast< string >( numAllocations ) + " times, the handler does not fit the allocator" );
+
+	client.close();
+	ioService.poll();
+}
+
+static void testFrameLoop()
+{
+	vector< string > shapeNames = boost::assign::list_of( "A" )( "B" )( "C" )( "D" );
+	fs::path folder = createRigFolder( shapeNames );
+	RigRef rig = Rig::create( folder );
+
+	boost::asio::io_service ioService;
+	tcp::acceptor acceptor( ioService, tcp::endpoint( boost::asio::ip::address_v4::loopback(), 0 ) );
+	tcp::socket server( ioService );
+
+	ciFaceShift faceShift;
+	faceShift.setIoMode( ciFaceShift::IO_POLL );
+	faceShift.setRig( rig );
+	faceShift.connect( "127.0.0.1", boost::lexical_cast< string >( acceptor.local_endpoint().port() ) );
+	for ( size_t i = 0; !faceShift.isConnected() && ( i < 1000 ); i++ )
+	{
+		faceShift.poll();
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 1 ) );
+	}
+	check( faceShift.isConnected(), "frame loop connected" );
+	if ( !faceShift.isConnected() )
+	{
+		fs::remove_all( folder );
+		return;
+	}
+	acceptor.accept( server );
+
+	vector< ciFaceShift * > instances( 1, &faceShift );
+	vector< float > weights( shapeNames.size(), 0.f );
+	vector< char > frame;
+	encodeFrame( frame, 0., weights );
+	size_t numFrames = 0;
+	for ( size_t i = 0; i < 110; i++ )
+	{
+		// the first frames size the buffers
+		if ( i == 10 )
+			startCounting();
+
+		weights[ i % weights.size() ] = float( i % 7 ) / 7.f;
+		encodeFrame( frame, i * .02, weights );
+		boost::asio::write( server, boost::asio::buffer( frame ) );
+
+		for ( size_t j = 0; ( numFrames <= i ) && ( j < 1000000 ); j++ )
+			numFrames += faceShift.poll();
+		if ( i % 2 )
+			faceShift.getBlendMesh();
+		else
+			ciFaceShift::updateBlendMeshes( instances );
+	}
+	size_t numAllocations = stopCounting();
+	check( numFrames == 110, "frame loop received the frames" );
+	check( numAllocations == 0, "the frame loop allocated " +
+		   boost::lexical_cast< string >( numAllocations ) + " times in steady state" );
+
+	// a corrupt blendshape count drops the frame without allocating
+	vector< char > corruptFrame = frame;
+	const size_t countOffset = 35;
+	uint32_t corruptCount = 0xffffffff;
+	std::copy( reinterpret_cast< const char * >( &corruptCount ),
+			   reinterpret_cast< const char * >( &corruptCount + 1 ), corruptFrame.begin() + countOffset );
+	startCounting();
+	boost::asio::write( server, boost::asio::buffer( corruptFrame ) );
+	boost::asio::write( server, boost::asio::buffer( frame ) );
+	for ( size_t j = 0; ( numFrames <= 110 ) && ( j < 1000000 ); j++ )
+		numFrames += faceShift.poll();
+	numAllocations = stopCounting();
+	check( ( numFrames == 111 ) && ( faceShift.getBlendshapeWeights() == weights ), "corrupt frame dropped" );
+	check( numAllocations == 0, "the corrupt frame allocated" );
+
+	vector< Vec3f > expected( rig->getNumVertices() );
+	rig->blend( &weights[ 0 ], weights.size(), &expected[ 0 ] );
+	const vector< Vec3f > &vertices = faceShift.getBlendMesh().getVertices();
+	check( std::equal( expected.begin(), expected.end(), vertices.begin() ), "frame loop blends the last frame" );
+
+	fs::remove_all( folder );
+}
+
+void testAllocations()
+{
+	testHandlerAllocator();
+	testFrameLoop();
+}
+
+} // namespace fsTest
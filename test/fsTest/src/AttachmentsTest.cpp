@@ -0,0 +1,104 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <boost/assign.hpp>
+
+#include "Attachments.h"
+#include "Rig.h"
+#include "ciFaceShift.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+static bool isFinite( const Vec3f &v )
+{
+	return std::isfinite( v.x ) && std::isfinite( v.y ) && std::isfinite( v.z );
+}
+
+static bool isUnit( const Vec3f &v )
+{
+	return isFinite( v ) && isNear( v.length(), 1.f, 1e-4f );
+}
+
+static void testDegenerateTriangle()
+{
+	// a zero-area triangle has no normal
+	fs::path folder = getTempPath();
+	fs::create_directories( folder );
+	writeFile( folder / "Neutral.obj", "v 0 0 0\nv 1 0 0\nv 2 0 0\nf 1 2 3\n" );
+	writeFile( folder / "A.obj", "v 0 0 0\nv 1 0 0\nv 3 0 0\nf 1 2 3\n" );
+	RigRef rig = Rig::create( folder );
+
+	Attachments attachments( rig );
+	attachments.addPoint( 0, Vec3f( 1.f, 1.f, 1.f ) / 3.f );
+	attachments.addVertex( 0 );
+	vector< float > weights( 1, .5f );
+	attachments.evaluate( &weights[ 0 ], weights.size() );
+	for ( size_t i = 0; i < attachments.getNumPoints(); i++ )
+	{
+		check( isFinite( attachments.getPosition( i ) ) && isUnit( attachments.getNormal( i ) ) &&
+			   isUnit( attachments.getTangent( i ) ), "degenerate attachment frame is finite" );
+	}
+	check( isNear( attachments.getPosition( 0 ).x, 1.f + .5f / 3.f ), "degenerate attachment position" );
+
+	fs::remove_all( folder );
+}
+
+static void testReloadedRig()
+{
+	vector< string > shapeNames = boost::assign::list_of( "A" )( "B" );
+	fs::path folder = createRigFolder( shapeNames );
+	fs::path otherFolder = createRigFolder( shapeNames, 5 );
+	RigRef rig = Rig::create( folder );
+
+	ciFaceShift faceShift;
+	faceShift.setRig( rig );
+	Attachments attachments( rig );
+	attachments.addVertex( 5 );
+	check( faceShift.evaluateAttachments( &attachments ), "attachments evaluated" );
+
+	// a reload of the same export keeps the points
+	RigRef reloaded = Rig::create( folder );
+	faceShift.setRig( reloaded );
+	check( faceShift.evaluateAttachments( &attachments ) && ( attachments.getRig() == reloaded ),
+		   "attachments follow a reloaded rig" );
+
+	// another topology is reported
+	faceShift.setRig( Rig::create( otherFolder ) );
+	check( !faceShift.evaluateAttachments( &attachments ) && ( attachments.getRig() == reloaded ),
+		   "attachments of another topology not evaluated" );
+
+	fs::remove_all( folder );
+	fs::remove_all( otherFolder );
+}
+
+void testAttachments()
+{
+	testDegenerateTriangle();
+	testReloadedRig();
+}
+
+} // namespace fsTest
@@ -0,0 +1,88 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <vector>
+
+#include "BlendCache.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+static const size_t kNumVertices = 1000;
+static const size_t kEntryVerticesSize = kNumVertices * sizeof( Vec3f );
+
+//! Looks up \a weights and stores vertices set to \a value on a miss, returns true on a hit.
+static bool lookupOrStore( BlendCache &cache, float w0, float w1, float w2, float value )
+{
+	float weights[] = { w0, w1, w2 };
+	if ( cache.lookup( weights, 3 ) != NULL )
+		return true;
+	vector< Vec3f > vertices( kNumVertices, Vec3f( value, value, value ) );
+	cache.store( &vertices[ 0 ] );
+	return false;
+}
+
+//! Returns the first cached vertex x of \a weights, or -1 on a miss.
+static float lookupValue( BlendCache &cache, float w0, float w1, float w2 )
+{
+	float weights[] = { w0, w1, w2 };
+	const Vec3f *vertices = cache.lookup( weights, 3 );
+	return ( vertices != NULL ) ? vertices[ 0 ].x : -1.f;
+}
+
+void testBlendCache()
+{
+	// weights within half a step share the key of the first of them
+	BlendCache cache( kNumVertices, 8 * kEntryVerticesSize, .1f );
+	check( !lookupOrStore( cache, .1f, .2f, .3f, 1.f ), "first lookup misses" );
+	check( isNear( lookupValue( cache, .14f, .16f, .3f ), 1.f ), "weights quantized to the same key hit" );
+	check( lookupValue( cache, .16f, .2f, .3f ) < 0.f, "weights quantized to another key miss" );
+	check( ( cache.getStats().mHits == 1 ) && ( cache.getStats().mMisses == 2 ), "hits and misses counted" );
+
+	// the entries are accounted with their overhead, a budget of exactly
+	// two vertex buffers holds one entry
+	BlendCache smallCache( kNumVertices, 2 * kEntryVerticesSize, .1f );
+	lookupOrStore( smallCache, 0.f, 0.f, 0.f, 1.f );
+	lookupOrStore( smallCache, 1.f, 0.f, 0.f, 2.f );
+	check( smallCache.getStats().mEntries == 1, "entry overhead accounted" );
+	check( ( smallCache.getStats().mMemoryUsage > kEntryVerticesSize ) &&
+		   ( smallCache.getStats().mMemoryUsage <= smallCache.getMemoryBudget() ), "memory usage within the budget" );
+
+	// four entries fit, the least recently used one is evicted
+	BlendCache lruCache( kNumVertices, 4 * kEntryVerticesSize + kEntryVerticesSize / 2, .1f );
+	for ( int i = 0; i < 4; i++ )
+		lookupOrStore( lruCache, float( i ), 0.f, 0.f, float( i ) );
+	check( ( lruCache.getStats().mEntries == 4 ) && ( lruCache.getStats().mEvictions == 0 ), "cache filled" );
+	check( isNear( lookupValue( lruCache, 0.f, 0.f, 0.f ), 0.f ), "oldest entry hit" );
+	lookupOrStore( lruCache, 4.f, 0.f, 0.f, 4.f );
+	check( ( lruCache.getStats().mEntries == 4 ) && ( lruCache.getStats().mEvictions == 1 ), "one entry evicted" );
+	check( lookupValue( lruCache, 1.f, 0.f, 0.f ) < 0.f, "least recently used entry evicted" );
+	check( isNear( lookupValue( lruCache, 0.f, 0.f, 0.f ), 0.f ) && isNear( lookupValue( lruCache, 2.f, 0.f, 0.f ), 2.f ) &&
+		   isNear( lookupValue( lruCache, 3.f, 0.f, 0.f ), 3.f ) && isNear( lookupValue( lruCache, 4.f, 0.f, 0.f ), 4.f ),
+		   "recently used entries kept" );
+	check( lruCache.getStats().mMemoryUsage <= lruCache.getMemoryBudget(), "memory usage within the budget after eviction" );
+
+	lruCache.clear();
+	check( ( lruCache.getStats().mEntries == 0 ) && ( lruCache.getStats().mMemoryUsage == 0 ) &&
+		   ( lookupValue( lruCache, 0.f, 0.f, 0.f ) < 0.f ), "cache cleared" );
+}
+
+} // namespace fsTest
@@ -0,0 +1,160 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/assign.hpp>
+
+#include "cinder/AxisAlignedBox.h"
+#include "cinder/CinderMath.h"
+#include "cinder/Quaternion.h"
+#include "cinder/Sphere.h"
+
+#include "Rig.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+static const size_t kGridSize = 6;
+
+//! Returns a pseudo random number in [ \a min, \a max ) advancing \a seed.
+static float randFloat( uint32_t &seed, float min, float max )
+{
+	seed = seed * 1664525u + 1013904223u;
+	return min + ( max - min ) * ( ( seed >> 8 ) / float( 1 << 24 ) );
+}
+
+static Quatf randRotation( uint32_t &seed, float maxAngle )
+{
+	Vec3f axis( randFloat( seed, -1.f, 1.f ), randFloat( seed, -1.f, 1.f ), randFloat( seed, -1.f, 1.f ) );
+	if ( axis.lengthSquared() < 1e-4f )
+		axis = Vec3f::yAxis();
+	return Quatf( axis.normalized(), randFloat( seed, -maxAngle, maxAngle ) );
+}
+
+/*! Writes the neutral grid of createRigFolder() with the faces of the
+ * first row in the left eye group and the faces of the last row in the
+ * right eye group.
+ */
+static void writeEyeNeutral( const fs::path &path )
+{
+	ostringstream obj;
+	for ( size_t v = 0; v < kGridSize * kGridSize; v++ )
+	{
+		Vec3f position = getRigVertex( -1, v, kGridSize );
+		obj << "v " << position.x << " " << position.y << " " << position.z << "\n";
+	}
+	for ( size_t y = 0; y + 1 < kGridSize; y++ )
+	{
+		if ( y == 0 )
+			obj << "g EyeLeft\n";
+		else if ( y + 2 == kGridSize )
+			obj << "g EyeRight\n";
+		else
+			obj << "g Face\n";
+		for ( size_t x = 0; x + 1 < kGridSize; x++ )
+		{
+			size_t i = y * kGridSize + x + 1;
+			obj << "f " << i << " " << i + 1 << " " << i + kGridSize + 1 << "\n";
+			obj << "f " << i << " " << i + kGridSize + 1 << " " << i + kGridSize << "\n";
+		}
+	}
+	writeFile( path, obj.str() );
+}
+
+//! Returns the number of \a vertices outside \a box and \a sphere grown by \a epsilon.
+static size_t countOutside( const vector< Vec3f > &vertices, const AxisAlignedBox3f &box,
+							const Sphere &sphere, float epsilon )
+{
+	size_t numOutside = 0;
+	for ( size_t i = 0; i < vertices.size(); i++ )
+	{
+		bool inside = true;
+		for ( int a = 0; a < 3; a++ )
+		{
+			inside = inside && ( vertices[ i ][ a ] >= box.getMin()[ a ] - epsilon ) &&
+					 ( vertices[ i ][ a ] <= box.getMax()[ a ] + epsilon );
+		}
+		inside = inside && ( vertices[ i ].distance( sphere.getCenter() ) <= sphere.getRadius() + epsilon );
+		if ( !inside )
+			numOutside++;
+	}
+	return numOutside;
+}
+
+void testBounds()
+{
+	fs::path folder = createRigFolder( boost::assign::list_of( "A" )( "B" )( "C" )( "D" ), kGridSize );
+	writeEyeNeutral( folder / "Neutral.obj" );
+	vector< Vec3f > sculpt;
+	for ( size_t v = 0; v < kGridSize * kGridSize; v++ )
+	{
+		sculpt.push_back( getRigVertex( 0, v, kGridSize ) + getRigVertex( 1, v, kGridSize ) -
+						  getRigVertex( -1, v, kGridSize ) + ( ( v % 2 ) ? Vec3f( 0.f, .3f, -.2f ) : Vec3f::zero() ) );
+	}
+	writeGridObj( folder / "AB.obj", sculpt, kGridSize );
+	writeFile( folder / "Correctives.xml",
+			   "<correctives>\n"
+			   "  <combination name=\"AB\"><driver name=\"A\" /><driver name=\"B\" /></combination>\n"
+			   "</correctives>\n" );
+
+	RigRef rig = Rig::create( folder );
+	check( rig->hasEyeGroups(), "bounds rig has eye groups" );
+	check( rig->getNumCorrectives() == 1, "bounds rig has a corrective" );
+
+	// random weight vectors, including negative and overshooting weights
+	// and the corrective activation, with and without random poses
+	uint32_t seed = 1;
+	size_t numWeights = rig->getNumBlendWeights();
+	vector< float > weights( numWeights );
+	vector< Vec3f > output( rig->getNumVertices() );
+	size_t numOutside = 0, numPosedOutside = 0;
+	for ( int trial = 0; trial < 500; trial++ )
+	{
+		for ( size_t i = 0; i < numWeights; i++ )
+			weights[ i ] = ( randFloat( seed, 0.f, 1.f ) < .2f ) ? 0.f : randFloat( seed, -1.f, 2.f );
+
+		rig->blend( &weights[ 0 ], numWeights, &output[ 0 ] );
+		numOutside += countOutside( output, rig->calcBounds( &weights[ 0 ], numWeights ),
+									rig->calcBoundingSphere( &weights[ 0 ], numWeights ), 1e-4f );
+
+		Rig::Pose pose;
+		pose.mHeadRotation = randRotation( seed, float( M_PI ) );
+		pose.mHeadPosition = Vec3f( randFloat( seed, -5.f, 5.f ), randFloat( seed, -5.f, 5.f ), randFloat( seed, -5.f, 5.f ) );
+		pose.mLeftEyeRotation = randRotation( seed, .7f );
+		pose.mRightEyeRotation = randRotation( seed, .7f );
+		const float *weightPtr = &weights[ 0 ];
+		Vec3f *outputPtr = &output[ 0 ];
+		rig->blend( 1, &weightPtr, numWeights, &outputPtr, &pose, NULL );
+		numPosedOutside += countOutside( output, rig->calcBounds( &weights[ 0 ], numWeights, &pose ),
+										 rig->calcBoundingSphere( &weights[ 0 ], numWeights, &pose ), 1e-4f );
+	}
+	check( numOutside == 0, "blended vertices inside the bounds" );
+	check( numPosedOutside == 0, "posed vertices inside the bounds" );
+
+	fs::remove_all( folder );
+}
+
+} // namespace fsTest
@@ -0,0 +1,74 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+
+#include "ClockSync.h"
+
+#include "fsTest.h"
+
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+void testClockSync()
+{
+	// the local clock runs 200 ppm fast, 3 s ahead with at least 20 ms of delay
+	const double drift = 2e-4;
+	const double offset = 3.0;
+	const double minDelay = .02;
+	const double remoteStart = 100.0;
+
+	ClockSync clockSync;
+	double remoteTime = remoteStart;
+	double localTime = 0.0;
+	double delay = 0.0;
+	unsigned int random = 1;
+	for ( size_t i = 0; i < 3000; i++, remoteTime += 1.0 / 60.0 )
+	{
+		// one-sided jitter, most frames arrive within 5 ms, every 50th late
+		random = random * 1103515245u + 12345u;
+		delay = ( ( i % 7 ) == 0 ) ? 0.0 : ( ( random >> 16 ) % 5000 ) * 1e-6;
+		if ( ( i % 50 ) == 25 )
+			delay += .1;
+		localTime = remoteTime * ( 1.0 + drift ) + offset + minDelay + delay;
+		clockSync.addSample( remoteTime, localTime );
+	}
+
+	check( std::abs( clockSync.getDrift() - drift ) < 1e-6, "clock sync drift" );
+	check( std::abs( clockSync.getOffset() - ( offset + minDelay + drift * remoteStart ) ) < 1e-4,
+		   "clock sync offset" );
+	double expected = remoteTime * ( 1.0 + drift ) + offset + minDelay;
+	check( std::abs( clockSync.toLocalTime( remoteTime ) - expected ) < 1e-4, "clock sync local time" );
+	// the frame age is the delay above the lowest one
+	double age = localTime - clockSync.toLocalTime( remoteTime - 1.0 / 60.0 );
+	check( std::abs( age - delay ) < 1e-4, "clock sync frame age" );
+	check( ( clockSync.getDelay() > 0.0 ) && ( clockSync.getDelay() < .01 ) && ( clockSync.getJitter() > 0.0 ),
+		   "clock sync delay and jitter" );
+
+	// a late frame does not move the fit
+	double before = clockSync.toLocalTime( remoteTime );
+	clockSync.addSample( remoteTime, clockSync.toLocalTime( remoteTime ) + 1.0 );
+	check( std::abs( clockSync.toLocalTime( remoteTime ) - before ) < 1e-9, "clock sync ignores a late frame" );
+
+	// a restarted remote clock restarts the fit
+	clockSync.addSample( 1.0, 50.0 );
+	check( ( clockSync.getNumSamples() == 1 ) && ( std::abs( clockSync.toLocalTime( 1.0 ) - 50.0 ) < 1e-9 ),
+		   "clock sync restarts" );
+}
+
+} // namespace fsTest
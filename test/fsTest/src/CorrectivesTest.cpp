@@ -0,0 +1,129 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/assign.hpp>
+
+#include "Rig.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+/*! Returns the neutral grid of createRigFolder() with the deltas of
+ * \a shapes at \a weight, moved by \a offset at every \a step'th vertex.
+ */
+static vector< Vec3f > getSculpt( const vector< int > &shapes, float weight, const Vec3f &offset, size_t step )
+{
+	vector< Vec3f > positions;
+	for ( size_t v = 0; v < 16; v++ )
+	{
+		Vec3f position = getRigVertex( -1, v );
+		for ( size_t s = 0; s < shapes.size(); s++ )
+			position += weight * ( getRigVertex( shapes[ s ], v ) - getRigVertex( -1, v ) );
+		if ( ( v % step ) == 0 )
+			position += offset;
+		positions.push_back( position );
+	}
+	return positions;
+}
+
+//! Blends the blendshape \a weights with the corrective activations of \a rig.
+static vector< Vec3f > blendCorrected( const Rig &rig, const vector< float > &weights )
+{
+	vector< float > blendWeights( weights );
+	blendWeights.resize( rig.getNumBlendWeights() );
+	rig.evaluateCorrectives( &weights[ 0 ], weights.size(), &blendWeights[ weights.size() ] );
+	vector< Vec3f > output( rig.getNumVertices() );
+	rig.blend( &blendWeights[ 0 ], blendWeights.size(), &output[ 0 ] );
+	return output;
+}
+
+static float maxDistance( const vector< Vec3f > &a, const vector< Vec3f > &b )
+{
+	float distance = 0.f;
+	for ( size_t i = 0; i < a.size(); i++ )
+		distance = std::max( distance, a[ i ].distance( b[ i ] ) );
+	return distance;
+}
+
+void testCorrectives()
+{
+	fs::path folder = createRigFolder( boost::assign::list_of( "A" )( "B" )( "C" ) );
+	// sculpted at their driver weights with extra offsets on some vertices
+	writeGridObj( folder / "AB.obj", getSculpt( boost::assign::list_of( 0 )( 1 ), 1.f, Vec3f( 0.f, .5f, 0.f ), 2 ) );
+	writeGridObj( folder / "ABC.obj", getSculpt( boost::assign::list_of( 0 )( 1 )( 2 ), 1.f, Vec3f( .2f, 0.f, 0.f ), 3 ) );
+	writeGridObj( folder / "A_50.obj", getSculpt( boost::assign::list_of( 0 ), .5f, Vec3f( 0.f, 0.f, .3f ), 4 ) );
+	writeFile( folder / "Correctives.xml",
+			   "<correctives>\n"
+			   "  <combination name=\"AB\"><driver name=\"A\" /><driver name=\"B\" /></combination>\n"
+			   "  <combination name=\"ABC\"><driver name=\"A\" /><driver name=\"B\" /><driver name=\"C\" /></combination>\n"
+			   "  <inbetween name=\"A_50\" driver=\"A\" weight=\".5\" />\n"
+			   "</correctives>\n" );
+	RigRef rig = Rig::create( folder );
+	check( ( rig->getNumBlendshapes() == 3 ) && ( rig->getNumCorrectives() == 3 ), "correctives imported" );
+	if ( rig->getNumCorrectives() != 3 )
+		return;
+
+	// the rig may reorder the vertices, the expectations use its meshes
+	const vector< Vec3f > &neutral = rig->getNeutralMesh().getVertices();
+	const vector< Vec3f > &a = rig->getBlendshapeMesh( rig->findBlendshape( "A" ) ).getVertices();
+	const vector< Vec3f > &b = rig->getBlendshapeMesh( rig->findBlendshape( "B" ) ).getVertices();
+	const vector< Vec3f > &ab = rig->getCorrectiveMesh( rig->findCorrective( "AB" ) ).getVertices();
+	const vector< Vec3f > &abc = rig->getCorrectiveMesh( rig->findCorrective( "ABC" ) ).getVertices();
+	const vector< Vec3f > &a50 = rig->getCorrectiveMesh( rig->findCorrective( "A_50" ) ).getVertices();
+
+	vector< float > weights( 3, 0.f );
+	check( maxDistance( blendCorrected( *rig, weights ), neutral ) < 1e-5f, "correctives inactive at 0" );
+
+	// the sculpts are reproduced at their keys
+	weights[ 0 ] = .5f;
+	check( maxDistance( blendCorrected( *rig, weights ), a50 ) < 1e-5f, "in-between at its weight" );
+	weights[ 0 ] = 1.f;
+	check( maxDistance( blendCorrected( *rig, weights ), a ) < 1e-5f, "in-between inactive at 1" );
+	weights[ 1 ] = 1.f;
+	check( maxDistance( blendCorrected( *rig, weights ), ab ) < 1e-5f, "combination at its drivers" );
+	weights[ 2 ] = 1.f;
+	check( maxDistance( blendCorrected( *rig, weights ), abc ) < 1e-5f, "nested combination at its drivers" );
+
+	// between the keys the combination follows the product of the weights,
+	// the in-between its piecewise linear weight
+	weights = boost::assign::list_of( .25f )( .6f )( 0.f ).convert_to_container< vector< float > >();
+	vector< Vec3f > output = blendCorrected( *rig, weights );
+	float maxError = 0.f;
+	for ( size_t v = 0; v < neutral.size(); v++ )
+	{
+		Vec3f deltaA = a[ v ] - neutral[ v ];
+		Vec3f deltaB = b[ v ] - neutral[ v ];
+		Vec3f expected = neutral[ v ] + .25f * deltaA + .6f * deltaB +
+						 .25f * .6f * ( ab[ v ] - neutral[ v ] - deltaA - deltaB ) +
+						 .5f * ( a50[ v ] - neutral[ v ] - .5f * deltaA );
+		maxError = std::max( maxError, output[ v ].distance( expected ) );
+	}
+	check( maxError < 1e-5f, "correctives between the keys" );
+
+	fs::remove_all( folder );
+}
+
+} // namespace fsTest
@@ -0,0 +1,108 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "CurveBaker.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+//! Checks that reading a copy of the curve file at \a path with a huge count at \a offset throws.
+static void checkCorruptCount( const fs::path &path, size_t offset, const string &message )
+{
+	string contents;
+	{
+		ifstream is( path.string().c_str(), ios::in | ios::binary );
+		contents.assign( istreambuf_iterator< char >( is ), istreambuf_iterator< char >() );
+	}
+	uint32_t count = 0xffffffff;
+	contents.replace( offset, sizeof( count ), reinterpret_cast< const char * >( &count ), sizeof( count ) );
+	fs::path corruptPath = getTempPath();
+	writeFile( corruptPath, contents );
+
+	bool threw = false;
+	try
+	{
+		BakedCurves::read( corruptPath );
+	}
+	catch ( const BakedCurvesExc & )
+	{
+		threw = true;
+	}
+	fs::remove( corruptPath );
+	check( threw, message );
+}
+
+void testCurveBaker()
+{
+	CurveBaker baker( CurveBaker::Format().weightTolerance( .001f ) );
+	vector< float > weights( 2 );
+	for ( size_t i = 0; i <= 60; i++ )
+	{
+		float t = i / 30.f;
+		weights[ 0 ] = std::min( t, 1.f );
+		weights[ 1 ] = .5f + .5f * std::sin( t * 3.f );
+		baker.addFrame( 10.0 + t, weights, Vec3f( t, 0.f, 0.f ), Quatf(), Quatf(), Quatf() );
+	}
+	BakedCurvesRef curves = baker.bake();
+	check( curves->getNumBlendshapes() == 2, "baked weight curves" );
+	// the ramp and the hold only need their corners
+	check( curves->getBlendshapeCurve( 0 ).getNumKeys() == 3, "baked curve reduced to its corners" );
+	check( std::abs( curves->getBlendshapeWeight( 1, 1.f ) - ( .5f + .5f * std::sin( 3.f ) ) ) <= .001f,
+		   "baked curve within the tolerance" );
+
+	fs::path path = getTempPath();
+	curves->write( path );
+	BakedCurvesRef read = BakedCurves::read( path );
+	check( ( read->getNumKeys() == curves->getNumKeys() ) && ( read->getDuration() == curves->getDuration() ) &&
+		   ( read->getStartTimestamp() == curves->getStartTimestamp() ), "baked curves read back" );
+	check( read->getBlendshapeWeight( 1, .7f ) == curves->getBlendshapeWeight( 1, .7f ), "baked curve values read back" );
+
+	// corrupt weight curve and key counts are rejected before allocating,
+	// the weight count follows the magic, the version, the start
+	// timestamp and the duration, the first key count follows it
+	checkCorruptCount( path, 20, "corrupt weight curve count rejected" );
+	checkCorruptCount( path, 24, "corrupt key count rejected" );
+	fs::remove( path );
+
+	// the stream errors of writing are reported
+	if ( fs::exists( "/dev/full" ) )
+	{
+		bool threw = false;
+		try
+		{
+			curves->write( "/dev/full" );
+		}
+		catch ( const BakedCurvesExc & )
+		{
+			threw = true;
+		}
+		check( threw, "baked curves write error reported" );
+	}
+}
+
+} // namespace fsTest
@@ -0,0 +1,101 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+
+#include <boost/assign.hpp>
+
+#include "GpuBlendData.h"
+#include "Rig.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+//! Returns the largest distance between the GPU evaluation of \a weights and the CPU blend of \a rig.
+static float compareBlend( const Rig &rig, const GpuBlendData &data, const vector< float > &weights )
+{
+	vector< Vec3f > output( rig.getNumVertices() );
+	rig.blend( &weights[ 0 ], weights.size(), &output[ 0 ] );
+
+	vector< int > indices( data.getMaxActiveShapes() );
+	vector< float > activeWeights( data.getMaxActiveShapes() );
+	size_t numActive = data.getActiveShapes( &weights[ 0 ], weights.size(), &indices[ 0 ], &activeWeights[ 0 ] );
+
+	float maxError = 0.f;
+	const vector< Vec3f > &neutral = rig.getNeutralMesh().getVertices();
+	for ( size_t v = 0; v < rig.getNumVertices(); v++ )
+	{
+		Vec3f gpu = neutral[ v ] + data.blendDelta( v, &indices[ 0 ], &activeWeights[ 0 ], numActive );
+		maxError = std::max( maxError, gpu.distance( output[ v ] ) );
+	}
+	return maxError;
+}
+
+void testGpuBlendData()
+{
+	vector< string > shapeNames = boost::assign::list_of( "A" )( "B" )( "C" )( "D" );
+	fs::path folder = createRigFolder( shapeNames, 5 );
+	RigRef rig = Rig::create( folder );
+
+	// a narrow texture wraps the vertices to several rows
+	GpuBlendData::Format format = GpuBlendData::Format().maxTextureSize( 16 ).maxActiveShapes( 4 );
+	GpuBlendDataRef data = GpuBlendData::create( *rig, format );
+	check( ( data->getVerticesPerRow() == 4 ) && ( data->getHeight() == 7 ), "gpu blend data layout" );
+	// the rig reorders the .obj vertices, compare against its own meshes
+	check( data->getDelta( 6, 0 ) == rig->getBlendshapeMesh( 0 ).getVertices()[ 6 ] -
+									  rig->getNeutralMesh().getVertices()[ 6 ], "gpu blend data delta" );
+
+	vector< float > weights = boost::assign::list_of( .5f )( 0.f )( -.25f )( 1.f );
+	check( compareBlend( *rig, *data, weights ) < 1e-5f, "gpu blend data matches the cpu blend" );
+
+	// with less active shapes the smallest weight is dropped
+	GpuBlendDataRef limited = GpuBlendData::create( *rig, GpuBlendData::Format().maxActiveShapes( 2 ) );
+	vector< float > limitedWeights = boost::assign::list_of( .5f )( 0.f )( -.25f )( 1.f );
+	vector< float > keptWeights = boost::assign::list_of( .5f )( 0.f )( 0.f )( 1.f );
+	check( compareBlend( *rig, *limited, keptWeights ) < 1e-5f,
+		   "gpu blend data keeps the largest active weights" );
+	check( compareBlend( *rig, *limited, limitedWeights ) > 1e-3f,
+		   "gpu blend data drops the smallest active weight" );
+
+	// the cache is only valid for the same meshes and format
+	fs::path cachePath = folder / "GpuBlend.bin";
+	data->write( cachePath );
+	GpuBlendDataRef cached = GpuBlendData::read( cachePath );
+	check( cached->matches( *rig, format ), "gpu blend cache matches its rig" );
+	check( compareBlend( *rig, *cached, weights ) < 1e-5f, "gpu blend cache matches the cpu blend" );
+	check( !cached->matches( *rig, GpuBlendData::Format().maxTextureSize( 16 ).maxActiveShapes( 64 ) ),
+		   "gpu blend cache rejected for more active shapes" );
+
+	// another export with the same counts has different deltas
+	fs::path otherFolder = createRigFolder( shapeNames, 5 );
+	fs::remove( otherFolder / "D.obj" );
+	fs::copy_file( otherFolder / "A.obj", otherFolder / "D.obj" );
+	RigRef otherRig = Rig::create( otherFolder );
+	check( ( otherRig->getNumVertices() == rig->getNumVertices() ) &&
+		   ( otherRig->getNumBlendshapes() == rig->getNumBlendshapes() ), "gpu blend cache rigs with the same counts" );
+	check( !cached->matches( *otherRig, format ), "gpu blend cache rejected for changed meshes" );
+
+	fs::remove_all( folder );
+	fs::remove_all( otherFolder );
+}
+
+} // namespace fsTest
@@ -0,0 +1,236 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/assign.hpp>
+#include <boost/thread.hpp>
+
+#include "ImportManifest.h"
+#include "Rig.h"
+#include "ciFaceShift.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+//! Writes \a contents to \a path and sets its write time to \a writeTime.
+static void rewriteFile( const fs::path &path, const string &contents, std::time_t writeTime )
+{
+	writeFile( path, contents );
+	fs::last_write_time( path, writeTime );
+}
+
+//! Sets the write time of the files in \a folder to \a writeTime, as if they were exported earlier.
+static void backdateFolder( const fs::path &folder, std::time_t writeTime )
+{
+	for ( fs::recursive_directory_iterator it( folder ); it != fs::recursive_directory_iterator(); ++it )
+	{
+		if ( fs::is_regular_file( it->path() ) )
+			fs::last_write_time( it->path(), writeTime );
+	}
+}
+
+//! Waits until the current second is over, the files written in it are compared by their contents.
+static void waitNextSecond()
+{
+	std::time_t start = std::time( NULL );
+	while ( std::time( NULL ) == start )
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 50 ) );
+}
+
+static void testManifestScan()
+{
+	fs::path folder = getTempPath();
+	fs::create_directories( folder );
+	std::time_t writeTime = std::time( NULL ) - 1000;
+	rewriteFile( folder / "A.obj", "v 0 0 0\n", writeTime );
+	rewriteFile( folder / "B.obj", "v 1 0 0\n", writeTime );
+	writeFile( folder / "notes.txt", "not part of the export" );
+
+	// the first import only lists the files
+	ImportManifest first = ImportManifest::scan( folder );
+	check( first.find( "A.obj" ) && ( first.find( "A.obj" )->mHash == 0 ), "first scan does not hash" );
+	check( !first.find( "notes.txt" ), "manifest skips other files" );
+	check( !first.isModified( folder ), "manifest not modified after scan" );
+
+	// unchanged files are not hashed again
+	ImportManifest second = ImportManifest::scan( folder, &first );
+	check( ( second.find( "A.obj" )->mHash == 0 ) && ImportManifest::isSame( first, second, "A.obj" ),
+		   "unchanged file keeps its entry" );
+	// the import hashes the files it reads
+	second.hash( folder / "A.obj" );
+	second.hash( folder / "B.obj" );
+
+	// exported again with the same contents
+	rewriteFile( folder / "A.obj", "v 0 0 0\n", writeTime + 10 );
+	check( first.isModified( folder ), "rewritten file modifies the manifest" );
+	ImportManifest third = ImportManifest::scan( folder, &second );
+	check( third.find( "A.obj" )->mHash != 0, "file with a new write time hashed" );
+	check( ImportManifest::isSame( second, third, "A.obj" ), "identical rewrite after the first import is unchanged" );
+	ImportManifest fourth = ImportManifest::scan( folder, &third );
+	check( ImportManifest::isSame( third, fourth, "A.obj" ) && ImportManifest::isSame( third, fourth, "B.obj" ),
+		   "rescan keeps the hashes" );
+
+	// same size, different contents
+	rewriteFile( folder / "A.obj", "v 2 0 0\n", writeTime + 30 );
+	ImportManifest fifth = ImportManifest::scan( folder, &fourth );
+	check( !ImportManifest::isSame( fourth, fifth, "A.obj" ), "changed contents detected" );
+	check( ImportManifest::isSame( fourth, fifth, "B.obj" ), "other file unchanged" );
+
+	// different size with the same write time
+	rewriteFile( folder / "B.obj", "v 1 0 0 0\n", writeTime );
+	ImportManifest sixth = ImportManifest::scan( folder, &fifth );
+	check( !ImportManifest::isSame( fifth, sixth, "B.obj" ), "changed size detected" );
+
+	// a file written in the second of the scan is compared by its contents
+	std::time_t now = std::time( NULL ) + 5;
+	rewriteFile( folder / "C.obj", "v 3 0 0\n", now );
+	ImportManifest recent = ImportManifest::scan( folder, &sixth );
+	check( ( recent.find( "C.obj" )->mWriteTime == 0 ) && recent.isModified( folder ),
+		   "file of the current second has no write time" );
+	recent.hash( folder / "C.obj" );
+	rewriteFile( folder / "C.obj", "v 4 0 0\n", now );
+	ImportManifest edited = ImportManifest::scan( folder, &recent );
+	check( !ImportManifest::isSame( recent, edited, "C.obj" ), "edit within the same second detected" );
+	edited.hash( folder / "C.obj" );
+	ImportManifest unchanged = ImportManifest::scan( folder, &edited );
+	check( ImportManifest::isSame( edited, unchanged, "C.obj" ), "unchanged file of the current second is the same" );
+
+	fs::remove( folder / "B.obj" );
+	check( sixth.isModified( folder ), "removed file modifies the manifest" );
+	ImportManifest seventh = ImportManifest::scan( folder, &sixth );
+	check( !ImportManifest::isSame( sixth, seventh, "B.obj" ), "removed file detected" );
+
+	// the write times and hashes are kept on disk
+	fs::path path = folder / ImportManifest::kFileName;
+	fifth.write( path );
+	ImportManifest read = ImportManifest::read( path );
+	check( read.find( "A.obj" ) && ( read.find( "A.obj" )->mHash == fifth.find( "A.obj" )->mHash ) &&
+		   ( read.find( "A.obj" )->mWriteTime == fifth.find( "A.obj" )->mWriteTime ) &&
+		   ImportManifest::isSame( read, fifth, "B.obj" ), "manifest read back" );
+
+	fs::remove_all( folder );
+}
+
+static void testLevelManifest()
+{
+	fs::path folder = createRigFolder( boost::assign::list_of( "A" ) );
+	fs::path levelFolder = folder / "lod1";
+	fs::create_directories( levelFolder );
+	std::time_t writeTime = std::time( NULL ) - 1000;
+	backdateFolder( folder, writeTime );
+	rewriteFile( levelFolder / "Neutral.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n", writeTime );
+
+	RigRef rig = Rig::create( folder, Rig::Format().exportTrimesh( true ) );
+	check( fs::exists( levelFolder / "Neutral.trimesh" ) && fs::exists( levelFolder / ImportManifest::kFileName ),
+		   "level conversion recorded" );
+	check( !rig->isModified(), "rig not modified after export" );
+	check( isNear( rig->getLevel( 1 ).getNeutralMesh().calcBoundingBox().getSize().x, 1.f ), "level neutral loaded" );
+
+	// an older .obj with the same size replaces the converted one
+	rewriteFile( levelFolder / "Neutral.obj", "v 0 0 0\nv 2 0 0\nv 0 1 0\nf 1 2 3\n", writeTime - 100 );
+	check( rig->isModified(), "changed level modifies the rig" );
+	waitNextSecond();
+	RigRef reimported = Rig::reimport( rig );
+	check( isNear( reimported->getLevel( 1 ).getNeutralMesh().calcBoundingBox().getSize().x, 2.f ),
+		   "changed level neutral converted again" );
+	check( !reimported->isModified(), "reimported rig not modified" );
+
+	fs::remove_all( folder );
+}
+
+static void testReloadCheck()
+{
+	fs::path folder = createRigFolder( boost::assign::list_of( "A" ) );
+	std::time_t writeTime = std::time( NULL ) - 1000;
+	backdateFolder( folder, writeTime );
+	RigRef rig = Rig::create( folder );
+
+	ciFaceShift faceShift;
+	faceShift.setRig( rig );
+	faceShift.setAutoReload( true, 0. );
+	// an unchanged folder is only listed, no import is started
+	faceShift.getBlendMesh();
+	check( !faceShift.isImporting() && ( faceShift.getRig() == rig ), "unchanged folder not imported again" );
+
+	rewriteFile( folder / "A.obj", "v 0 0 0\n", writeTime + 10 );
+	faceShift.getBlendMesh();
+	check( faceShift.isImporting() || ( faceShift.getRig() != rig ), "changed folder imported again" );
+	for ( size_t i = 0; faceShift.isImporting() && ( i < 1000 ); i++ )
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 10 ) );
+
+	fs::remove_all( folder );
+}
+
+//! Returns the width of the blendshape A of \a rig.
+static float getShapeWidth( const Rig &rig )
+{
+	return rig.getBlendshapeMesh( rig.findBlendshape( "A" ) ).calcBoundingBox().getSize().x;
+}
+
+static void testConversionVersion()
+{
+	fs::path folder = createRigFolder( boost::assign::list_of( "A" ) );
+	std::time_t writeTime = std::time( NULL ) - 1000;
+	backdateFolder( folder, writeTime );
+	float width = getShapeWidth( *Rig::create( folder ) );
+
+	// a wider A.trimesh converted by another version
+	fs::path otherFolder = createRigFolder( boost::assign::list_of( "A" ) );
+	vector< Vec3f > positions;
+	for ( size_t v = 0; v < 16; v++ )
+		positions.push_back( getRigVertex( 0, v ) * 2.f );
+	writeGridObj( otherFolder / "A.obj", positions );
+	Rig::create( otherFolder, Rig::Format().exportTrimesh( true ) );
+	fs::copy_file( otherFolder / "A.trimesh", folder / "A.trimesh" );
+	check( isNear( getShapeWidth( *Rig::create( folder ) ), width ), ".trimesh without a conversion record not loaded" );
+
+	// the manifest of an earlier version records the .obj
+	RigRef rig = Rig::create( folder, Rig::Format().exportTrimesh( true ) );
+	fs::path manifestPath = folder / ImportManifest::kFileName;
+	ImportManifest manifest = ImportManifest::read( manifestPath );
+	check( manifest.find( "A.obj" ) != NULL, "conversion recorded" );
+	check( isNear( getShapeWidth( *Rig::create( folder ) ), width ), "converted .trimesh loaded" );
+	fs::copy_file( otherFolder / "A.trimesh", folder / "A.trimesh", fs::copy_option::overwrite_if_exists );
+	const ImportManifest::Entry *entry = manifest.find( "A.obj" );
+	ostringstream earlier;
+	earlier << entry->mSize << " " << entry->mWriteTime << " " << std::hex << entry->mHash << " A.obj\n";
+	writeFile( manifestPath, earlier.str() );
+	check( ImportManifest::read( manifestPath ).isEmpty(), "manifest of an earlier version not read" );
+	check( isNear( getShapeWidth( *Rig::create( folder ) ), width ), ".trimesh of an earlier version not loaded" );
+
+	fs::remove_all( folder );
+	fs::remove_all( otherFolder );
+}
+
+void testImportManifest()
+{
+	testManifestScan();
+	testLevelManifest();
+	testReloadCheck();
+	testConversionVersion();
+}
+
+} // namespace fsTest
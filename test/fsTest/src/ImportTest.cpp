@@ -0,0 +1,80 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <vector>
+
+#include <boost/assign.hpp>
+#include <boost/thread.hpp>
+
+#include "ciFaceShift.h"
+#include "Rig.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+static void countImport( boost::mutex *mutex, size_t *count, RigRef rig )
+{
+	if ( !rig )
+		return;
+	boost::lock_guard< boost::mutex > lock( *mutex );
+	( *count )++;
+}
+
+void testImportAsync()
+{
+	fs::path firstFolder = createRigFolder( boost::assign::list_of( "First" ), 32 );
+	fs::path secondFolder = createRigFolder( boost::assign::list_of( "Second" ) );
+
+	boost::mutex mutex;
+	size_t numCallbacks = 0;
+	ciFaceShift faceShift;
+	// the second import supersedes the first one without waiting for it
+	faceShift.importAsync( firstFolder, false, boost::bind( countImport, &mutex, &numCallbacks, _1 ) );
+	faceShift.importAsync( secondFolder, false, boost::bind( countImport, &mutex, &numCallbacks, _1 ) );
+
+	for ( size_t i = 0; faceShift.isImporting() && ( i < 1000 ); i++ )
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 10 ) );
+	check( !faceShift.isImporting(), "async import finishes" );
+	check( faceShift.getImportError().empty(), "async import without error" );
+
+	faceShift.getBlendMesh();
+	RigRef rig = faceShift.getRig();
+	check( rig && ( rig->getBlendshapeNames() == boost::assign::list_of( "Second" ).convert_to_container< vector< string > >() ),
+		   "newest async import installed" );
+	{
+		boost::lock_guard< boost::mutex > lock( mutex );
+		check( numCallbacks >= 1, "async import callback called" );
+	}
+
+	// a failed import reports its error
+	faceShift.importAsync( firstFolder / "missing" );
+	for ( size_t i = 0; faceShift.isImporting() && ( i < 1000 ); i++ )
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 10 ) );
+	check( !faceShift.getImportError().empty(), "async import error reported" );
+	check( faceShift.getRig() == rig, "failed async import keeps the rig" );
+
+	fs::remove_all( firstFolder );
+	fs::remove_all( secondFolder );
+}
+
+} // namespace fsTest
@@ -0,0 +1,138 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <boost/assign.hpp>
+
+#include "Rig.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+static const size_t kGridSize = 8;
+
+//! Returns the index of the vertex of \a vertices at \a position or -1.
+static int findVertex( const vector< Vec3f > &vertices, const Vec3f &position )
+{
+	for ( size_t j = 0; j < vertices.size(); j++ )
+	{
+		if ( vertices[ j ].distance( position ) < 1e-5f )
+			return int( j );
+	}
+	return -1;
+}
+
+/*! Returns true if every vertex of \a level takes the blendshape delta of
+ * the vertex of \a rig at its neutral position moved by \a offset.
+ */
+static bool hasSourceDeltas( const Rig &rig, const Rig &level, const Vec3f &offset )
+{
+	const vector< Vec3f > &neutral = rig.getNeutralMesh().getVertices();
+	const vector< Vec3f > &levelNeutral = level.getNeutralMesh().getVertices();
+	for ( size_t i = 0; i < rig.getNumBlendshapes(); i++ )
+	{
+		const vector< Vec3f > &shape = rig.getBlendshapeMesh( i ).getVertices();
+		const vector< Vec3f > &levelShape = level.getBlendshapeMesh( i ).getVertices();
+		for ( size_t j = 0; j < levelNeutral.size(); j++ )
+		{
+			int source = findVertex( neutral, levelNeutral[ j ] + offset );
+			if ( ( source < 0 ) ||
+				 ( levelShape[ j ].distance( levelNeutral[ j ] + shape[ source ] - neutral[ source ] ) > 1e-5f ) )
+				return false;
+		}
+	}
+	return true;
+}
+
+void testLevels()
+{
+	// generated levels, the 7 unit wide grid is clustered in cells of
+	// 2.1 and 4.2 units
+	fs::path folder = createRigFolder( boost::assign::list_of( "A" )( "B" ), kGridSize );
+	RigRef rig = Rig::create( folder, Rig::Format().levels( 2 ).levelCellSize( .3f ) );
+	check( rig->getNumLevels() == 3, "levels generated" );
+	if ( rig->getNumLevels() == 3 )
+	{
+		const Rig &level1 = rig->getLevel( 1 );
+		const Rig &level2 = rig->getLevel( 2 );
+		check( level1.getNumVertices() == 16, "level 1 clustered to 4 x 4 vertices" );
+		check( level2.getNumVertices() == 4, "level 2 clustered to 2 x 2 vertices" );
+		check( level1.getNeutralMesh().getNumTriangles() > 0, "level 1 has triangles" );
+		check( hasSourceDeltas( *rig, level1, Vec3f::zero() ), "level 1 vertices take the deltas of their cluster vertex" );
+		check( hasSourceDeltas( *rig, level2, Vec3f::zero() ), "level 2 vertices take the deltas of their cluster vertex" );
+	}
+	fs::remove_all( folder );
+
+	// a lod folder neutral slightly off every second full resolution
+	// vertex takes the deltas of the nearest vertex
+	folder = createRigFolder( boost::assign::list_of( "A" )( "B" ), kGridSize );
+	fs::create_directories( folder / "lod1" );
+	const Vec3f offset( .1f, -.1f, .05f );
+	vector< Vec3f > lodPositions;
+	for ( size_t y = 0; y < kGridSize / 2; y++ )
+	{
+		for ( size_t x = 0; x < kGridSize / 2; x++ )
+			lodPositions.push_back( Vec3f( 2.f * x, 2.f * y, 0.f ) + offset );
+	}
+	writeGridObj( folder / "lod1" / "Neutral.obj", lodPositions, kGridSize / 2 );
+	rig = Rig::create( folder );
+	check( rig->getNumLevels() == 2, "lod folder level imported" );
+	if ( rig->getNumLevels() == 2 )
+	{
+		const Rig &level = rig->getLevel( 1 );
+		const vector< Vec3f > &levelNeutral = level.getNeutralMesh().getVertices();
+		bool isLodNeutral = ( levelNeutral.size() == lodPositions.size() );
+		for ( size_t j = 0; isLodNeutral && ( j < lodPositions.size() ); j++ )
+			isLodNeutral = ( findVertex( levelNeutral, lodPositions[ j ] ) >= 0 );
+		check( isLodNeutral, "lod level neutral is the lod folder neutral" );
+		check( hasSourceDeltas( *rig, level, -offset ), "lod level vertices take the deltas of the nearest vertex" );
+
+		// the full resolution vertex 2, 2 moves with the blendshape B
+		int j = findVertex( levelNeutral, Vec3f( 2.f, 2.f, 0.f ) + offset );
+		size_t v = 2 * kGridSize + 2;
+		check( ( j >= 0 ) && ( level.getBlendshapeMesh( rig->findBlendshape( "B" ) ).getVertices()[ j ].distance(
+					levelNeutral[ j ] + getRigVertex( 1, v, kGridSize ) - getRigVertex( -1, v, kGridSize ) ) < 1e-5f ),
+			   "lod level vertex takes the delta of the nearest vertex" );
+	}
+	fs::remove_all( folder );
+
+	// a single point neutral clusters into one vertex
+	folder = getTempPath();
+	fs::create_directories( folder );
+	vector< Vec3f > positions( 16, Vec3f( 1.f, 1.f, 1.f ) );
+	writeGridObj( folder / "Neutral.obj", positions );
+	positions[ 0 ].z = 2.f;
+	writeGridObj( folder / "A.obj", positions );
+	rig = Rig::create( folder, Rig::Format().levels( 1 ) );
+	check( rig->getNumLevels() == 2, "single point level generated" );
+	if ( rig->getNumLevels() == 2 )
+	{
+		const vector< Vec3f > &levelNeutral = rig->getLevel( 1 ).getNeutralMesh().getVertices();
+		check( ( levelNeutral.size() == 1 ) && ( levelNeutral[ 0 ].distance( Vec3f( 1.f, 1.f, 1.f ) ) < 1e-5f ),
+			   "single point clustered into one vertex" );
+	}
+	fs::remove_all( folder );
+}
+
+} // namespace fsTest
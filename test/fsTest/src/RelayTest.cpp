@@ -0,0 +1,118 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <unistd.h>
+
+#include "ciFaceShift.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+using boost::asio::ip::tcp;
+
+namespace fsTest {
+
+static void destroy( ciFaceShift *faceShift )
+{
+	delete faceShift;
+}
+
+//! Connects \a socket to the relay on \a port, which starts asynchronously.
+static bool connectClient( tcp::socket &socket, unsigned short port, ciFaceShift *faceShift )
+{
+	for ( size_t i = 0; i < 200; i++ )
+	{
+		if ( faceShift->getIoMode() == ciFaceShift::IO_POLL )
+			faceShift->poll();
+
+		boost::system::error_code error;
+		socket.connect( tcp::endpoint( boost::asio::ip::address_v4::loopback(), port ), error );
+		if ( !error )
+			return true;
+		socket.close();
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 10 ) );
+	}
+	return false;
+}
+
+//! Destroys \a faceShift with a relay client connected.
+static void destroyWithClient( ciFaceShift *faceShift, unsigned short port, const string &mode )
+{
+	boost::asio::io_service ioService;
+	tcp::socket client( ioService );
+	check( connectClient( client, port, faceShift ), "relay accepts a client in " + mode + " mode" );
+
+	boost::thread thread( boost::bind( destroy, faceShift ) );
+	if ( !thread.timed_join( boost::posix_time::seconds( 10 ) ) )
+		fail( "relay blocks the destructor in " + mode + " mode" );
+
+	// the relay disconnected the client, or reset it if it was not accepted yet
+	char data;
+	boost::system::error_code error;
+	client.read_some( boost::asio::buffer( &data, 1 ), error );
+	check( ( error == boost::asio::error::eof ) || ( error == boost::asio::error::connection_reset ),
+		   "relay disconnects its clients in " + mode + " mode" );
+}
+
+void testRelay()
+{
+	unsigned short port = 20000 + getpid() % 20000;
+
+	{
+		ciFaceShift faceShift;
+		// nothing listens on the connection port, the relay runs anyway
+		faceShift.connect( "127.0.0.1", boost::lexical_cast< string >( port + 1 ) );
+		faceShift.startRelay( port );
+		faceShift.addRelayUdpTarget( "127.0.0.1", "no-such-service" );
+		for ( size_t i = 0; faceShift.getRelayError().empty() && ( i < 500 ); i++ )
+			boost::this_thread::sleep( boost::posix_time::milliseconds( 10 ) );
+		check( !faceShift.getRelayError().empty(), "relay target resolve error reported" );
+
+		// connecting again keeps the relay, closing stops it and the I/O thread
+		faceShift.connect( "127.0.0.1", boost::lexical_cast< string >( port + 1 ) );
+		boost::asio::io_service ioService;
+		tcp::socket client( ioService );
+		check( connectClient( client, port, &faceShift ), "relay kept by connect" );
+		faceShift.close();
+		boost::thread thread( boost::bind( &ciFaceShift::connect, &faceShift, "127.0.0.1",
+										   boost::lexical_cast< string >( port + 1 ) ) );
+		if ( !thread.timed_join( boost::posix_time::seconds( 10 ) ) )
+			fail( "relay blocks connect after close" );
+	}
+
+	ciFaceShift *faceShift = new ciFaceShift();
+	faceShift->connect( "127.0.0.1", boost::lexical_cast< string >( port + 1 ) );
+	faceShift->startRelay( port );
+	destroyWithClient( faceShift, port, "thread" );
+
+	faceShift = new ciFaceShift();
+	faceShift->setIoMode( ciFaceShift::IO_POLL );
+	faceShift->connect( "127.0.0.1", boost::lexical_cast< string >( port + 1 ) );
+	faceShift->startRelay( port );
+	destroyWithClient( faceShift, port, "poll" );
+}
+
+} // namespace fsTest
@@ -0,0 +1,175 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <vector>
+
+#include <boost/assign.hpp>
+
+#include "cinder/DataSource.h"
+
+#include "ciFaceShift.h"
+#include "Retargeter.h"
+#include "Rig.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+static RetargeterRef createRetargeter( const string &definition,
+									   const vector< string > &sourceNames,
+									   const vector< string > &targetNames )
+{
+	fs::path path = getTempPath();
+	writeFile( path, definition );
+	RetargeterRef retargeter;
+	try
+	{
+		retargeter = Retargeter::create( loadFile( path ), sourceNames, targetNames );
+	}
+	catch ( ... )
+	{
+		fs::remove( path );
+		throw;
+	}
+	fs::remove( path );
+	return retargeter;
+}
+
+//! Checks that a loaded definition follows the rig of a ciFaceShift instance.
+static void testFaceShiftRetargeter()
+{
+	fs::path definitionPath = getTempPath();
+	writeFile( definitionPath,
+			"<retarget>"
+			"  <target name=\"Smile\">"
+			"    <source name=\"MouthSmile_L\" weight=\".5\" />"
+			"    <source name=\"MouthSmile_R\" weight=\".5\" />"
+			"  </target>"
+			"</retarget>" );
+	fs::path smileFolder = createRigFolder( boost::assign::list_of( "Blink" )( "Smile" ) );
+	fs::path frownFolder = createRigFolder( boost::assign::list_of( "Frown" ) );
+
+	ciFaceShift faceShift;
+	// without a rig the definition is compiled when the rig is set
+	faceShift.loadRetargeter( definitionPath );
+	check( !faceShift.getRetargeter(), "retargeter deferred without a rig" );
+
+	faceShift.setRig( Rig::create( smileFolder ) );
+	check( faceShift.getRetargeter() && ( faceShift.getRetargeter()->getNumTargets() == 2 ),
+		   "retargeter compiled for the rig set later" );
+	check( faceShift.getRetargeterError().empty(), "retargeter without error" );
+
+	// the definition does not match the blendshapes of the new rig
+	faceShift.setRig( Rig::create( frownFolder ) );
+	check( !faceShift.getRetargeter(), "retargeter dropped for a rig without its targets" );
+	check( !faceShift.getRetargeterError().empty(), "retargeter error for a rig without its targets" );
+
+	// a retargeter set for another rig is reported when blending
+	RetargeterRef smileRetargeter = Retargeter::create( loadFile( definitionPath ),
+			faceShift.getBlendshapeNames(), boost::assign::list_of( "Blink" )( "Smile" ) );
+	faceShift.setRetargeter( smileRetargeter );
+	check( faceShift.getRetargeterError().empty(), "retargeter error cleared" );
+	faceShift.getBlendMesh();
+	check( !faceShift.getRetargeterError().empty(), "retargeter target count mismatch reported" );
+
+	fs::remove( definitionPath );
+	fs::remove_all( smileFolder );
+	fs::remove_all( frownFolder );
+}
+
+void testRetargeter()
+{
+	vector< string > sourceNames = boost::assign::list_of( "A" )( "B" )( "C" );
+	vector< string > targetNames = boost::assign::list_of( "X" )( "Y" )( "Z" )( "W" );
+
+	// rows for W and Y in reverse order of the targets, Z is not mentioned
+	RetargeterRef retargeter = createRetargeter(
+			"<retarget>"
+			"  <target name=\"W\" min=\"0\" max=\"1\">"
+			"    <source name=\"A\" weight=\"2\" />"
+			"    <source name=\"C\" weight=\"-1\" />"
+			"  </target>"
+			"  <target name=\"Y\">"
+			"    <source name=\"C\" />"
+			"    <curve>"
+			"      <key in=\"1\" out=\"1\" />"
+			"      <key in=\"0\" out=\"0\" />"
+			"      <key in=\".5\" out=\".2\" />"
+			"    </curve>"
+			"  </target>"
+			"  <target name=\"X\">"
+			"    <source name=\"A\" weight=\".5\" />"
+			"    <source name=\"B\" weight=\".5\" />"
+			"  </target>"
+			"</retarget>", sourceNames, targetNames );
+
+	check( retargeter->getNumSources() == 3, "retargeter source count" );
+	check( retargeter->getNumTargets() == 4, "retargeter target count" );
+
+	const float sources[] = { .8f, .6f, .75f };
+	float targets[] = { -1.f, -1.f, -1.f, -1.f };
+	retargeter->evaluate( sources, 3, targets );
+	check( isNear( targets[ 0 ], .7f ), "retargeter weighted sum" );
+	// the unsorted curve keys are sorted, .75 is halfway between .2 and 1
+	check( isNear( targets[ 1 ], .6f ), "retargeter curve interpolation" );
+	check( targets[ 2 ] == 0.f, "retargeter unmapped target is zero" );
+	check( isNear( targets[ 3 ], .85f ), "retargeter negative weight" );
+
+	// missing sources are zero, the curve holds its first key below its range
+	retargeter->evaluate( sources, 2, targets );
+	check( isNear( targets[ 1 ], 0.f ), "retargeter missing source" );
+	// 2 * .8 without the negative source is clamped to the maximum
+	check( isNear( targets[ 3 ], 1.f ), "retargeter clamps to max" );
+
+	const float negative[] = { 0.f, 0.f, 2.f };
+	retargeter->evaluate( negative, 3, targets );
+	check( isNear( targets[ 1 ], 1.f ), "retargeter curve holds its last key" );
+	check( targets[ 3 ] == 0.f, "retargeter clamps to min" );
+
+	bool threw = false;
+	try
+	{
+		createRetargeter( "<retarget><target name=\"X\"><source name=\"D\" /></target></retarget>",
+						  sourceNames, targetNames );
+	}
+	catch ( const RetargeterExc & )
+	{
+		threw = true;
+	}
+	check( threw, "retargeter rejects unknown sources" );
+
+	threw = false;
+	try
+	{
+		createRetargeter( "<retarget><target name=\"X\" /><target name=\"X\" /></retarget>",
+						  sourceNames, targetNames );
+	}
+	catch ( const RetargeterExc & )
+	{
+		threw = true;
+	}
+	check( threw, "retargeter rejects duplicate targets" );
+
+	testFaceShiftRetargeter();
+}
+
+} // namespace fsTest
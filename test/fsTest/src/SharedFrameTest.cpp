@@ -0,0 +1,169 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <unistd.h>
+
+#include "SharedFrame.h"
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+namespace fsTest {
+
+//! Fills every field of \a frame derived from \a value, so a torn read mixes values.
+static void fillFrame( SharedFrame &frame, uint32_t value )
+{
+	float v = float( value );
+	frame.mTimestamp = v;
+	frame.mTrackingSuccessful = value;
+	frame.mHeadPosition = Vec3f( v, v, v );
+	frame.mNumBlendshapes = SharedFrame::kMaxBlendshapes;
+	for ( size_t i = 0; i < SharedFrame::kMaxBlendshapes; i++ )
+		frame.mBlendshapeWeights[ i ] = v;
+	frame.mNumMarkers = SharedFrame::kMaxMarkers;
+	for ( size_t i = 0; i < SharedFrame::kMaxMarkers; i++ )
+		frame.mMarkers[ i ] = Vec3f( v, v, v );
+}
+
+//! Returns true if all fields of \a frame were filled from the same value.
+static bool isConsistent( const SharedFrame &frame )
+{
+	float v = float( frame.mTrackingSuccessful );
+	if ( ( frame.mTimestamp != v ) || ( frame.mHeadPosition != Vec3f( v, v, v ) ) ||
+		 ( frame.mNumBlendshapes != SharedFrame::kMaxBlendshapes ) ||
+		 ( frame.mNumMarkers != SharedFrame::kMaxMarkers ) )
+		return false;
+	for ( size_t i = 0; i < SharedFrame::kMaxBlendshapes; i++ )
+		if ( frame.mBlendshapeWeights[ i ] != v )
+			return false;
+	for ( size_t i = 0; i < SharedFrame::kMaxMarkers; i++ )
+		if ( frame.mMarkers[ i ] != Vec3f( v, v, v ) )
+			return false;
+	return true;
+}
+
+static void publishFrames( SharedFramePublisher *publisher, uint32_t numFrames )
+{
+	SharedFrame frame;
+	for ( uint32_t i = 1; i <= numFrames; i++ )
+	{
+		fillFrame( frame, i );
+		publisher->publish( frame );
+	}
+}
+
+void testSharedFrame()
+{
+	string name = "/fsTest" + boost::lexical_cast< string >( getpid() );
+
+	bool threw = false;
+	try
+	{
+		SharedFrameReader reader( name );
+	}
+	catch ( const SharedFrameExc & )
+	{
+		threw = true;
+	}
+	check( threw, "shared frame reader of a missing segment throws" );
+
+	{
+		SharedFramePublisher publisher( name, 4 );
+		SharedFrameReader reader( name );
+		SharedFrame frame;
+		check( !reader.read( frame ), "shared frame read before publishing" );
+
+		// more frames than slots, the ring wraps around
+		for ( uint32_t i = 1; i <= 10; i++ )
+		{
+			fillFrame( frame, i );
+			publisher.publish( frame );
+			check( frame.mFrameNumber == i - 1, "shared frame number assigned" );
+		}
+		check( reader.getNumFrames() == 10, "shared frame count" );
+
+		SharedFrame latest;
+		check( reader.read( latest ) && isConsistent( latest ) && ( latest.mTrackingSuccessful == 10 ) &&
+			   ( latest.mFrameNumber == 9 ), "shared frame reads the latest frame" );
+
+		// the acquired slot stays valid until the publisher comes around to it again
+		uint64_t version;
+		const SharedFrame *acquired = reader.acquire( version );
+		check( acquired && ( acquired->mFrameNumber == 9 ), "shared frame acquired in place" );
+		check( reader.validate( acquired, version ), "shared frame valid before it is overwritten" );
+		for ( uint32_t i = 11; i <= 13; i++ )
+		{
+			fillFrame( frame, i );
+			publisher.publish( frame );
+		}
+		check( reader.validate( acquired, version ), "shared frame valid while other slots are written" );
+		fillFrame( frame, 14 );
+		publisher.publish( frame );
+		check( !reader.validate( acquired, version ), "shared frame invalid after it is overwritten" );
+	}
+
+	{
+		// a concurrent reader never sees a torn frame or a frame older than the last one read
+		SharedFramePublisher publisher( name, 2 );
+		SharedFrameReader reader( name );
+		const uint32_t numFrames = 200000;
+		boost::thread publisherThread( publishFrames, &publisher, numFrames );
+
+		size_t numReads = 0;
+		size_t numTorn = 0;
+		size_t numBackwards = 0;
+		uint64_t lastFrameNumber = 0;
+		SharedFrame frame;
+		while ( reader.getNumFrames() < numFrames )
+		{
+			if ( !reader.read( frame ) )
+				continue;
+			numReads++;
+			if ( !isConsistent( frame ) || ( frame.mFrameNumber + 1 != frame.mTrackingSuccessful ) )
+				numTorn++;
+			if ( frame.mFrameNumber < lastFrameNumber )
+				numBackwards++;
+			lastFrameNumber = frame.mFrameNumber;
+		}
+		publisherThread.join();
+
+		check( numReads > 0, "shared frame concurrent reads" );
+		check( numTorn == 0, "shared frame concurrent reads are consistent" );
+		check( numBackwards == 0, "shared frame concurrent reads are in order" );
+	}
+
+	threw = false;
+	try
+	{
+		SharedFrameReader reader( name );
+	}
+	catch ( const SharedFrameExc & )
+	{
+		threw = true;
+	}
+	check( threw, "shared frame segment removed with the publisher" );
+}
+
+} // namespace fsTest
@@ -0,0 +1,157 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ Behaviour checks of the ciFaceShift library. Runs without a window or GL
+ context and returns a non-zero exit status if a check fails.
+
+ usage: fsTest
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "fsTest.h"
+
+using namespace ci;
+using namespace std;
+
+namespace fsTest {
+
+static size_t sNumChecks = 0;
+static size_t sNumFailures = 0;
+
+void check( bool condition, const string &message )
+{
+	sNumChecks++;
+	if ( condition )
+		return;
+
+	sNumFailures++;
+	cerr << "FAILED: " << message << endl;
+}
+
+void fail( const string &message )
+{
+	check( false, message );
+	cout << sNumChecks << " checks, " << sNumFailures << " failed" << endl;
+	// the destructors of the blocked threads would not return
+	std::_Exit( 1 );
+}
+
+bool isNear( float a, float b, float epsilon /* = 1e-5f */ )
+{
+	return std::abs( a - b ) <= epsilon;
+}
+
+fs::path getTempPath()
+{
+	return fs::temp_directory_path() / fs::unique_path( "fsTest-%%%%-%%%%-%%%%" );
+}
+
+void writeFile( const fs::path &path, const string &contents )
+{
+	ofstream os( path.string().c_str(), ios::out | ios::binary | ios::trunc );
+	os << contents;
+	check( os.good(), "cannot write " + path.string() );
+}
+
+Vec3f getRigVertex( int shape, size_t vertex, size_t gridSize /* = 4 */ )
+{
+	Vec3f position( float( vertex % gridSize ), float( vertex / gridSize ), 0.f );
+	// each blendshape moves every third vertex starting from its index
+	if ( ( shape >= 0 ) && ( ( vertex % 3 ) == ( size_t( shape ) % 3 ) ) )
+		position += Vec3f( .25f * ( shape + 1 ), 0.f, float( vertex % 5 ) - 2.f );
+	return position;
+}
+
+void writeGridObj( const fs::path &path, const vector< Vec3f > &positions, size_t gridSize /* = 4 */ )
+{
+	ostringstream obj;
+	for ( size_t v = 0; v < positions.size(); v++ )
+		obj << "v " << positions[ v ].x << " " << positions[ v ].y << " " << positions[ v ].z << "\n";
+	for ( size_t y = 0; y + 1 < gridSize; y++ )
+	{
+		for ( size_t x = 0; x + 1 < gridSize; x++ )
+		{
+			size_t i = y * gridSize + x + 1;
+			obj << "f " << i << " " << i + 1 << " " << i + gridSize + 1 << "\n";
+			obj << "f " << i << " " << i + gridSize + 1 << " " << i + gridSize << "\n";
+		}
+	}
+	writeFile( path, obj.str() );
+}
+
+fs::path createRigFolder( const vector< string > &shapeNames, size_t gridSize /* = 4 */ )
+{
+	fs::path folder = getTempPath();
+	fs::create_directories( folder );
+
+	for ( int shape = -1; shape < int( shapeNames.size() ); shape++ )
+	{
+		vector< Vec3f > positions;
+		for ( size_t v = 0; v < gridSize * gridSize; v++ )
+			positions.push_back( getRigVertex( shape, v, gridSize ) );
+		writeGridObj( folder / ( ( ( shape < 0 ) ? string( "Neutral" ) : shapeNames[ shape ] ) + ".obj" ),
+					  positions, gridSize );
+	}
+	return folder;
+}
+
+} // namespace fsTest
+
+int main()
+{
+	typedef void ( *Test )();
+	struct { const char *mName; Test mTest; } tests[] = {
+		{ "Retargeter", fsTest::testRetargeter },
+		{ "ImportAsync", fsTest::testImportAsync },
+		{ "ImportManifest", fsTest::testImportManifest },
+		{ "SharedFrame", fsTest::testSharedFrame },
+		{ "Relay", fsTest::testRelay },
+		{ "CurveBaker", fsTest::testCurveBaker },
+		{ "GpuBlendData", fsTest::testGpuBlendData },
+		{ "Allocations", fsTest::testAllocations },
+		{ "Attachments", fsTest::testAttachments },
+		{ "Correctives", fsTest::testCorrectives },
+		{ "ClockSync", fsTest::testClockSync },
+		{ "Bounds", fsTest::testBounds },
+		{ "Levels", fsTest::testLevels },
+		{ "BlendCache", fsTest::testBlendCache }
+	};
+
+	for ( size_t i = 0; i < sizeof( tests ) / sizeof( tests[ 0 ] ); i++ )
+	{
+		cout << tests[ i ].mName << endl;
+		try
+		{
+			tests[ i ].mTest();
+		}
+		catch ( const std::exception &exc )
+		{
+			fsTest::check( false, string( tests[ i ].mName ) + " threw " + exc.what() );
+		}
+	}
+
+	cout << fsTest::sNumChecks << " checks, " << fsTest::sNumFailures << " failed" << endl;
+	return ( fsTest::sNumFailures == 0 ) ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+
+namespace fsTest {
+
+//! Reports \a message as a failure if \a condition is false.
+void check( bool condition, const std::string &message );
+/*! Reports \a message as a failure and exits right away, for a check
+ * which leaves threads blocked.
+ */
+void fail( const std::string &message );
+//! Returns true if \a a and \a b differ by at most \a epsilon.
+bool isNear( float a, float b, float epsilon = 1e-5f );
+//! Returns a path in the temporary directory which does not exist yet.
+ci::fs::path getTempPath();
+//! Writes \a contents to the file at \a path.
+void writeFile( const ci::fs::path &path, const std::string &contents );
+//! Writes an .obj of a \a gridSize x \a gridSize grid of triangles with the vertex \a positions.
+void writeGridObj( const ci::fs::path &path, const std::vector< ci::Vec3f > &positions, size_t gridSize = 4 );
+/*! Creates a model export folder with a neutral grid of \a gridSize x
+ * \a gridSize vertices and a blendshape named after each of \a shapeNames,
+ * moving a few vertices of the grid. Returns the path of the folder.
+ */
+ci::fs::path createRigFolder( const std::vector< std::string > &shapeNames, size_t gridSize = 4 );
+//! Returns the position of \a vertex in the blendshape \a shape of createRigFolder(), or the neutral position if \a shape is -1.
+ci::Vec3f getRigVertex( int shape, size_t vertex, size_t gridSize = 4 );
+
+void testAllocations();
+void testAttachments();
+void testBlendCache();
+void testBounds();
+void testClockSync();
+void testCorrectives();
+void testCurveBaker();
+void testGpuBlendData();
+void testRetargeter();
+void testImportAsync();
+void testImportManifest();
+void testLevels();
+void testRelay();
+void testSharedFrame();
+
+} // namespace fsTest
@@ -0,0 +1,195 @@
+/*
+ Copyright (C) 2012 Gabor Papp
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ Blends a recording made with ciFaceShift::startRecording() with the rig
+ in an fsStudio model export folder and writes the vertices of every frame
+ to a PointCache2 (.pc2) file. Runs without a window or GL context.
+
+ usage: fsBlend [-t threads] [-b batch] [-w] rigFolder recording output.pc2
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "cinder/Cinder.h"
+#include "cinder/Vector.h"
+
+#include "ciFaceShift.h"
+#include "Rig.h"
+
+using namespace ci;
+using namespace std;
+using namespace mndl::faceshift;
+
+static void usage()
+{
+	cerr << "usage: fsBlend [-t threads] [-b batch] [-w] rigFolder recording output.pc2" << endl;
+	cerr << "  -t threads  number of blending threads (default: number of cores)" << endl;
+	cerr << "  -b batch    frames blended together in one pass over the deltas (default: 16)" << endl;
+	cerr << "  -w          apply the head pose and eye rotations" << endl;
+}
+
+//! Blends \a numFrames frames starting from \a firstFrame into \a output in one batch.
+static void blendFrames( RigRef rig, const vector< float > *weights, size_t numWeights,
+						 const vector< Rig::Pose > *poses, size_t firstFrame, size_t numFrames,
+						 Vec3f *output )
+{
+	size_t numVertices = rig->getNumVertices();
+	vector< const float * > frameWeights( numFrames );
+	vector< Vec3f * > frameOutputs( numFrames );
+	for ( size_t i = 0; i < numFrames; i++ )
+	{
+		frameWeights[ i ] = &( *weights )[ ( firstFrame + i ) * numWeights ];
+		frameOutputs[ i ] = output + i * numVertices;
+	}
+
+	if ( poses->empty() )
+	{
+		rig->blend( numFrames, &frameWeights[ 0 ], numWeights, &frameOutputs[ 0 ] );
+	}
+	else
+	{
+		rig->blend( numFrames, &frameWeights[ 0 ], numWeights, &frameOutputs[ 0 ],
+					&( *poses )[ firstFrame ], NULL );
+	}
+}
+
+template <typename T>
+static inline void writeRaw( ostream& os, const T& data )
+{
+	os.write( reinterpret_cast< const char * >( &data ), sizeof( T ) );
+}
+
+int main( int argc, char *argv[] )
+{
+	size_t numThreads = max< size_t >( boost::thread::hardware_concurrency(), 1 );
+	size_t batchSize = 16;
+	bool world = false;
+
+	vector< string > args;
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( ( strcmp( argv[ i ], "-t" ) == 0 ) && ( i + 1 < argc ) )
+			numThreads = max( atoi( argv[ ++i ] ), 1 );
+		else if ( ( strcmp( argv[ i ], "-b" ) == 0 ) && ( i + 1 < argc ) )
+			batchSize = max( atoi( argv[ ++i ] ), 1 );
+		else if ( strcmp( argv[ i ], "-w" ) == 0 )
+			world = true;
+		else
+			args.push_back( argv[ i ] );
+	}
+
+	if ( args.size() != 3 )
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		RigRef rig = Rig::create( fs::path( args[ 0 ] ) );
+		size_t numVertices = rig->getNumVertices();
+
+		// decode all weights up front, they are small compared to the vertices
+		ifstream is( args[ 1 ].c_str(), ios::in | ios::binary );
+		if ( !is )
+		{
+			cerr << "cannot open " << args[ 1 ] << endl;
+			return EXIT_FAILURE;
+		}
+
+		ciFaceShift faceShift;
+		size_t numBlendshapes = rig->getNumBlendshapes();
+		size_t numWeights = rig->getNumBlendWeights();
+		vector< float > weights;
+		vector< Rig::Pose > poses;
+		while ( faceShift.readFrame( is ) )
+		{
+			const vector< float >& frameWeights = faceShift.getBlendshapeWeights();
+			size_t frameOffset = weights.size();
+			for ( size_t i = 0; i < numWeights; i++ )
+				weights.push_back( ( i < min( numBlendshapes, frameWeights.size() ) ) ? frameWeights[ i ] : 0.f );
+			// the corrective activations follow the blendshape weights
+			if ( rig->getNumCorrectives() > 0 )
+				rig->evaluateCorrectives( &weights[ frameOffset ], numBlendshapes, &weights[ frameOffset + numBlendshapes ] );
+
+			if ( world )
+			{
+				Rig::Pose pose;
+				pose.mHeadRotation = faceShift.getRotation();
+				pose.mHeadPosition = faceShift.getPosition();
+				pose.mLeftEyeRotation = faceShift.getLeftEyeRotation();
+				pose.mRightEyeRotation = faceShift.getRightEyeRotation();
+				poses.push_back( pose );
+			}
+		}
+		size_t numFrames = ( numWeights > 0 ) ? weights.size() / numWeights : 0;
+
+		ofstream os( args[ 2 ].c_str(), ios::out | ios::binary | ios::trunc );
+		if ( !os )
+		{
+			cerr << "cannot create " << args[ 2 ] << endl;
+			return EXIT_FAILURE;
+		}
+
+		// PointCache2 header
+		os.write( "POINTCACHE2", 12 );
+		writeRaw( os, int32_t( 1 ) ); // file version
+		writeRaw( os, int32_t( numVertices ) );
+		writeRaw( os, 0.f ); // start frame
+		writeRaw( os, 1.f ); // sample rate
+		writeRaw( os, int32_t( numFrames ) );
+
+		// every thread blends a batch of frames, the batches are written in order
+		size_t framesPerPass = numThreads * batchSize;
+		vector< Vec3f > output( framesPerPass * numVertices );
+		for ( size_t first = 0; first < numFrames; first += framesPerPass )
+		{
+			size_t passFrames = min( framesPerPass, numFrames - first );
+
+			boost::thread_group threads;
+			for ( size_t t = 0; t * batchSize < passFrames; t++ )
+			{
+				size_t batchFrames = min( batchSize, passFrames - t * batchSize );
+				threads.create_thread( boost::bind( blendFrames, rig, &weights, numWeights, &poses,
+							first + t * batchSize, batchFrames, &output[ t * batchSize * numVertices ] ) );
+			}
+			threads.join_all();
+
+			os.write( reinterpret_cast< const char * >( &output[ 0 ] ),
+					  passFrames * numVertices * sizeof( Vec3f ) );
+		}
+
+		cout << "blended " << numFrames << " frames of " << numVertices << " vertices" << endl;
+	}
+	catch ( const std::exception &exc )
+	{
+		cerr << exc.what() << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}